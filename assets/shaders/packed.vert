@@ -0,0 +1,60 @@
+#version 450
+#extension GL_ARB_shading_language_include : require
+
+#include "shader_common.h"
+
+layout(binding = 0) uniform TOS_UBO
+{
+	mat4 V;
+	mat4 P;
+} ubo;
+
+layout(push_constant) uniform TOS_push_constant
+{
+	mat4 M;
+	int texture_idx;
+	float wireframe;
+	uint flags;
+	vec4 quantization_min;
+	vec4 quantization_extent;
+} push_constant;
+
+layout(location = 0) in uvec4 in_position_material;
+layout(location = 1) in vec2 in_uv;
+layout(location = 2) in vec2 in_normal;
+
+layout(location = 0) out vec2 out_uv;
+layout(location = 1) out vec3 out_normal;
+layout(location = 2) out uint out_material_idx;
+
+layout(location = 3) out float out_wireframe;
+layout(location = 4) out int out_texture_idx;
+layout(location = 5) out uint out_flags;
+
+vec3 decode_octahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+	return normalize(n);
+}
+
+void main()
+{
+	mat4 MVP = mat4(1.0);
+	if((push_constant.flags & TOS_SHADER_FLAG_NDC_GEOMETRY) < 1)
+		MVP = ubo.P * ubo.V * push_constant.M;
+
+	vec3 position = push_constant.quantization_min.xyz + vec3(in_position_material.xyz) / 65535.0 * push_constant.quantization_extent.xyz;
+	uint material = in_position_material.w;
+
+	out_uv = in_uv;
+	out_normal = (material & TOS_PACKED_MATERIAL_NO_NORMAL) != 0 ? vec3(0) : decode_octahedral(in_normal);
+	out_material_idx = material & TOS_PACKED_MATERIAL_MASK;
+
+	out_wireframe = push_constant.wireframe;
+	out_texture_idx = push_constant.texture_idx;
+	out_flags = push_constant.flags;
+
+	gl_Position = MVP * vec4(position, 1.0);
+}
@@ -1 +1,5 @@
-#define TOS_SHADER_FLAG_NDC_GEOMETRY (1 << 0)
\ No newline at end of file
+#define TOS_SHADER_FLAG_NDC_GEOMETRY (1 << 0)
+
+// Material field of TOS_packed_vertex
+#define TOS_PACKED_MATERIAL_MASK 0x7FFFu
+#define TOS_PACKED_MATERIAL_NO_NORMAL 0x8000u
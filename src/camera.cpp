@@ -46,6 +46,11 @@ TOS_ray TOS_camera::viewport_ray(float x, float y)
 	return TOS_ray::direction_magnitude(transform.position, glm::vec3(world)-transform.position, far);
 }
 
+TOS_frustum TOS_camera::frustum()
+{
+	return TOS_frustum::view_projection(P_cached * V());
+}
+
 void TOS_camera::tick()
 {
 	transform.tick();
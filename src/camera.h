@@ -27,6 +27,7 @@ public:
 	glm::mat4 V();
 	glm::mat4 P();
 	TOS_ray viewport_ray(float x, float y);
+	TOS_frustum frustum();
 	void tick();
 private:
 	glm::mat4 P_cached;
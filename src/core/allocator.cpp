@@ -0,0 +1,527 @@
+#include "allocator.h"
+
+#include "cowtools.h"
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+// Free regions are binned by size class: the first level is the power of
+// two below the size, the second splits that range into TLSF_SL_COUNT
+// linear steps. Sizes under TLSF_SL_COUNT share the first class.
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 48
+// Remainders smaller than this stay attached to the region they came from
+#define TLSF_MIN_SPLIT 64
+#define TLSF_NONE UINT32_MAX
+
+struct tlsf_node
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	// Neighbours by address in the block
+	uint32_t prev_physical;
+	uint32_t next_physical;
+	// Neighbours in the free list of the node's size class
+	uint32_t prev_free;
+	uint32_t next_free;
+	bool free;
+};
+
+struct memory_block
+{
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	uint8_t* mapped;
+	std::vector<tlsf_node> nodes;
+	std::vector<uint32_t> spare_nodes;
+	uint64_t fl_bitmap;
+	uint32_t sl_bitmaps[TLSF_FL_COUNT];
+	uint32_t heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+	VkDeviceSize used;
+	size_t allocation_count;
+};
+
+// Released blocks keep their slot with a null memory handle so that the
+// block indices held by live allocations stay valid
+struct memory_pool
+{
+	std::vector<memory_block> blocks;
+};
+
+struct TOS_memory_allocator
+{
+	memory_pool pools[VK_MAX_MEMORY_TYPES * 2];
+	size_t dedicated_count;
+	VkDeviceSize dedicated_size;
+	// Bytes held from each heap, blocks and dedicated allocations alike
+	VkDeviceSize heap_usage[VK_MAX_MEMORY_HEAPS];
+};
+
+static int floor_log2(VkDeviceSize value)
+{
+	return 63 - __builtin_clzll(value);
+}
+
+static void map_size(VkDeviceSize size, int* fl, int* sl)
+{
+	if(size < TLSF_SL_COUNT)
+	{
+		*fl = 0;
+		*sl = (int) size;
+		return;
+	}
+	int log2 = floor_log2(size);
+	*sl = (int) (size >> (log2 - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+	*fl = log2 - TLSF_SL_LOG2 + 1;
+}
+
+static void insert_free(memory_block* block, uint32_t index)
+{
+	tlsf_node& node = block->nodes[index];
+	int fl, sl;
+	map_size(node.size, &fl, &sl);
+	node.free = true;
+	node.prev_free = TLSF_NONE;
+	node.next_free = block->heads[fl][sl];
+	if(node.next_free != TLSF_NONE)
+		block->nodes[node.next_free].prev_free = index;
+	block->heads[fl][sl] = index;
+	block->fl_bitmap |= 1ull << fl;
+	block->sl_bitmaps[fl] |= 1u << sl;
+}
+
+static void remove_free(memory_block* block, uint32_t index)
+{
+	tlsf_node& node = block->nodes[index];
+	int fl, sl;
+	map_size(node.size, &fl, &sl);
+	if(node.prev_free != TLSF_NONE)
+		block->nodes[node.prev_free].next_free = node.next_free;
+	else
+		block->heads[fl][sl] = node.next_free;
+	if(node.next_free != TLSF_NONE)
+		block->nodes[node.next_free].prev_free = node.prev_free;
+	if(block->heads[fl][sl] == TLSF_NONE)
+	{
+		block->sl_bitmaps[fl] &= ~(1u << sl);
+		if(block->sl_bitmaps[fl] == 0)
+			block->fl_bitmap &= ~(1ull << fl);
+	}
+	node.free = false;
+}
+
+static uint32_t create_node(memory_block* block, VkDeviceSize offset, VkDeviceSize size)
+{
+	tlsf_node node = {offset, size, TLSF_NONE, TLSF_NONE, TLSF_NONE, TLSF_NONE, false};
+	if(!block->spare_nodes.empty())
+	{
+		uint32_t index = block->spare_nodes.back();
+		block->spare_nodes.pop_back();
+		block->nodes[index] = node;
+		return index;
+	}
+	block->nodes.push_back(node);
+	return (uint32_t) block->nodes.size() - 1;
+}
+
+// Finds a free region of at least size, rounding the request up to the
+// next class boundary so that any region in the class found is big enough
+static uint32_t find_free(memory_block* block, VkDeviceSize size)
+{
+	if(size >= TLSF_SL_COUNT)
+		size += (1ull << (floor_log2(size) - TLSF_SL_LOG2)) - 1;
+	int fl, sl;
+	map_size(size, &fl, &sl);
+	if(fl >= TLSF_FL_COUNT)
+		return TLSF_NONE;
+
+	uint32_t sl_map = sl < 32 ? block->sl_bitmaps[fl] & (~0u << sl) : 0;
+	if(sl_map == 0)
+	{
+		uint64_t fl_map = fl+1 < 64 ? block->fl_bitmap & (~0ull << (fl+1)) : 0;
+		if(fl_map == 0)
+			return TLSF_NONE;
+		fl = __builtin_ctzll(fl_map);
+		sl_map = block->sl_bitmaps[fl];
+	}
+	sl = __builtin_ctz(sl_map);
+	return block->heads[fl][sl];
+}
+
+static bool allocate_in_block(memory_block* block, VkDeviceSize size, VkDeviceSize alignment, uint32_t* result)
+{
+	// Looks for room for the worst-case padding so that one search suffices
+	VkDeviceSize padded = size + (alignment > 1 ? alignment - 1 : 0);
+	uint32_t index = find_free(block, padded);
+	if(index == TLSF_NONE)
+		return false;
+	remove_free(block, index);
+
+	// The front padding becomes a free region of its own. Free neighbours
+	// are always merged, so the region before it is in use.
+	VkDeviceSize offset = block->nodes[index].offset;
+	VkDeviceSize aligned = (offset + alignment-1) / alignment * alignment;
+	if(aligned > offset)
+	{
+		uint32_t front = create_node(block, offset, aligned - offset);
+		tlsf_node& node = block->nodes[index];
+		block->nodes[front].prev_physical = node.prev_physical;
+		block->nodes[front].next_physical = index;
+		if(node.prev_physical != TLSF_NONE)
+			block->nodes[node.prev_physical].next_physical = front;
+		node.prev_physical = front;
+		node.offset = aligned;
+		node.size -= aligned - offset;
+		insert_free(block, front);
+	}
+
+	if(block->nodes[index].size - size >= TLSF_MIN_SPLIT)
+	{
+		tlsf_node node = block->nodes[index];
+		uint32_t back = create_node(block, node.offset + size, node.size - size);
+		tlsf_node& split = block->nodes[index];
+		block->nodes[back].prev_physical = index;
+		block->nodes[back].next_physical = split.next_physical;
+		if(split.next_physical != TLSF_NONE)
+			block->nodes[split.next_physical].prev_physical = back;
+		split.next_physical = back;
+		split.size = size;
+		insert_free(block, back);
+	}
+
+	block->used += block->nodes[index].size;
+	block->allocation_count++;
+	*result = index;
+	return true;
+}
+
+// Absorbs the physical successor of index. Neither may be in a free list.
+static void merge_next(memory_block* block, uint32_t index)
+{
+	tlsf_node& node = block->nodes[index];
+	uint32_t next = node.next_physical;
+	node.size += block->nodes[next].size;
+	node.next_physical = block->nodes[next].next_physical;
+	if(node.next_physical != TLSF_NONE)
+		block->nodes[node.next_physical].prev_physical = index;
+	block->spare_nodes.push_back(next);
+}
+
+static void free_in_block(memory_block* block, uint32_t index)
+{
+	block->used -= block->nodes[index].size;
+	block->allocation_count--;
+
+	uint32_t prev = block->nodes[index].prev_physical;
+	if(prev != TLSF_NONE && block->nodes[prev].free)
+	{
+		remove_free(block, prev);
+		merge_next(block, prev);
+		index = prev;
+	}
+	uint32_t next = block->nodes[index].next_physical;
+	if(next != TLSF_NONE && block->nodes[next].free)
+	{
+		remove_free(block, next);
+		merge_next(block, index);
+	}
+	insert_free(block, index);
+}
+
+static VkResult allocate_device_memory(TOS_device* device, VkDeviceSize size, uint32_t memory_type, VkDeviceMemory* memory, void** mapped)
+{
+	VkMemoryAllocateInfo alloc_info {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = size;
+	alloc_info.memoryTypeIndex = memory_type;
+	VkResult result = vkAllocateMemory(device->logical, &alloc_info, nullptr, memory);
+	if(result != VK_SUCCESS)
+		return result;
+
+	*mapped = nullptr;
+	VkMemoryPropertyFlags flags = device->memory_properties.memoryTypes[memory_type].propertyFlags;
+	if(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		result = vkMapMemory(device->logical, *memory, 0, VK_WHOLE_SIZE, 0, mapped);
+		if(result != VK_SUCCESS)
+		{
+			vkFreeMemory(device->logical, *memory, nullptr);
+			return result;
+		}
+	}
+	device->allocator->heap_usage[device->memory_properties.memoryTypes[memory_type].heapIndex] += size;
+	return result;
+}
+
+static void free_device_memory(TOS_device* device, VkDeviceMemory memory, void* mapped, VkDeviceSize size, uint32_t memory_type)
+{
+	if(mapped != nullptr)
+		vkUnmapMemory(device->logical, memory);
+	vkFreeMemory(device->logical, memory, nullptr);
+	device->allocator->heap_usage[device->memory_properties.memoryTypes[memory_type].heapIndex] -= size;
+}
+
+static bool create_block(TOS_device* device, memory_pool* pool, uint32_t memory_type, VkDeviceSize size, uint32_t* result)
+{
+	VkDeviceMemory memory;
+	void* mapped;
+	if(allocate_device_memory(device, size, memory_type, &memory, &mapped) != VK_SUCCESS)
+		return false;
+
+	uint32_t index = 0;
+	while(index < pool->blocks.size() && pool->blocks[index].memory != VK_NULL_HANDLE)
+		index++;
+	if(index == pool->blocks.size())
+		pool->blocks.emplace_back();
+
+	memory_block& block = pool->blocks[index];
+	block = {};
+	block.memory = memory;
+	block.size = size;
+	block.mapped = (uint8_t*) mapped;
+	for(int fl = 0; fl < TLSF_FL_COUNT; fl++)
+	{
+		for(int sl = 0; sl < TLSF_SL_COUNT; sl++)
+			block.heads[fl][sl] = TLSF_NONE;
+	}
+	insert_free(&block, create_node(&block, 0, size));
+	*result = index;
+	return true;
+}
+
+static void release_block(TOS_device* device, memory_block* block, uint32_t memory_type)
+{
+	free_device_memory(device, block->memory, block->mapped, block->size, memory_type);
+	*block = {};
+}
+
+void TOS_create_memory_allocator(TOS_device* device)
+{
+	device->allocator = new TOS_memory_allocator {};
+}
+
+void TOS_destroy_memory_allocator(TOS_device* device)
+{
+	TOS_memory_allocator* allocator = device->allocator;
+	size_t leaked = allocator->dedicated_count;
+	for(uint32_t p = 0; p < VK_MAX_MEMORY_TYPES * 2; p++)
+	{
+		for(memory_block& block : allocator->pools[p].blocks)
+		{
+			if(block.memory == VK_NULL_HANDLE)
+				continue;
+			leaked += block.allocation_count;
+			release_block(device, &block, p / 2);
+		}
+	}
+	if(leaked > 0)
+		std::cerr << "TOS_destroy_memory_allocator: " << leaked << " allocations still live" << std::endl;
+	delete allocator;
+	device->allocator = nullptr;
+}
+
+uint32_t TOS_find_memory_type(TOS_device* device, uint32_t type_filter, VkMemoryPropertyFlags properties)
+{
+	const VkPhysicalDeviceMemoryProperties& memory_properties = device->memory_properties;
+	for(uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+	{
+		if
+		(
+			(type_filter & (1 << i)) &&
+			(memory_properties.memoryTypes[i].propertyFlags & properties) == properties
+		)
+		{
+			return i;
+		}
+	}
+	throw std::runtime_error("TOS_find_memory_type: failed to find suitable memory type");
+}
+
+VkDeviceSize TOS_get_heap_budget(TOS_device* device, uint32_t heap)
+{
+	VkDeviceSize share = (VkDeviceSize) (device->memory_properties.memoryHeaps[heap].size * TOS_HEAP_BUDGET_SHARE);
+	VkDeviceSize usage = device->allocator->heap_usage[heap];
+	return usage < share ? share - usage : 0;
+}
+
+// The first type with the preferred properties as well whose heap can still
+// take the request, otherwise the first type with the required ones
+static uint32_t choose_memory_type
+(
+	TOS_device* device, VkMemoryRequirements requirements,
+	VkMemoryPropertyFlags properties, VkMemoryPropertyFlags preferred
+)
+{
+	const VkPhysicalDeviceMemoryProperties& memory_properties = device->memory_properties;
+	VkMemoryPropertyFlags wanted = properties | preferred;
+	for(uint32_t i = 0; i < memory_properties.memoryTypeCount && preferred != 0; i++)
+	{
+		if
+		(
+			(requirements.memoryTypeBits & (1 << i)) &&
+			(memory_properties.memoryTypes[i].propertyFlags & wanted) == wanted &&
+			TOS_get_heap_budget(device, memory_properties.memoryTypes[i].heapIndex) >= requirements.size
+		)
+		{
+			return i;
+		}
+	}
+	return TOS_find_memory_type(device, requirements.memoryTypeBits, properties);
+}
+
+static TOS_allocation allocate_dedicated(TOS_device* device, VkDeviceSize size, uint32_t memory_type)
+{
+	TOS_allocation allocation {};
+	if(allocate_device_memory(device, size, memory_type, &allocation.memory, &allocation.mapped) != VK_SUCCESS)
+		throw std::runtime_error("TOS_allocate_memory: failed to allocate device memory");
+	allocation.size = size;
+	allocation.pool = TOS_DEDICATED_POOL;
+	allocation.block = memory_type;
+	device->allocator->dedicated_count++;
+	device->allocator->dedicated_size += size;
+	return allocation;
+}
+
+TOS_allocation TOS_allocate_memory(TOS_device* device, VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, TOS_resource_kind kind, VkMemoryPropertyFlags preferred)
+{
+	uint32_t memory_type = choose_memory_type(device, requirements, properties, preferred);
+	// Small heaps such as a 256 MiB device-local host-visible window get
+	// proportionally smaller blocks
+	uint32_t heap = device->memory_properties.memoryTypes[memory_type].heapIndex;
+	VkDeviceSize block_size = TOS_min(TOS_MEMORY_BLOCK_SIZE, device->memory_properties.memoryHeaps[heap].size / 8);
+	VkDeviceSize alignment = TOS_max(requirements.alignment, (VkDeviceSize) 1);
+	if(requirements.size >= TOS_DEDICATED_ALLOCATION_SIZE || requirements.size + alignment > block_size)
+		return allocate_dedicated(device, requirements.size, memory_type);
+
+	uint32_t pool_index = memory_type * 2 + kind;
+	memory_pool* pool = &device->allocator->pools[pool_index];
+	TOS_allocation allocation {};
+	allocation.pool = pool_index;
+	bool found = false;
+	for(uint32_t b = 0; b < pool->blocks.size() && !found; b++)
+	{
+		memory_block* block = &pool->blocks[b];
+		if(block->memory == VK_NULL_HANDLE)
+			continue;
+		found = allocate_in_block(block, requirements.size, alignment, &allocation.node);
+		allocation.block = b;
+	}
+	if(!found)
+	{
+		// Out of device memory for a whole block, the resource alone may still fit
+		if(!create_block(device, pool, memory_type, block_size, &allocation.block))
+			return allocate_dedicated(device, requirements.size, memory_type);
+		allocate_in_block(&pool->blocks[allocation.block], requirements.size, alignment, &allocation.node);
+	}
+
+	memory_block& block = pool->blocks[allocation.block];
+	const tlsf_node& node = block.nodes[allocation.node];
+	allocation.memory = block.memory;
+	allocation.offset = node.offset;
+	allocation.size = node.size;
+	allocation.mapped = block.mapped != nullptr ? block.mapped + node.offset : nullptr;
+	return allocation;
+}
+
+void TOS_free_memory(TOS_device* device, TOS_allocation* allocation)
+{
+	if(allocation->memory == VK_NULL_HANDLE)
+		return;
+	TOS_memory_allocator* allocator = device->allocator;
+	if(allocation->pool == TOS_DEDICATED_POOL)
+	{
+		free_device_memory(device, allocation->memory, allocation->mapped, allocation->size, allocation->block);
+		allocator->dedicated_count--;
+		allocator->dedicated_size -= allocation->size;
+		*allocation = {};
+		return;
+	}
+
+	memory_pool* pool = &allocator->pools[allocation->pool];
+	memory_block* block = &pool->blocks[allocation->block];
+	free_in_block(block, allocation->node);
+	// Keep one empty block per pool around so that a resource freed and
+	// created again each frame does not go back to the driver every time
+	if(block->allocation_count == 0)
+	{
+		for(uint32_t b = 0; b < pool->blocks.size(); b++)
+		{
+			if(b != allocation->block && pool->blocks[b].memory != VK_NULL_HANDLE)
+			{
+				release_block(device, block, allocation->pool / 2);
+				break;
+			}
+		}
+	}
+	*allocation = {};
+}
+
+static void add_block_stats(const memory_block& block, TOS_memory_stats* stats, VkDeviceSize* free_total)
+{
+	stats->block_count++;
+	stats->allocation_count += block.allocation_count;
+	stats->reserved += block.size;
+	stats->used += block.used;
+	for(uint32_t n = 0; n < block.nodes.size(); n++)
+	{
+		// Spare nodes are neither free nor used and hold stale sizes
+		if(!block.nodes[n].free)
+			continue;
+		stats->free_region_count++;
+		stats->largest_free_region = TOS_max(stats->largest_free_region, block.nodes[n].size);
+		*free_total += block.nodes[n].size;
+	}
+}
+
+static float fragmentation(const TOS_memory_stats& stats, VkDeviceSize free_total)
+{
+	return free_total > 0 ? 1.0f - (float) stats.largest_free_region / free_total : 0.0f;
+}
+
+TOS_memory_stats TOS_get_memory_stats(TOS_device* device)
+{
+	TOS_memory_allocator* allocator = device->allocator;
+	TOS_memory_stats stats {};
+	VkDeviceSize free_total = 0;
+	for(const memory_pool& pool : allocator->pools)
+	{
+		for(const memory_block& block : pool.blocks)
+		{
+			if(block.memory != VK_NULL_HANDLE)
+				add_block_stats(block, &stats, &free_total);
+		}
+	}
+	stats.dedicated_count = allocator->dedicated_count;
+	stats.allocation_count += allocator->dedicated_count;
+	stats.reserved += allocator->dedicated_size;
+	stats.used += allocator->dedicated_size;
+	stats.fragmentation = fragmentation(stats, free_total);
+	return stats;
+}
+
+void TOS_print_memory_stats(TOS_device* device)
+{
+	TOS_memory_allocator* allocator = device->allocator;
+	const double MiB = 1024.0 * 1024.0;
+	for(uint32_t p = 0; p < VK_MAX_MEMORY_TYPES * 2; p++)
+	{
+		TOS_memory_stats stats {};
+		VkDeviceSize free_total = 0;
+		for(const memory_block& block : allocator->pools[p].blocks)
+		{
+			if(block.memory != VK_NULL_HANDLE)
+				add_block_stats(block, &stats, &free_total);
+		}
+		if(stats.block_count == 0)
+			continue;
+		std::cout << "TOS_memory: type " << p / 2 << (p % 2 == TOS_RESOURCE_LINEAR ? " linear" : " optimal")
+		<< ", " << stats.block_count << " blocks, " << stats.allocation_count << " allocations, "
+		<< stats.used / MiB << " of " << stats.reserved / MiB << " MiB used, "
+		<< stats.free_region_count << " free regions, fragmentation " << fragmentation(stats, free_total) << "\n";
+	}
+	TOS_memory_stats total = TOS_get_memory_stats(device);
+	std::cout << "TOS_memory: " << total.allocation_count << " allocations, "
+	<< total.dedicated_count << " dedicated, "
+	<< total.used / MiB << " of " << total.reserved / MiB << " MiB used" << std::endl;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "device.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Sub-allocation of device memory. Every memory type keeps two pools of
+// large blocks, one for buffers and linearly tiled images and one for
+// optimally tiled images, so neighbours in a block never need padding for
+// bufferImageGranularity. Blocks are carved up by a two-level segregated
+// fit allocator (Masmoudi et al. 2004), which finds a free region and
+// merges freed ones in constant time. Resources too large to share a block
+// get memory of their own.
+
+#define TOS_MEMORY_BLOCK_SIZE (64ull << 20)
+#define TOS_DEDICATED_ALLOCATION_SIZE (TOS_MEMORY_BLOCK_SIZE / 4)
+#define TOS_DEDICATED_POOL UINT32_MAX
+// Share of a heap's size the renderer lets itself fill with preferred
+// placements. The instance targets Vulkan 1.0 without VK_EXT_memory_budget,
+// so the heap size is all there is to go by.
+#define TOS_HEAP_BUDGET_SHARE 0.75
+
+enum TOS_resource_kind
+{
+	TOS_RESOURCE_LINEAR,
+	TOS_RESOURCE_OPTIMAL
+};
+
+struct TOS_allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Address of offset in the block's persistent mapping, or null when the
+	// memory is not host visible
+	void* mapped = nullptr;
+	// Where the region came from, for TOS_free_memory. Dedicated allocations
+	// keep their memory type in block.
+	uint32_t pool = TOS_DEDICATED_POOL;
+	uint32_t block = 0;
+	uint32_t node = 0;
+};
+
+struct TOS_memory_stats
+{
+	size_t block_count;
+	size_t dedicated_count;
+	size_t allocation_count;
+	// Bytes held from the driver, dedicated allocations included
+	VkDeviceSize reserved;
+	VkDeviceSize used;
+	size_t free_region_count;
+	VkDeviceSize largest_free_region;
+	// Share of the free space in blocks outside the largest free region,
+	// 0 when it is all one piece
+	float fragmentation;
+};
+
+void TOS_create_memory_allocator(TOS_device* device);
+void TOS_destroy_memory_allocator(TOS_device* device);
+
+uint32_t TOS_find_memory_type(TOS_device* device, uint32_t type_filter, VkMemoryPropertyFlags properties);
+// Memory types that also have the preferred properties are taken first, as
+// long as their heap has budget left for the request
+TOS_allocation TOS_allocate_memory(TOS_device* device, VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, TOS_resource_kind kind, VkMemoryPropertyFlags preferred=0);
+void TOS_free_memory(TOS_device* device, TOS_allocation* allocation);
+// Bytes of the heap still within TOS_HEAP_BUDGET_SHARE of its size
+VkDeviceSize TOS_get_heap_budget(TOS_device* device, uint32_t heap);
+
+TOS_memory_stats TOS_get_memory_stats(TOS_device* device);
+// One line per pool in use, then the totals
+void TOS_print_memory_stats(TOS_device* device);
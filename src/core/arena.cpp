@@ -0,0 +1,185 @@
+#include "arena.h"
+
+#include "memory.h"
+#include "upload.h"
+#include "cowtools.h"
+#include <string.h>
+#include <algorithm>
+
+TOS_geometry_arena TOS_arena;
+
+void TOS_create_range_allocator(TOS_range_allocator* allocator, VkDeviceSize capacity)
+{
+	allocator->capacity = capacity;
+	allocator->used = 0;
+	allocator->free_blocks.clear();
+	if(capacity > 0)
+		allocator->free_blocks.push_back({0, capacity});
+}
+
+bool TOS_range_allocate(TOS_range_allocator* allocator, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+	std::vector<TOS_free_block>& blocks = allocator->free_blocks;
+	for(size_t i = 0; i < blocks.size(); i++)
+	{
+		TOS_free_block block = blocks[i];
+		// Alignments need not be powers of two, vertex strides are not
+		VkDeviceSize start = (block.offset + alignment-1) / alignment * alignment;
+		VkDeviceSize end = start + size;
+		if(end > block.offset + block.size)
+			continue;
+
+		// The padding before start and the tail after end stay free
+		TOS_free_block head = {block.offset, start - block.offset};
+		TOS_free_block tail = {end, block.offset + block.size - end};
+		blocks.erase(blocks.begin() + i);
+		if(tail.size > 0)
+			blocks.insert(blocks.begin() + i, tail);
+		if(head.size > 0)
+			blocks.insert(blocks.begin() + i, head);
+
+		allocator->used += size;
+		*offset = start;
+		return true;
+	}
+	return false;
+}
+
+void TOS_range_free(TOS_range_allocator* allocator, VkDeviceSize offset, VkDeviceSize size)
+{
+	if(size == 0)
+		return;
+	std::vector<TOS_free_block>& blocks = allocator->free_blocks;
+	auto next = std::lower_bound
+	(
+		blocks.begin(), blocks.end(), offset,
+		[](const TOS_free_block& block, VkDeviceSize offset)
+		{
+			return block.offset < offset;
+		}
+	);
+	size_t i = next - blocks.begin();
+	blocks.insert(next, {offset, size});
+	allocator->used -= size;
+
+	if(i+1 < blocks.size() && blocks[i].offset + blocks[i].size == blocks[i+1].offset)
+	{
+		blocks[i].size += blocks[i+1].size;
+		blocks.erase(blocks.begin() + i+1);
+	}
+	if(i > 0 && blocks[i-1].offset + blocks[i-1].size == blocks[i].offset)
+	{
+		blocks[i-1].size += blocks[i].size;
+		blocks.erase(blocks.begin() + i);
+	}
+}
+
+static void add_page(TOS_device* device, TOS_geometry_pool* pool, VkDeviceSize capacity)
+{
+	TOS_geometry_page page;
+	TOS_create_buffer
+	(
+		device, capacity,
+		pool->usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		page.buffer, page.memory,
+		TOS_GEOMETRY_ARENA_DIRECT_PROPERTIES
+	);
+	TOS_create_range_allocator(&page.ranges, capacity);
+	pool->pages.push_back(page);
+}
+
+static void destroy_pool(TOS_device* device, TOS_geometry_pool* pool)
+{
+	for(TOS_geometry_page& page : pool->pages)
+	{
+		vkDestroyBuffer(device->logical, page.buffer, nullptr);
+		TOS_free_memory(device, &page.memory);
+	}
+	*pool = {};
+}
+
+void TOS_create_geometry_arena(TOS_device* device, VkDeviceSize vertex_capacity, VkDeviceSize index_capacity)
+{
+	TOS_arena = {};
+	TOS_arena.vertices.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	TOS_arena.vertices.page_capacity = vertex_capacity;
+	add_page(device, &TOS_arena.vertices, vertex_capacity);
+
+	TOS_arena.indices.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	TOS_arena.indices.page_capacity = index_capacity;
+	add_page(device, &TOS_arena.indices, index_capacity);
+}
+
+void TOS_destroy_geometry_arena(TOS_device* device)
+{
+	destroy_pool(device, &TOS_arena.indices);
+	destroy_pool(device, &TOS_arena.vertices);
+	TOS_arena = {};
+}
+
+static TOS_geometry_allocation upload
+(
+	TOS_device* device, TOS_geometry_pool* pool,
+	const void* data, VkDeviceSize size, VkDeviceSize alignment
+)
+{
+	TOS_geometry_allocation allocation {};
+	if(size == 0)
+		return allocation;
+	bool placed = false;
+	for(uint32_t i = 0; i < pool->pages.size() && !placed; i++)
+	{
+		allocation.page = i;
+		placed = TOS_range_allocate(&pool->pages[i].ranges, size, alignment, &allocation.offset);
+	}
+	if(!placed)
+	{
+		// A fresh page is empty, so its block starts at offset 0
+		add_page(device, pool, TOS_max(pool->page_capacity, size));
+		allocation.page = (uint32_t) pool->pages.size() - 1;
+		TOS_range_allocate(&pool->pages.back().ranges, size, alignment, &allocation.offset);
+	}
+	allocation.size = size;
+
+	// Host coherent memory needs no flush, and the next queue submission
+	// makes the writes visible to the GPU
+	TOS_geometry_page& page = pool->pages[allocation.page];
+	if(page.memory.mapped != nullptr)
+	{
+		memcpy((uint8_t*) page.memory.mapped + allocation.offset, data, size);
+		TOS_arena.stats.direct_uploads++;
+		TOS_arena.stats.direct_bytes += size;
+	}
+	else
+	{
+		TOS_upload_buffer(device, page.buffer, allocation.offset, data, size);
+		TOS_arena.stats.staged_uploads++;
+		TOS_arena.stats.staged_bytes += size;
+	}
+	return allocation;
+}
+
+TOS_geometry_allocation TOS_upload_vertices(TOS_device* device, const void* data, VkDeviceSize size, VkDeviceSize stride)
+{
+	return upload(device, &TOS_arena.vertices, data, size, stride);
+}
+
+TOS_geometry_allocation TOS_upload_indices(TOS_device* device, const void* data, VkDeviceSize size, VkDeviceSize index_size)
+{
+	return upload(device, &TOS_arena.indices, data, size, index_size);
+}
+
+void TOS_free_vertices(TOS_geometry_allocation* allocation)
+{
+	if(allocation->size > 0)
+		TOS_range_free(&TOS_arena.vertices.pages[allocation->page].ranges, allocation->offset, allocation->size);
+	*allocation = {};
+}
+
+void TOS_free_indices(TOS_geometry_allocation* allocation)
+{
+	if(allocation->size > 0)
+		TOS_range_free(&TOS_arena.indices.pages[allocation->page].ranges, allocation->offset, allocation->size);
+	*allocation = {};
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "device.h"
+#include "allocator.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Vertex and index buffers shared by every mesh. Meshes take blocks of them
+// through a free list, so loading a mesh rarely allocates device memory and
+// draws mostly move firstIndex and vertexOffset. Vertex blocks are aligned
+// to their vertex stride and index blocks to their index size, which lets
+// both buffers stay bound at offset 0 for any format.
+//
+// The buffers come in pages. When no page has room for a mesh, another is
+// chained on, as large as the default capacity or the mesh, whichever is
+// larger, so meshes of any size still load. Draws rebind only when a mesh
+// lives in a different page than the previous one. Pages are kept until the
+// arena is destroyed, even once empty.
+//
+// Where the device has memory that is both device local and host visible,
+// as on integrated GPUs and with resizable BAR, the buffers live there
+// while the heap has room and meshes are written straight into them.
+// Otherwise they go through the staging ring.
+
+#define TOS_GEOMETRY_ARENA_VERTEX_CAPACITY (64 << 20)
+#define TOS_GEOMETRY_ARENA_INDEX_CAPACITY (32 << 20)
+#define TOS_GEOMETRY_ARENA_DIRECT_PROPERTIES (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+
+struct TOS_free_block
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+// First-fit allocator over a range of offsets. Free blocks are kept sorted
+// by offset so that freeing coalesces with both neighbours.
+struct TOS_range_allocator
+{
+	VkDeviceSize capacity = 0;
+	VkDeviceSize used = 0;
+	std::vector<TOS_free_block> free_blocks;
+};
+
+void TOS_create_range_allocator(TOS_range_allocator* allocator, VkDeviceSize capacity);
+// Returns false when no free block fits size at the given alignment
+bool TOS_range_allocate(TOS_range_allocator* allocator, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+void TOS_range_free(TOS_range_allocator* allocator, VkDeviceSize offset, VkDeviceSize size);
+
+// A block of one of the arena's vertex or index pages
+struct TOS_geometry_allocation
+{
+	uint32_t page = 0;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+};
+
+// How mesh data reached the arena: written through the mapping or copied
+// from the staging ring
+struct TOS_geometry_upload_stats
+{
+	size_t direct_uploads;
+	VkDeviceSize direct_bytes;
+	size_t staged_uploads;
+	VkDeviceSize staged_bytes;
+};
+
+struct TOS_geometry_page
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	TOS_allocation memory;
+	TOS_range_allocator ranges;
+};
+
+// The pages holding either vertices or indices
+struct TOS_geometry_pool
+{
+	VkBufferUsageFlags usage = 0;
+	VkDeviceSize page_capacity = 0;
+	std::vector<TOS_geometry_page> pages;
+};
+
+struct TOS_geometry_arena
+{
+	TOS_geometry_pool vertices;
+	TOS_geometry_pool indices;
+	TOS_geometry_upload_stats stats {};
+};
+
+extern TOS_geometry_arena TOS_arena;
+
+void TOS_create_geometry_arena(TOS_device* device, VkDeviceSize vertex_capacity=TOS_GEOMETRY_ARENA_VERTEX_CAPACITY, VkDeviceSize index_capacity=TOS_GEOMETRY_ARENA_INDEX_CAPACITY);
+void TOS_destroy_geometry_arena(TOS_device* device);
+
+// Copies data into a new block of a vertex or index page, chaining on a new
+// page when none has room
+TOS_geometry_allocation TOS_upload_vertices(TOS_device* device, const void* data, VkDeviceSize size, VkDeviceSize stride);
+TOS_geometry_allocation TOS_upload_indices(TOS_device* device, const void* data, VkDeviceSize size, VkDeviceSize index_size);
+// The block is reusable at once, so the GPU must be done drawing from it
+void TOS_free_vertices(TOS_geometry_allocation* allocation);
+void TOS_free_indices(TOS_geometry_allocation* allocation);
@@ -0,0 +1,775 @@
+#include "bcn.h"
+
+#include "threads.h"
+#include "cowtools.h"
+#include <math.h>
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#define BLOCK_TEXELS 16
+// Least squares passes over the endpoints after the first fit
+#define REFINE_PASSES 2
+// Power iterations toward the principal axis of a block's colours
+#define AXIS_ITERATIONS 8
+
+// BC7 interpolation weights for 4 bit indices, out of 64
+static const int bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+static bool is_bc1(VkFormat format)
+{
+	return
+	format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGB_UNORM_BLOCK ||
+	format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+}
+
+static bool is_bc3(VkFormat format)
+{
+	return format == VK_FORMAT_BC3_SRGB_BLOCK || format == VK_FORMAT_BC3_UNORM_BLOCK;
+}
+
+static bool is_bc7(VkFormat format)
+{
+	return format == VK_FORMAT_BC7_SRGB_BLOCK || format == VK_FORMAT_BC7_UNORM_BLOCK;
+}
+
+static bool is_opaque(const TOS_image* image)
+{
+	for(size_t i = 3; i < image->size; i += 4)
+	{
+		if(image->pixels[i] != 255)
+			return false;
+	}
+	return true;
+}
+
+VkFormat TOS_get_compressed_format(TOS_texture_compression compression, const TOS_image* image)
+{
+	switch(compression)
+	{
+		case TOS_TEXTURE_COMPRESSION_NONE:
+			return VK_FORMAT_R8G8B8A8_SRGB;
+		case TOS_TEXTURE_COMPRESSION_BC1:
+			return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		case TOS_TEXTURE_COMPRESSION_BC3:
+			return VK_FORMAT_BC3_SRGB_BLOCK;
+		case TOS_TEXTURE_COMPRESSION_BC7:
+			return VK_FORMAT_BC7_SRGB_BLOCK;
+		case TOS_TEXTURE_COMPRESSION_AUTO:
+			return is_opaque(image) ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC7_SRGB_BLOCK;
+	}
+	return VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+uint32_t TOS_get_block_size(VkFormat format)
+{
+	if(is_bc1(format))
+		return 8;
+	if(is_bc3(format) || is_bc7(format))
+		return 16;
+	return 0;
+}
+
+size_t TOS_get_compressed_size(VkFormat format, uint32_t width, uint32_t height)
+{
+	size_t blocks_wide = (width + 3) / 4;
+	size_t blocks_high = (height + 3) / 4;
+	return blocks_wide * blocks_high * TOS_get_block_size(format);
+}
+
+static void load_block(const TOS_image* image, uint32_t block_x, uint32_t block_y, uint8_t texels[BLOCK_TEXELS][4])
+{
+	for(uint32_t y = 0; y < 4; y++)
+	{
+		uint32_t row = TOS_min(block_y * 4 + y, image->height - 1);
+		for(uint32_t x = 0; x < 4; x++)
+		{
+			uint32_t column = TOS_min(block_x * 4 + x, image->width - 1);
+			memcpy(texels[y * 4 + x], image->pixels + ((size_t) row * image->width + column) * 4, 4);
+		}
+	}
+}
+
+static void store_block(TOS_image* image, uint32_t block_x, uint32_t block_y, const uint8_t texels[BLOCK_TEXELS][4])
+{
+	for(uint32_t y = 0; y < 4 && block_y * 4 + y < image->height; y++)
+	{
+		for(uint32_t x = 0; x < 4 && block_x * 4 + x < image->width; x++)
+		{
+			size_t index = ((size_t) (block_y * 4 + y) * image->width + block_x * 4 + x) * 4;
+			memcpy(image->pixels + index, texels[y * 4 + x], 4);
+		}
+	}
+}
+
+// Mean and principal axis of the first channels of a block. The axis is
+// left at zero when every texel is the same.
+static void fit_axis(const uint8_t texels[BLOCK_TEXELS][4], int channels, float mean[4], float axis[4])
+{
+	for(int c = 0; c < 4; c++)
+		mean[c] = axis[c] = 0.0f;
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		for(int c = 0; c < channels; c++)
+			mean[c] += texels[i][c];
+	}
+	for(int c = 0; c < channels; c++)
+		mean[c] /= BLOCK_TEXELS;
+
+	float covariance[4][4] = {};
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		float d[4];
+		for(int c = 0; c < channels; c++)
+			d[c] = texels[i][c] - mean[c];
+		for(int a = 0; a < channels; a++)
+		{
+			for(int b = 0; b < channels; b++)
+				covariance[a][b] += d[a] * d[b];
+		}
+	}
+
+	// Starting from the channel that varies most keeps the iteration off
+	// vectors orthogonal to the axis
+	int widest = 0;
+	for(int c = 1; c < channels; c++)
+	{
+		if(covariance[c][c] > covariance[widest][widest])
+			widest = c;
+	}
+	if(covariance[widest][widest] <= 0.0f)
+		return;
+	float v[4] = {};
+	for(int c = 0; c < channels; c++)
+		v[c] = covariance[widest][c];
+	for(int iteration = 0; iteration < AXIS_ITERATIONS; iteration++)
+	{
+		float next[4] = {};
+		float length = 0.0f;
+		for(int a = 0; a < channels; a++)
+		{
+			for(int b = 0; b < channels; b++)
+				next[a] += covariance[a][b] * v[b];
+			length += next[a] * next[a];
+		}
+		if(length <= 0.0f)
+			return;
+		length = 1.0f / sqrtf(length);
+		for(int c = 0; c < channels; c++)
+			v[c] = next[c] * length;
+	}
+	for(int c = 0; c < channels; c++)
+		axis[c] = v[c];
+}
+
+// Endpoints at the extremes of the block's projections onto its axis
+static void fit_endpoints(const uint8_t texels[BLOCK_TEXELS][4], int channels, float e0[4], float e1[4])
+{
+	float mean[4], axis[4];
+	fit_axis(texels, channels, mean, axis);
+	float low = 0.0f, high = 0.0f;
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		float t = 0.0f;
+		for(int c = 0; c < channels; c++)
+			t += (texels[i][c] - mean[c]) * axis[c];
+		low = TOS_min(low, t);
+		high = TOS_max(high, t);
+	}
+	for(int c = 0; c < 4; c++)
+	{
+		e0[c] = mean[c] + axis[c] * high;
+		e1[c] = mean[c] + axis[c] * low;
+	}
+}
+
+// Solves for the two endpoints that best reproduce the block, given each
+// texel's weight toward the second one. Returns false when the weights
+// cannot separate them, as when every texel picked the same index.
+static bool solve_endpoints(const uint8_t texels[BLOCK_TEXELS][4], int channels, const float weights[BLOCK_TEXELS], float e0[4], float e1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		float b = weights[i];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for(int c = 0; c < channels; c++)
+		{
+			ax[c] += a * texels[i][c];
+			bx[c] += b * texels[i][c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if(fabsf(determinant) < 1e-6f)
+		return false;
+	float inverse = 1.0f / determinant;
+	for(int c = 0; c < channels; c++)
+	{
+		e0[c] = TOS_clamp((bb * ax[c] - ab * bx[c]) * inverse, 0.0f, 255.0f);
+		e1[c] = TOS_clamp((aa * bx[c] - ab * ax[c]) * inverse, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+// BC1 colour
+
+static uint16_t pack_565(const float colour[4])
+{
+	int r = (int) (TOS_clamp(colour[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	int g = (int) (TOS_clamp(colour[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+	int b = (int) (TOS_clamp(colour[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	return (uint16_t) ((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t packed, int colour[3])
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	colour[0] = (r << 3) | (r >> 2);
+	colour[1] = (g << 2) | (g >> 4);
+	colour[2] = (b << 3) | (b >> 2);
+}
+
+// The four colour palette, in index order
+static void get_colour_palette(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for(int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+}
+
+static uint32_t choose_colour_indices(const uint8_t texels[BLOCK_TEXELS][4], uint16_t c0, uint16_t c1, uint8_t indices[BLOCK_TEXELS])
+{
+	int palette[4][3];
+	get_colour_palette(c0, c1, palette);
+	uint32_t error = 0;
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		uint32_t best = UINT32_MAX;
+		for(uint8_t p = 0; p < 4; p++)
+		{
+			uint32_t distance = 0;
+			for(int c = 0; c < 3; c++)
+			{
+				int d = texels[i][c] - palette[p][c];
+				distance += d * d;
+			}
+			if(distance < best)
+			{
+				best = distance;
+				indices[i] = p;
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+// Always in four colour mode, which BC3 assumes regardless of the order of
+// the endpoints
+static void encode_colour_block(const uint8_t texels[BLOCK_TEXELS][4], uint8_t* block)
+{
+	static const float index_weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+	float e0[4], e1[4];
+	fit_endpoints(texels, 3, e0, e1);
+	uint16_t c0 = pack_565(e0);
+	uint16_t c1 = pack_565(e1);
+	uint8_t indices[BLOCK_TEXELS];
+	uint32_t error = choose_colour_indices(texels, c0, c1, indices);
+
+	for(int pass = 0; pass < REFINE_PASSES && error > 0; pass++)
+	{
+		float weights[BLOCK_TEXELS];
+		for(int i = 0; i < BLOCK_TEXELS; i++)
+			weights[i] = index_weights[indices[i]];
+		if(!solve_endpoints(texels, 3, weights, e0, e1))
+			break;
+		uint16_t refined0 = pack_565(e0);
+		uint16_t refined1 = pack_565(e1);
+		uint8_t refined_indices[BLOCK_TEXELS];
+		uint32_t refined_error = choose_colour_indices(texels, refined0, refined1, refined_indices);
+		if(refined_error >= error)
+			break;
+		c0 = refined0;
+		c1 = refined1;
+		error = refined_error;
+		memcpy(indices, refined_indices, sizeof(indices));
+	}
+
+	// Four colour mode needs the first endpoint to be the greater one
+	if(c0 < c1)
+	{
+		uint16_t swap = c0;
+		c0 = c1;
+		c1 = swap;
+		for(int i = 0; i < BLOCK_TEXELS; i++)
+			indices[i] ^= 1;
+	}
+	uint32_t bits = 0;
+	if(c0 != c1)
+	{
+		for(int i = 0; i < BLOCK_TEXELS; i++)
+			bits |= (uint32_t) indices[i] << (2 * i);
+	}
+	block[0] = c0 & 0xFF;
+	block[1] = c0 >> 8;
+	block[2] = c1 & 0xFF;
+	block[3] = c1 >> 8;
+	memcpy(block + 4, &bits, 4);
+}
+
+static void decode_colour_block(const uint8_t* block, bool four_colour_only, uint8_t texels[BLOCK_TEXELS][4])
+{
+	uint16_t c0 = block[0] | (block[1] << 8);
+	uint16_t c1 = block[2] | (block[3] << 8);
+	uint32_t bits;
+	memcpy(&bits, block + 4, 4);
+
+	int palette[4][4];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for(int c = 0; c < 3; c++)
+	{
+		if(c0 > c1 || four_colour_only)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		const int* colour = palette[(bits >> (2 * i)) & 3];
+		for(int c = 0; c < 4; c++)
+			texels[i][c] = (uint8_t) colour[c];
+	}
+}
+
+// BC3 alpha
+
+static void get_alpha_palette(int a0, int a1, int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if(a0 > a1)
+	{
+		for(int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	}
+	else
+	{
+		for(int i = 2; i < 6; i++)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void encode_alpha_block(const uint8_t texels[BLOCK_TEXELS][4], uint8_t* block)
+{
+	int low = 255, high = 0;
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		low = TOS_min(low, (int) texels[i][3]);
+		high = TOS_max(high, (int) texels[i][3]);
+	}
+	// Eight interpolated values between the extremes, or one value when
+	// the block is flat
+	int palette[8];
+	get_alpha_palette(high, low, palette);
+	uint64_t bits = 0;
+	for(int i = 0; i < BLOCK_TEXELS && high != low; i++)
+	{
+		int best = 256;
+		uint64_t index = 0;
+		for(int p = 0; p < 8; p++)
+		{
+			int distance = abs(texels[i][3] - palette[p]);
+			if(distance < best)
+			{
+				best = distance;
+				index = p;
+			}
+		}
+		bits |= index << (3 * i);
+	}
+	block[0] = (uint8_t) high;
+	block[1] = (uint8_t) low;
+	for(int b = 0; b < 6; b++)
+		block[2 + b] = (uint8_t) (bits >> (8 * b));
+}
+
+static void decode_alpha_block(const uint8_t* block, uint8_t texels[BLOCK_TEXELS][4])
+{
+	int palette[8];
+	get_alpha_palette(block[0], block[1], palette);
+	uint64_t bits = 0;
+	for(int b = 0; b < 6; b++)
+		bits |= (uint64_t) block[2 + b] << (8 * b);
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+		texels[i][3] = (uint8_t) palette[(bits >> (3 * i)) & 7];
+}
+
+// BC7 mode 6
+
+// Fields of a block in order from its least significant bit
+struct bit_stream
+{
+	uint8_t* data;
+	uint32_t position;
+};
+
+static void write_bits(bit_stream* stream, uint32_t value, uint32_t count)
+{
+	for(uint32_t i = 0; i < count; i++, stream->position++)
+	{
+		if(value >> i & 1)
+			stream->data[stream->position / 8] |= 1 << (stream->position % 8);
+	}
+}
+
+static uint32_t read_bits(bit_stream* stream, uint32_t count)
+{
+	uint32_t value = 0;
+	for(uint32_t i = 0; i < count; i++, stream->position++)
+		value |= (uint32_t) (stream->data[stream->position / 8] >> (stream->position % 8) & 1) << i;
+	return value;
+}
+
+// An endpoint as stored: 7 bits per channel and a shared low bit
+struct bc7_endpoint
+{
+	uint8_t channels[4];
+	uint8_t p;
+};
+
+static bc7_endpoint quantize_bc7(const float colour[4], uint8_t p)
+{
+	bc7_endpoint endpoint {};
+	endpoint.p = p;
+	for(int c = 0; c < 4; c++)
+		endpoint.channels[c] = (uint8_t) TOS_clamp((int) ((colour[c] - p) * 0.5f + 0.5f), 0, 127);
+	return endpoint;
+}
+
+static void get_bc7_palette(const bc7_endpoint* e0, const bc7_endpoint* e1, int palette[16][4])
+{
+	for(int c = 0; c < 4; c++)
+	{
+		int v0 = e0->channels[c] << 1 | e0->p;
+		int v1 = e1->channels[c] << 1 | e1->p;
+		for(int i = 0; i < 16; i++)
+			palette[i][c] = ((64 - bc7_weights[i]) * v0 + bc7_weights[i] * v1 + 32) >> 6;
+	}
+}
+
+// Nearest 4 bit index for each position along the endpoints, in 64ths
+static const uint8_t* get_bc7_index_table()
+{
+	static uint8_t table[65];
+	static bool filled = []()
+	{
+		for(int t = 0; t <= 64; t++)
+		{
+			int best = 0;
+			for(int i = 1; i < 16; i++)
+			{
+				if(abs(bc7_weights[i] - t) < abs(bc7_weights[best] - t))
+					best = i;
+			}
+			table[t] = (uint8_t) best;
+		}
+		return true;
+	}();
+	(void) filled;
+	return table;
+}
+
+// Indices come from each texel's projection onto the segment between the
+// endpoints, which for one subset is nearly always the nearest entry
+static uint32_t choose_bc7_indices(const uint8_t texels[BLOCK_TEXELS][4], const bc7_endpoint* e0, const bc7_endpoint* e1, uint8_t indices[BLOCK_TEXELS])
+{
+	const uint8_t* table = get_bc7_index_table();
+	int palette[16][4];
+	get_bc7_palette(e0, e1, palette);
+	int direction[4];
+	int length = 0;
+	for(int c = 0; c < 4; c++)
+	{
+		direction[c] = palette[15][c] - palette[0][c];
+		length += direction[c] * direction[c];
+	}
+
+	uint32_t error = 0;
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		int index = 0;
+		if(length > 0)
+		{
+			int dot = 0;
+			for(int c = 0; c < 4; c++)
+				dot += (texels[i][c] - palette[0][c]) * direction[c];
+			index = table[TOS_clamp((dot * 64 + length / 2) / length, 0, 64)];
+		}
+		indices[i] = (uint8_t) index;
+		for(int c = 0; c < 4; c++)
+		{
+			int d = texels[i][c] - palette[index][c];
+			error += d * d;
+		}
+	}
+	return error;
+}
+
+// Tries every pairing of low bits, since they move all four channels
+static uint32_t quantize_bc7_endpoints(const uint8_t texels[BLOCK_TEXELS][4], const float e0[4], const float e1[4], bc7_endpoint endpoints[2], uint8_t indices[BLOCK_TEXELS])
+{
+	uint32_t best = UINT32_MAX;
+	for(uint8_t p = 0; p < 4; p++)
+	{
+		bc7_endpoint candidate[2] = {quantize_bc7(e0, p & 1), quantize_bc7(e1, p >> 1)};
+		uint8_t candidate_indices[BLOCK_TEXELS];
+		uint32_t error = choose_bc7_indices(texels, &candidate[0], &candidate[1], candidate_indices);
+		if(error < best)
+		{
+			best = error;
+			endpoints[0] = candidate[0];
+			endpoints[1] = candidate[1];
+			memcpy(indices, candidate_indices, BLOCK_TEXELS);
+		}
+	}
+	return best;
+}
+
+static void encode_bc7_block(const uint8_t texels[BLOCK_TEXELS][4], uint8_t* block)
+{
+	float e0[4], e1[4];
+	fit_endpoints(texels, 4, e0, e1);
+	bc7_endpoint endpoints[2];
+	uint8_t indices[BLOCK_TEXELS];
+	uint32_t error = quantize_bc7_endpoints(texels, e0, e1, endpoints, indices);
+
+	for(int pass = 0; pass < REFINE_PASSES && error > 0; pass++)
+	{
+		float weights[BLOCK_TEXELS];
+		for(int i = 0; i < BLOCK_TEXELS; i++)
+			weights[i] = bc7_weights[indices[i]] / 64.0f;
+		if(!solve_endpoints(texels, 4, weights, e0, e1))
+			break;
+		bc7_endpoint refined[2];
+		uint8_t refined_indices[BLOCK_TEXELS];
+		uint32_t refined_error = quantize_bc7_endpoints(texels, e0, e1, refined, refined_indices);
+		if(refined_error >= error)
+			break;
+		endpoints[0] = refined[0];
+		endpoints[1] = refined[1];
+		error = refined_error;
+		memcpy(indices, refined_indices, sizeof(indices));
+	}
+
+	// The first index drops its top bit, so it must point at the first half
+	if(indices[0] >= 8)
+	{
+		bc7_endpoint swap = endpoints[0];
+		endpoints[0] = endpoints[1];
+		endpoints[1] = swap;
+		for(int i = 0; i < BLOCK_TEXELS; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(block, 0, 16);
+	bit_stream stream = {block, 0};
+	write_bits(&stream, 1 << 6, 7);
+	for(int c = 0; c < 4; c++)
+	{
+		write_bits(&stream, endpoints[0].channels[c], 7);
+		write_bits(&stream, endpoints[1].channels[c], 7);
+	}
+	write_bits(&stream, endpoints[0].p, 1);
+	write_bits(&stream, endpoints[1].p, 1);
+	write_bits(&stream, indices[0], 3);
+	for(int i = 1; i < BLOCK_TEXELS; i++)
+		write_bits(&stream, indices[i], 4);
+}
+
+static void decode_bc7_block(const uint8_t* block, uint8_t texels[BLOCK_TEXELS][4])
+{
+	int mode = 0;
+	while(mode < 8 && !(block[0] >> mode & 1))
+		mode++;
+	if(mode != 6)
+		throw std::runtime_error("TOS_decompress_image: BC7 mode " + std::to_string(mode) + " blocks are not supported");
+
+	bit_stream stream = {(uint8_t*) block, 7};
+	bc7_endpoint endpoints[2];
+	for(int c = 0; c < 4; c++)
+	{
+		endpoints[0].channels[c] = (uint8_t) read_bits(&stream, 7);
+		endpoints[1].channels[c] = (uint8_t) read_bits(&stream, 7);
+	}
+	endpoints[0].p = (uint8_t) read_bits(&stream, 1);
+	endpoints[1].p = (uint8_t) read_bits(&stream, 1);
+	int palette[16][4];
+	get_bc7_palette(&endpoints[0], &endpoints[1], palette);
+	for(int i = 0; i < BLOCK_TEXELS; i++)
+	{
+		uint32_t index = read_bits(&stream, i == 0 ? 3 : 4);
+		for(int c = 0; c < 4; c++)
+			texels[i][c] = (uint8_t) palette[index][c];
+	}
+}
+
+void TOS_compress_image(const TOS_image* image, VkFormat format, uint8_t* blocks, int thread_count)
+{
+	uint32_t block_size = TOS_get_block_size(format);
+	if(block_size == 0)
+		throw std::runtime_error("TOS_compress_image: format is not block compressed");
+	uint32_t blocks_wide = (image->width + 3) / 4;
+	uint32_t blocks_high = (image->height + 3) / 4;
+	TOS_parallel_for
+	(
+		blocks_high,
+		[&](size_t block_y)
+		{
+			uint8_t* block = blocks + block_y * blocks_wide * block_size;
+			for(uint32_t block_x = 0; block_x < blocks_wide; block_x++, block += block_size)
+			{
+				uint8_t texels[BLOCK_TEXELS][4];
+				load_block(image, block_x, (uint32_t) block_y, texels);
+				if(is_bc7(format))
+					encode_bc7_block(texels, block);
+				else if(is_bc3(format))
+				{
+					encode_alpha_block(texels, block);
+					encode_colour_block(texels, block + 8);
+				}
+				else
+					encode_colour_block(texels, block);
+			}
+		},
+		thread_count
+	);
+}
+
+void TOS_decompress_image(const uint8_t* blocks, VkFormat format, uint32_t width, uint32_t height, TOS_image* image)
+{
+	uint32_t block_size = TOS_get_block_size(format);
+	if(block_size == 0)
+		throw std::runtime_error("TOS_decompress_image: format is not block compressed");
+	TOS_create_image(image, width, height);
+	uint32_t blocks_wide = (width + 3) / 4;
+	uint32_t blocks_high = (height + 3) / 4;
+	bool bc1_alpha = format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	TOS_parallel_for
+	(
+		blocks_high,
+		[&](size_t block_y)
+		{
+			const uint8_t* block = blocks + block_y * blocks_wide * block_size;
+			for(uint32_t block_x = 0; block_x < blocks_wide; block_x++, block += block_size)
+			{
+				uint8_t texels[BLOCK_TEXELS][4];
+				if(is_bc7(format))
+					decode_bc7_block(block, texels);
+				else if(is_bc3(format))
+				{
+					decode_colour_block(block + 8, true, texels);
+					decode_alpha_block(block, texels);
+				}
+				else
+				{
+					decode_colour_block(block, false, texels);
+					// The black entry of three colour blocks is transparent
+					// only in the RGBA variant
+					uint16_t c0 = block[0] | (block[1] << 8);
+					uint16_t c1 = block[2] | (block[3] << 8);
+					uint32_t bits;
+					memcpy(&bits, block + 4, 4);
+					for(int i = 0; bc1_alpha && c0 <= c1 && i < BLOCK_TEXELS; i++)
+					{
+						if((bits >> (2 * i) & 3) == 3)
+							texels[i][3] = 0;
+					}
+				}
+				store_block(image, block_x, (uint32_t) block_y, texels);
+			}
+		}
+	);
+}
+
+double TOS_measure_psnr(const TOS_image* reference, const TOS_image* image, bool alpha)
+{
+	if(reference->width != image->width || reference->height != image->height)
+		throw std::runtime_error("TOS_measure_psnr: images differ in size");
+	int channels = alpha ? 4 : 3;
+	double sum = 0.0;
+	size_t texels = (size_t) reference->width * reference->height;
+	for(size_t i = 0; i < texels; i++)
+	{
+		for(int c = 0; c < channels; c++)
+		{
+			double d = (double) reference->pixels[i * 4 + c] - image->pixels[i * 4 + c];
+			sum += d * d;
+		}
+	}
+	double mse = sum / ((double) texels * channels);
+	if(mse == 0.0)
+		return INFINITY;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+TOS_compression_report TOS_measure_compression(const TOS_image* image, VkFormat format, const uint8_t* blocks)
+{
+	TOS_image decoded;
+	TOS_decompress_image(blocks, format, image->width, image->height, &decoded);
+	bool alpha = !(format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+	TOS_compression_report report =
+	{
+		.format = format,
+		.original_size = image->size,
+		.compressed_size = TOS_get_compressed_size(format, image->width, image->height),
+		.psnr = TOS_measure_psnr(image, &decoded, alpha)
+	};
+	TOS_destroy_image(&decoded);
+	return report;
+}
+
+static const char* get_format_name(VkFormat format)
+{
+	if(is_bc1(format))
+		return "BC1";
+	if(is_bc3(format))
+		return "BC3";
+	if(is_bc7(format))
+		return "BC7";
+	return "RGBA8";
+}
+
+void TOS_print_compression_report(const char* name, const TOS_compression_report* report)
+{
+	std::ostringstream line;
+	line << "TOS_compress_image: " << name << " " << get_format_name(report->format)
+	<< ", " << report->original_size << " -> " << report->compressed_size << " bytes, PSNR ";
+	if(isinf(report->psnr))
+		line << "lossless";
+	else
+		line << report->psnr << " dB";
+	TOS_print_line(std::cout, line.str());
+}
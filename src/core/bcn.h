@@ -0,0 +1,49 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "textures.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Block compression of RGBA8 images into BC1, BC3 and BC7, each 4x4 texels
+// to a block of 8 or 16 bytes. Endpoints start on the principal axis of the
+// block's colours and are refined by least squares against the indices
+// chosen for them. BC7 blocks are all written in mode 6, one subset with
+// RGBA endpoints and 4 bit indices, and the decoder reads only that mode.
+// Colour is encoded as stored, so sRGB images map to the _SRGB formats.
+
+enum TOS_texture_compression
+{
+	TOS_TEXTURE_COMPRESSION_NONE,
+	TOS_TEXTURE_COMPRESSION_BC1,
+	TOS_TEXTURE_COMPRESSION_BC3,
+	TOS_TEXTURE_COMPRESSION_BC7,
+	// BC1 for opaque images, BC7 for the rest
+	TOS_TEXTURE_COMPRESSION_AUTO
+};
+
+struct TOS_compression_report
+{
+	VkFormat format;
+	size_t original_size;
+	size_t compressed_size;
+	// Over the channels the format stores, infinite when lossless
+	double psnr;
+};
+
+// The sRGB format for a compression. The image is only read to resolve AUTO.
+VkFormat TOS_get_compressed_format(TOS_texture_compression compression, const TOS_image* image);
+// Bytes per 4x4 block, 0 for formats that are not block compressed
+uint32_t TOS_get_block_size(VkFormat format);
+size_t TOS_get_compressed_size(VkFormat format, uint32_t width, uint32_t height);
+
+// Blocks are written row by row into TOS_get_compressed_size bytes.
+// Partial blocks at the right and bottom edges repeat the edge texels.
+void TOS_compress_image(const TOS_image* image, VkFormat format, uint8_t* blocks, int thread_count=0);
+// Throws on BC7 blocks in modes other than 6
+void TOS_decompress_image(const uint8_t* blocks, VkFormat format, uint32_t width, uint32_t height, TOS_image* image);
+
+double TOS_measure_psnr(const TOS_image* reference, const TOS_image* image, bool alpha);
+// Decodes the blocks again to compare them with the image
+TOS_compression_report TOS_measure_compression(const TOS_image* image, VkFormat format, const uint8_t* blocks);
+void TOS_print_compression_report(const char* name, const TOS_compression_report* report);
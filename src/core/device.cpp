@@ -1,5 +1,7 @@
 #include "device.h"
 
+#include "allocator.h"
+#include "upload.h"
 #include <set>
 #include <iostream>
 
@@ -23,11 +25,11 @@ TOS_queue_family_indices TOS_query_queue_families(TOS_context* context, VkPhysic
 	TOS_queue_family_indices indices;
 	for(int i = 0; i < family_count; i++)
 	{
-		if(family_properties[i].queueFlags & VK_QUEUE_TRANSFER_BIT)
-			indices.transfer = i;
-		
 		if(family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
 			indices.graphics = i;
+			indices.transfer = i;
+		}
 		
 		VkBool32 present_support;
 		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, context->surface, &present_support);
@@ -172,9 +174,13 @@ VkResult create_logical_device(TOS_context* context, VkPhysicalDevice physical,
 	create_info.pQueueCreateInfos = queue_create_infos.data();
 	create_info.queueCreateInfoCount = (uint32_t) queue_create_infos.size();
 	
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical, &supported_features);
 	VkPhysicalDeviceFeatures2 features2 {};
 	features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
 	features2.features.samplerAnisotropy = VK_TRUE;
+	// Optional; textures fall back to decoding on the CPU without it
+	features2.features.textureCompressionBC = supported_features.textureCompressionBC;
 	VkPhysicalDeviceFragmentShaderBarycentricFeaturesKHR requested_fragment_shader_barycentric_features {};
 	requested_fragment_shader_barycentric_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADER_BARYCENTRIC_FEATURES_KHR;
 	requested_fragment_shader_barycentric_features.fragmentShaderBarycentric = VK_TRUE;
@@ -235,18 +241,34 @@ void TOS_create_device(TOS_context* context, TOS_device* device)
 	VkPhysicalDeviceProperties properties;
 	vkGetPhysicalDeviceProperties(device->physical, &properties);
 	std::cout << "TOS_create_device: selected:\n\t" << properties.deviceName << std::endl;
+	vkGetPhysicalDeviceMemoryProperties(device->physical, &device->memory_properties);
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(device->physical, &features);
+	device->texture_compression_bc = features.textureCompressionBC == VK_TRUE;
+	TOS_create_memory_allocator(device);
 
 	create_queues(context, device);
 	create_command_pools(context, device);
+	TOS_create_upload_queue(device);
 }
 
 void TOS_destroy_device(TOS_context* context, TOS_device* device)
 {
+	TOS_destroy_upload_queue(device);
 	vkDestroyCommandPool(device->logical, device->command_pools.render, nullptr);
 	vkDestroyCommandPool(device->logical, device->command_pools.transfer, nullptr);
+	TOS_destroy_memory_allocator(device);
 	vkDestroyDevice(device->logical, nullptr);
 }
 
+bool TOS_supports_sampled_format(TOS_device* device, VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(device->physical, format, &properties);
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
 VkCommandBuffer TOS_create_command_buffer(TOS_device* device, VkCommandPool pool)
 {
 	VkCommandBufferAllocateInfo alloc_info {};
@@ -271,15 +293,4 @@ void TOS_begin_command_buffer(TOS_device* device, VkCommandBuffer buffer, VkComm
 	begin_info.flags = flags;
 	begin_info.pInheritanceInfo = nullptr;
 	vkBeginCommandBuffer(buffer, &begin_info);
-}
-
-void TOS_end_command_buffer(TOS_device* device, VkQueue queue, VkCommandBuffer buffer)
-{
-	vkEndCommandBuffer(buffer);
-	VkSubmitInfo submission {};
-	submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submission.commandBufferCount = 1;
-	submission.pCommandBuffers = &buffer;
-	vkQueueSubmit(queue, 1, &submission, VK_NULL_HANDLE);
-	vkQueueWaitIdle(queue);
 }
\ No newline at end of file
@@ -8,6 +8,10 @@ std::vector<VkExtensionProperties> TOS_query_device_extensions(VkPhysicalDevice
 
 struct TOS_queue_family_indices
 {
+	// Always the graphics family. Upload batches, including the levels a
+	// streaming texture gains each frame, record layout transitions against
+	// fragment shader reads, which a transfer-only family cannot express,
+	// and images uploaded there need no queue family ownership transfer.
 	std::optional<uint32_t> transfer;
 	std::optional<uint32_t> graphics;
 	std::optional<uint32_t> present;
@@ -37,10 +41,20 @@ struct TOS_command_pools
 	VkCommandPool render;
 };
 
+// See allocator.h and upload.h
+struct TOS_memory_allocator;
+struct TOS_upload_queue;
+
 struct TOS_device
 {
 	VkPhysicalDevice physical;
 	VkDevice logical;
+	// Queried once at creation since it never changes
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	// Whether the textureCompressionBC feature was enabled
+	bool texture_compression_bc;
+	TOS_memory_allocator* allocator;
+	TOS_upload_queue* uploads;
 
 	TOS_queues queues;
 	TOS_command_pools command_pools;
@@ -48,8 +62,10 @@ struct TOS_device
 
 void TOS_create_device(TOS_context* context, TOS_device* device);
 void TOS_destroy_device(TOS_context* context, TOS_device* device);
+// Whether optimal tiling images of the format can be sampled with linear
+// filtering
+bool TOS_supports_sampled_format(TOS_device* device, VkFormat format);
 
 VkCommandBuffer TOS_create_command_buffer(TOS_device* device, VkCommandPool pool);
 void TOS_destroy_command_buffer(TOS_device* device, VkCommandPool pool, VkCommandBuffer buffer);
-void TOS_begin_command_buffer(TOS_device* device, VkCommandBuffer buffer, VkCommandBufferUsageFlags flags=0);
-void TOS_end_command_buffer(TOS_device* device, VkQueue queue, VkCommandBuffer buffer);
\ No newline at end of file
+void TOS_begin_command_buffer(TOS_device* device, VkCommandBuffer buffer, VkCommandBufferUsageFlags flags=0);
\ No newline at end of file
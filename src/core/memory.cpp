@@ -1,63 +1,80 @@
 #include "memory.h"
 
+#include "upload.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
-#include <stdio.h>
-#include <iostream>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <stdexcept>
 
-void* TOS_map_file(const char* path, int mode, size_t* size)
+void* TOS_map_file(const char* path, int mode, size_t* size, int hints)
 {
-	int fd = open(path, O_RDWR, S_IRUSR | S_IWUSR);
+	*size = 0;
+	int fd = open(path, mode == TOS_FILE_MAP_READ ? O_RDONLY : O_RDWR);
 	if(fd == -1)
+		throw std::runtime_error(std::string("TOS_map_file: failed to open ") + path + ": " + strerror(errno));
+	struct stat info;
+	if(fstat(fd, &info) != 0)
 	{
-		std::cerr << "TOS_map_file: failed to open " << path << std::endl;
-		perror("TOS_map_file: open");
-		*size = 0;
+		int error = errno;
+		close(fd);
+		throw std::runtime_error(std::string("TOS_map_file: failed to stat ") + path + ": " + strerror(error));
+	}
+	size_t file_size = (size_t) info.st_size;
+	if(file_size == 0)
+	{
+		close(fd);
 		return nullptr;
 	}
-	size_t file_size = lseek(fd, 0, SEEK_END);
+
+	int flags = mode == TOS_FILE_MAP_PRIVATE ? MAP_PRIVATE : MAP_SHARED;
+#ifdef MAP_POPULATE
+	if(hints & TOS_FILE_MAP_POPULATE)
+		flags |= MAP_POPULATE;
+#endif
 	void* file_data = mmap
 	(
 		NULL, file_size,
-		PROT_READ | PROT_WRITE,
-		mode == TOS_FILE_MAP_PUBLIC ? MAP_SHARED : MAP_PRIVATE,
-		fd, 0
+		mode == TOS_FILE_MAP_READ ? PROT_READ : PROT_READ | PROT_WRITE,
+		flags, fd, 0
 	);
-
+	int error = errno;
+	// The mapping holds its own reference to the file
 	close(fd);
+	if(file_data == MAP_FAILED)
+		throw std::runtime_error(std::string("TOS_map_file: failed to map ") + path + ": " + strerror(error));
+
+#ifdef MADV_SEQUENTIAL
+	if(hints & TOS_FILE_MAP_SEQUENTIAL)
+		madvise(file_data, file_size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+	if(hints & TOS_FILE_MAP_WILLNEED)
+		madvise(file_data, file_size, MADV_WILLNEED);
+#endif
+#ifdef MADV_HUGEPAGE
+	if(hints & TOS_FILE_MAP_HUGE_PAGES)
+		madvise(file_data, file_size, MADV_HUGEPAGE);
+#endif
 	*size = file_size;
 	return file_data;
 }
 
 void TOS_unmap_file(void* data, size_t size)
 {
-	munmap(data, size);
-}
-
-uint32_t find_memory_type(TOS_device* device, uint32_t type_filter, VkMemoryPropertyFlags properties)
-{
-	VkPhysicalDeviceMemoryProperties mem_properties;
-	vkGetPhysicalDeviceMemoryProperties(device->physical, &mem_properties);
-	for(uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
-	{
-		if
-		(
-			(type_filter & (1 << i)) &&
-			(mem_properties.memoryTypes[i].propertyFlags & properties) == properties
-		)
-		{
-			return i;
-		}
-	}
-	throw std::runtime_error("[ERROR] failed to find suitable memory type");
+	if(data != nullptr)
+		munmap(data, size);
 }
 
 void TOS_create_buffer
 (
 	TOS_device* device, VkDeviceSize size,
 	VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-	VkBuffer& buffer, VkDeviceMemory& memory
+	VkBuffer& buffer, TOS_allocation& allocation,
+	VkMemoryPropertyFlags preferred_properties
 )
 {
 	VkBufferCreateInfo create_info {};
@@ -73,41 +90,22 @@ void TOS_create_buffer
 	VkMemoryRequirements mem_requirements;
 	vkGetBufferMemoryRequirements(device->logical, buffer, &mem_requirements);
 	
-	VkMemoryAllocateInfo alloc_info {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = mem_requirements.size;
-	alloc_info.memoryTypeIndex = find_memory_type
-	(
-		device,
-		mem_requirements.memoryTypeBits,
-		properties
-	);
-	
-	result = vkAllocateMemory(device->logical, &alloc_info, nullptr, &memory);
-	if(result != VK_SUCCESS)
-		throw std::runtime_error("TOS_create_buffer: failed to allocate buffer memory");
-	
-	vkBindBufferMemory(device->logical, buffer, memory, 0);
+	allocation = TOS_allocate_memory(device, mem_requirements, properties, TOS_RESOURCE_LINEAR, preferred_properties);
+	vkBindBufferMemory(device->logical, buffer, allocation.memory, allocation.offset);
 }
 
 void TOS_copy_buffer
 (
 	TOS_device* device,
 	VkBuffer src, VkBuffer dst,
-	VkDeviceSize size
+	VkDeviceSize size, VkDeviceSize dst_offset
 )
 {
-	VkCommandBuffer command_buffer = TOS_create_command_buffer(device, device->command_pools.transfer);
-	TOS_begin_command_buffer(device, command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	
 	VkBufferCopy copy_region {};
 	copy_region.srcOffset = 0;
-	copy_region.dstOffset = 0;
+	copy_region.dstOffset = dst_offset;
 	copy_region.size = size;
-	vkCmdCopyBuffer(command_buffer, src, dst, 1, &copy_region);
-
-	TOS_end_command_buffer(device, device->queues.transfer, command_buffer);
-	TOS_destroy_command_buffer(device, device->command_pools.transfer, command_buffer);
+	vkCmdCopyBuffer(TOS_get_upload_command_buffer(device), src, dst, 1, &copy_region);
 }
 
 void TOS_create_image
@@ -117,7 +115,7 @@ void TOS_create_image
 	uint32_t mip_levels,
 	VkImageTiling tiling, VkImageUsageFlags usage,
 	VkMemoryPropertyFlags memory_properties,
-	VkImage& image, VkDeviceMemory& memory
+	VkImage& image, TOS_allocation& allocation
 )
 {
 	VkImageCreateInfo create_info {};
@@ -146,16 +144,9 @@ void TOS_create_image
 	VkMemoryRequirements mem_requirements;
 	vkGetImageMemoryRequirements(device->logical, image, &mem_requirements);
 	
-	VkMemoryAllocateInfo alloc_info {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = mem_requirements.size;
-	alloc_info.memoryTypeIndex = find_memory_type(device, mem_requirements.memoryTypeBits, memory_properties);
-	
-	result = vkAllocateMemory(device->logical, &alloc_info, nullptr, &memory);
-	if(result != VK_SUCCESS)
-		throw std::runtime_error("TOS_create_image: failed to allocate image memory");
-	
-	vkBindImageMemory(device->logical, image, memory, 0);
+	TOS_resource_kind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? TOS_RESOURCE_OPTIMAL : TOS_RESOURCE_LINEAR;
+	allocation = TOS_allocate_memory(device, mem_requirements, memory_properties, kind);
+	vkBindImageMemory(device->logical, image, allocation.memory, allocation.offset);
 }
 
 VkImageView TOS_create_image_view
@@ -196,16 +187,14 @@ VkImageView TOS_create_image_view
 	return view;
 }
 
-void TOS_transition_image_layout
+void TOS_record_image_transition
 (
-	TOS_device* device,
+	VkCommandBuffer command_buffer,
 	VkImage image, VkFormat format, uint32_t mip_levels,
-	VkImageLayout old_layout, VkImageLayout new_layout
+	VkImageLayout old_layout, VkImageLayout new_layout,
+	uint32_t base_level
 )
 {
-	VkCommandBuffer command_buffer = TOS_create_command_buffer(device, device->command_pools.transfer);
-	TOS_begin_command_buffer(device, command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	
 	VkImageMemoryBarrier barrier {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	barrier.oldLayout = old_layout;
@@ -215,7 +204,7 @@ void TOS_transition_image_layout
 	barrier.image = image;
 	barrier.subresourceRange =
 	{
-		.baseMipLevel = 0,
+		.baseMipLevel = base_level,
 		.levelCount = mip_levels,
 		.baseArrayLayer = 0,
 		.layerCount = 1
@@ -271,7 +260,7 @@ void TOS_transition_image_layout
 	}
 	else
 	{
-		throw std::runtime_error("TOS_transition_image_layout: specified image layout transition not supported");
+		throw std::runtime_error("TOS_record_image_transition: specified image layout transition not supported");
 	}
 	
 	vkCmdPipelineBarrier
@@ -283,7 +272,14 @@ void TOS_transition_image_layout
 		0, nullptr,
 		1, &barrier
 	);
-	
-	TOS_end_command_buffer(device, device->queues.transfer, command_buffer);
-	TOS_destroy_command_buffer(device, device->command_pools.transfer, command_buffer);
+}
+
+void TOS_transition_image_layout
+(
+	TOS_device* device,
+	VkImage image, VkFormat format, uint32_t mip_levels,
+	VkImageLayout old_layout, VkImageLayout new_layout
+)
+{
+	TOS_record_image_transition(TOS_get_upload_command_buffer(device), image, format, mip_levels, old_layout, new_layout);
 }
\ No newline at end of file
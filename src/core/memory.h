@@ -2,26 +2,51 @@
 
 #include <GLFW/glfw3.h>
 #include "device.h"
+#include "allocator.h"
 #include <stdint.h>
 #include <stddef.h>
 
 enum TOS_file_map_mode
 {
+	// Writable copy on write pages, never written back to the file
 	TOS_FILE_MAP_PRIVATE,
-	TOS_FILE_MAP_PUBLIC
+	// Writable pages shared with the file
+	TOS_FILE_MAP_PUBLIC,
+	// Read only pages shared with the page cache; the file needs only read
+	// permission
+	TOS_FILE_MAP_READ
 };
 
-void* TOS_map_file(const char* path, int mode, size_t* size);
+// Access pattern hints, combined with |. Each is skipped where the platform
+// lacks it, and none of them can make mapping fail.
+enum TOS_file_map_hint
+{
+	// Fault in every page while mapping
+	TOS_FILE_MAP_POPULATE = 1 << 0,
+	// Read ahead aggressively and drop pages soon after they are passed
+	TOS_FILE_MAP_SEQUENTIAL = 1 << 1,
+	// Start reading the whole file in the background
+	TOS_FILE_MAP_WILLNEED = 1 << 2,
+	// Ask for transparent huge pages, which only some kernels provide for
+	// file mappings
+	TOS_FILE_MAP_HUGE_PAGES = 1 << 3
+};
+
+// Throws if the file cannot be opened or mapped. An empty file maps to
+// nullptr with a size of 0.
+void* TOS_map_file(const char* path, int mode, size_t* size, int hints=0);
 void TOS_unmap_file(void* data, size_t size);
 
 void TOS_create_buffer
 (
 	TOS_device* device, VkDeviceSize size,
 	VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-	VkBuffer& buffer, VkDeviceMemory& memory
+	VkBuffer& buffer, TOS_allocation& allocation,
+	VkMemoryPropertyFlags preferred_properties=0
 );
 
-void TOS_copy_buffer(TOS_device* device, VkBuffer src, VkBuffer dst, VkDeviceSize size);
+// Recorded into the upload batch, see upload.h
+void TOS_copy_buffer(TOS_device* device, VkBuffer src, VkBuffer dst, VkDeviceSize size, VkDeviceSize dst_offset=0);
 
 void TOS_create_image
 (
@@ -30,7 +55,7 @@ void TOS_create_image
 	uint32_t mip_levels,
 	VkImageTiling tiling, VkImageUsageFlags usage,
 	VkMemoryPropertyFlags memory_properties,
-	VkImage& image, VkDeviceMemory& memory
+	VkImage& image, TOS_allocation& allocation
 );
 
 VkImageView TOS_create_image_view
@@ -40,6 +65,15 @@ VkImageView TOS_create_image_view
 	VkImageAspectFlags aspects
 );
 
+// Covers mip_levels levels starting at base_level
+void TOS_record_image_transition
+(
+	VkCommandBuffer command_buffer,
+	VkImage image, VkFormat format, uint32_t mip_levels,
+	VkImageLayout old_layout, VkImageLayout new_layout,
+	uint32_t base_level=0
+);
+// Records the transition into the upload batch, see upload.h
 void TOS_transition_image_layout
 (
 	TOS_device* device,
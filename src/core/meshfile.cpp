@@ -0,0 +1,290 @@
+#include "meshfile.h"
+
+#include "memory.h"
+#include "optimize.h"
+#include "threads.h"
+#include "cowtools.h"
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
+#define SECTION_ALIGNMENT 16
+
+static uint64_t align_up(uint64_t offset, uint64_t alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Nanoseconds, so a source edited within the second it was baked in still
+// reads as changed
+static bool stat_source(const char* source_path, uint64_t* size, int64_t* mtime_ns)
+{
+	struct stat info;
+	if(stat(source_path, &info) != 0)
+		return false;
+	*size = (uint64_t) info.st_size;
+	*mtime_ns = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+	return true;
+}
+
+bool TOS_open_mesh_file(TOS_mesh_file* file, const char* path, const char* source_path)
+{
+	*file = {};
+
+	struct stat info;
+	if(stat(path, &info) != 0 || info.st_size < 0 || (size_t) info.st_size < sizeof(TOS_mesh_file_header))
+		return false;
+
+	// The whole cache goes to the GPU, so read it ahead in one go
+	size_t size;
+	void* data;
+	try
+	{
+		data = TOS_map_file(path, TOS_FILE_MAP_READ, &size, TOS_FILE_MAP_WILLNEED | TOS_FILE_MAP_HUGE_PAGES);
+	}
+	catch(const std::exception& e)
+	{
+		TOS_print_line(std::cerr, e.what());
+		return false;
+	}
+
+	const TOS_mesh_file_header* header = (const TOS_mesh_file_header*) data;
+	uint64_t source_size;
+	int64_t source_mtime_ns;
+	bool valid =
+	size >= sizeof(TOS_mesh_file_header) &&
+	header->magic == TOS_MESH_FILE_MAGIC &&
+	header->version == TOS_MESH_FILE_VERSION &&
+	header->vertex_stride == sizeof(TOS_vertex) &&
+	header->vertex_offset <= size && (uint64_t) header->vertex_count * sizeof(TOS_vertex) <= size - header->vertex_offset &&
+	header->index_offset <= size && (uint64_t) header->index_count * sizeof(uint32_t) <= size - header->index_offset &&
+	header->lod_count <= header->lod_request &&
+	(header->lod_count == 0 || (header->lod_offset <= size && (uint64_t) header->lod_count * sizeof(TOS_lod_span) <= size - header->lod_offset));
+
+	// A missing source is fine; the cache can ship on its own
+	if(valid && stat_source(source_path, &source_size, &source_mtime_ns))
+		valid = header->source_size == source_size && header->source_mtime_ns == source_mtime_ns;
+
+	if(!valid)
+	{
+		TOS_unmap_file(data, size);
+		return false;
+	}
+
+	*file =
+	{
+		.data = data,
+		.size = size,
+		.header = header,
+		.vertices = (const TOS_vertex*) ((const uint8_t*) data + header->vertex_offset),
+		.indices = (const uint32_t*) ((const uint8_t*) data + header->index_offset),
+		.lods = header->lod_count > 0 ? (const TOS_lod_span*) ((const uint8_t*) data + header->lod_offset) : nullptr
+	};
+	// Meshlets, splitting and the GPU all index the vertices unchecked
+	valid = true;
+	for(uint32_t l = 0; valid && l < header->lod_count; l++)
+		valid = (uint64_t) file->lods[l].first_index + file->lods[l].index_count <= header->index_count;
+	uint32_t largest_index = 0;
+	for(uint32_t i = 0; i < header->index_count; i++)
+		largest_index = TOS_max(largest_index, file->indices[i]);
+	if(!valid || (header->index_count > 0 && largest_index >= header->vertex_count))
+	{
+		TOS_close_mesh_file(file);
+		return false;
+	}
+	return true;
+}
+
+void TOS_close_mesh_file(TOS_mesh_file* file)
+{
+	if(file->data != nullptr)
+		TOS_unmap_file(file->data, file->size);
+	*file = {};
+}
+
+static bool init_header
+(
+	TOS_mesh_file_header* header, const char* source_path,
+	uint32_t vertex_count, uint32_t index_count,
+	glm::vec3 min, glm::vec3 max,
+	uint32_t lod_count=0, uint32_t lod_request=1, float lod_ratio=0.0f
+)
+{
+	*header = {};
+	header->magic = TOS_MESH_FILE_MAGIC;
+	header->version = TOS_MESH_FILE_VERSION;
+	if(!stat_source(source_path, &header->source_size, &header->source_mtime_ns))
+		return false;
+	header->vertex_stride = sizeof(TOS_vertex);
+	header->vertex_count = vertex_count;
+	header->index_count = index_count;
+	for(int i = 0; i < 3; i++)
+	{
+		header->min[i] = min[i];
+		header->max[i] = max[i];
+	}
+	header->vertex_offset = align_up(sizeof(TOS_mesh_file_header), SECTION_ALIGNMENT);
+	header->index_offset = align_up(header->vertex_offset + (uint64_t) vertex_count * sizeof(TOS_vertex), SECTION_ALIGNMENT);
+	header->lod_count = lod_count;
+	header->lod_request = lod_request;
+	header->lod_ratio = lod_ratio;
+	header->lod_offset = align_up(header->index_offset + (uint64_t) index_count * sizeof(uint32_t), SECTION_ALIGNMENT);
+	return true;
+}
+
+static const uint8_t padding[SECTION_ALIGNMENT] = {};
+
+// Closes the temporary file and moves it over the destination,
+// so a reader never maps a partial file
+static bool finish_file(FILE* out, const std::string& temp_path, const char* path, bool written)
+{
+	written = fclose(out) == 0 && written;
+	if(!written || rename(temp_path.c_str(), path) != 0)
+	{
+		TOS_print_line(std::cerr, std::string("TOS_write_mesh_file: failed to write ") + path);
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool TOS_write_mesh_file
+(
+	const char* path, const char* source_path,
+	const TOS_vertex* vertices, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count,
+	glm::vec3 min, glm::vec3 max,
+	const TOS_lod_span* lods, uint32_t lod_count,
+	uint32_t lod_request, float lod_ratio
+)
+{
+	TOS_mesh_file_header header;
+	if(!init_header(&header, source_path, vertex_count, index_count, min, max, lod_count, lod_request, lod_ratio))
+		return false;
+
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE* out = fopen(temp_path.c_str(), "wb");
+	if(out == nullptr)
+	{
+		TOS_print_line(std::cerr, "TOS_write_mesh_file: failed to open " + temp_path);
+		return false;
+	}
+
+	size_t header_padding = header.vertex_offset - sizeof(header);
+	size_t vertex_padding = header.index_offset - header.vertex_offset - (uint64_t) vertex_count * sizeof(TOS_vertex);
+	size_t index_padding = header.lod_offset - header.index_offset - (uint64_t) index_count * sizeof(uint32_t);
+	bool written =
+	fwrite(&header, sizeof(header), 1, out) == 1 &&
+	fwrite(padding, 1, header_padding, out) == header_padding &&
+	fwrite(vertices, sizeof(TOS_vertex), vertex_count, out) == vertex_count &&
+	fwrite(padding, 1, vertex_padding, out) == vertex_padding &&
+	fwrite(indices, sizeof(uint32_t), index_count, out) == index_count &&
+	(
+		lod_count == 0 ||
+		(
+			fwrite(padding, 1, index_padding, out) == index_padding &&
+			fwrite(lods, sizeof(TOS_lod_span), lod_count, out) == lod_count
+		)
+	);
+	return finish_file(out, temp_path, path, written);
+}
+
+bool TOS_import_mesh_file(const char* path, const char* source_path)
+{
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE* out = fopen(temp_path.c_str(), "wb");
+	if(out == nullptr)
+	{
+		std::cerr << "TOS_import_mesh_file: failed to open " << temp_path << std::endl;
+		return false;
+	}
+	// Indices arrive interleaved with vertices but belong after them,
+	// so they are spilled to an anonymous file and appended at the end
+	FILE* spill = tmpfile();
+	if(spill == nullptr)
+	{
+		std::cerr << "TOS_import_mesh_file: failed to create spill file" << std::endl;
+		fclose(out);
+		remove(temp_path.c_str());
+		return false;
+	}
+
+	uint64_t vertex_offset = align_up(sizeof(TOS_mesh_file_header), SECTION_ALIGNMENT);
+	bool written = fseek(out, (long) vertex_offset, SEEK_SET) == 0;
+
+	TOS_mesh_stream stream;
+	stream.emit_vertices = [&](const TOS_vertex* vertices, uint32_t count)
+	{
+		written = written && fwrite(vertices, sizeof(TOS_vertex), count, out) == count;
+	};
+	stream.emit_indices = [&](const uint32_t* indices, uint32_t count)
+	{
+		written = written && fwrite(indices, sizeof(uint32_t), count, spill) == count;
+	};
+	try
+	{
+		TOS_stream_mesh(&stream, source_path);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		written = false;
+	}
+
+	TOS_mesh_file_header header;
+	written = written && init_header(&header, source_path, stream.vertex_count, stream.index_count, stream.min, stream.max);
+	if(written)
+	{
+		size_t vertex_padding = header.index_offset - header.vertex_offset - (uint64_t) stream.vertex_count * sizeof(TOS_vertex);
+		written = fwrite(padding, 1, vertex_padding, out) == vertex_padding && fseek(spill, 0, SEEK_SET) == 0;
+
+		uint8_t buffer[1 << 16];
+		size_t read;
+		while(written && (read = fread(buffer, 1, sizeof(buffer), spill)) > 0)
+			written = fwrite(buffer, 1, read, out) == read;
+		written = written && ferror(spill) == 0;
+
+		written = written &&
+		fseek(out, 0, SEEK_SET) == 0 &&
+		fwrite(&header, sizeof(header), 1, out) == 1 &&
+		fwrite(padding, 1, header.vertex_offset - sizeof(header), out) == header.vertex_offset - sizeof(header);
+	}
+	fclose(spill);
+
+	// Reorder for the vertex cache through a shared mapping of the finished
+	// file, before the rename publishes it
+	written = written && fflush(out) == 0;
+	if(written)
+	{
+		size_t size;
+		uint8_t* data = nullptr;
+		try
+		{
+			data = (uint8_t*) TOS_map_file(temp_path.c_str(), TOS_FILE_MAP_PUBLIC, &size);
+		}
+		catch(const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			written = false;
+		}
+		if(written)
+		{
+			TOS_vertex* vertices = (TOS_vertex*) (data + header.vertex_offset);
+			uint32_t* indices = (uint32_t*) (data + header.index_offset);
+			// Triangles are reordered in bounded windows, but renumbering
+			// vertices tracks all of them at once, so it is kept to meshes
+			// whose vertex state fits the weld budget
+			if((uint64_t) header.vertex_count * TOS_OPTIMIZE_VERTEX_STATE_SIZE <= stream.weld_budget)
+				TOS_optimize_mesh(vertices, header.vertex_count, indices, header.index_count);
+			else
+			{
+				TOS_optimize_vertex_cache(indices, header.index_count, header.vertex_count);
+				std::cout << "TOS_import_mesh_file: " << source_path << " has too many vertices to renumber, reordered its triangles only" << std::endl;
+			}
+			TOS_unmap_file(data, size);
+		}
+	}
+	return finish_file(out, temp_path, path, written);
+}
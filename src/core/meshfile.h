@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vertices.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary mesh cache, written next to a source mesh on first import.
+// Holds the final deduplicated vertex and index arrays so later runs can
+// map the file and upload straight from it.
+
+#define TOS_MESH_FILE_MAGIC 0x48534D54 // "TMSH"
+#define TOS_MESH_FILE_VERSION 4
+#define TOS_MESH_FILE_EXTENSION ".tmesh"
+
+struct TOS_mesh_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime_ns;
+	uint32_t vertex_stride;
+	uint32_t vertex_count;
+	// Covers the indices of every level of detail
+	uint32_t index_count;
+	uint32_t lod_count;
+	// The level count and ratio the levels were simplified with. The chain
+	// may hold fewer levels than requested if simplification stopped early.
+	uint32_t lod_request;
+	float lod_ratio;
+	float min[3];
+	float max[3];
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t lod_offset;
+};
+
+struct TOS_mesh_file
+{
+	void* data;
+	size_t size;
+
+	const TOS_mesh_file_header* header;
+	const TOS_vertex* vertices;
+	const uint32_t* indices;
+	// Empty when the file holds the full detail level only
+	const TOS_lod_span* lods;
+};
+
+// Returns false if the file is missing, malformed, or older than its source
+bool TOS_open_mesh_file(TOS_mesh_file* file, const char* path, const char* source_path);
+void TOS_close_mesh_file(TOS_mesh_file* file);
+bool TOS_write_mesh_file
+(
+	const char* path, const char* source_path,
+	const TOS_vertex* vertices, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count,
+	glm::vec3 min, glm::vec3 max,
+	const TOS_lod_span* lods=nullptr, uint32_t lod_count=0,
+	uint32_t lod_request=1, float lod_ratio=0.0f
+);
+
+// Streams an OBJ import straight into a cache file, holding only fixed-size
+// blocks of the output and a bounded weld table in memory, see
+// TOS_mesh_stream, then reorders it for the vertex cache through a mapping
+// of the file. Vertices are renumbered for fetch only when the mesh's
+// per-vertex optimization state fits the weld budget.
+bool TOS_import_mesh_file(const char* path, const char* source_path);
@@ -0,0 +1,178 @@
+#include "meshlets.h"
+
+#include "cowtools.h"
+#include <math.h>
+
+// Fills in the bounds of a meshlet whose range is already set
+static void bound_meshlet(const TOS_vertex* vertices, const uint32_t* indices, TOS_meshlet* meshlet)
+{
+	const TOS_vertex* base = vertices + meshlet->range.vertex_offset;
+	const uint32_t* first = indices + meshlet->range.first_index;
+	uint32_t index_count = meshlet->range.index_count;
+
+	glm::vec3 min = glm::vec3(INFINITY, INFINITY, INFINITY);
+	glm::vec3 max = -min;
+	for(uint32_t i = 0; i < index_count; i++)
+	{
+		min = glm::min(min, base[first[i]].position);
+		max = glm::max(max, base[first[i]].position);
+	}
+	meshlet->aabb = TOS_AABB::min_max(min, max);
+
+	glm::vec3 center = (min + max) * 0.5f;
+	float r = 0.0f;
+	for(uint32_t i = 0; i < index_count; i++)
+		r = TOS_max(r, glm::length(base[first[i]].position - center));
+	meshlet->sphere = TOS_sphere::center_radius(center, r);
+
+	std::vector<glm::vec3> normals;
+	normals.reserve(index_count / 3);
+	glm::vec3 axis = glm::vec3(0);
+	for(uint32_t i = 0; i+2 < index_count; i += 3)
+	{
+		glm::vec3 a = base[first[i+0]].position;
+		glm::vec3 b = base[first[i+1]].position;
+		glm::vec3 c = base[first[i+2]].position;
+		glm::vec3 n = glm::cross(b-a, c-a);
+		float length = glm::length(n);
+		if(length == 0.0f)
+			continue;
+		n /= length;
+		normals.push_back(n);
+		axis += n;
+	}
+
+	meshlet->cone_axis = glm::vec3(0, 0, 1);
+	meshlet->cone_cutoff = 1.0f;
+	float length = glm::length(axis);
+	if(normals.empty() || length == 0.0f)
+		return;
+	axis /= length;
+
+	float min_dot = 1.0f;
+	for(glm::vec3 n : normals)
+		min_dot = TOS_min(min_dot, glm::dot(axis, n));
+	// Past about 84 degrees of spread the cone would almost never cull
+	if(min_dot <= 0.1f)
+		return;
+	meshlet->cone_axis = axis;
+	meshlet->cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+void TOS_build_meshlets
+(
+	const TOS_vertex* vertices, const uint32_t* indices,
+	const TOS_mesh_range* ranges, size_t range_count,
+	std::vector<TOS_meshlet>* meshlets
+)
+{
+	meshlets->clear();
+	uint32_t members[TOS_MESHLET_MAX_VERTICES];
+	for(size_t r = 0; r < range_count; r++)
+	{
+		const TOS_mesh_range& range = ranges[r];
+		TOS_meshlet meshlet = {};
+		meshlet.range = {range.first_index, 0, range.vertex_offset};
+		uint32_t member_count = 0;
+
+		auto close_meshlet = [&]()
+		{
+			if(meshlet.range.index_count == 0)
+				return;
+			bound_meshlet(vertices, indices, &meshlet);
+			meshlets->push_back(meshlet);
+			meshlet.range.first_index += meshlet.range.index_count;
+			meshlet.range.index_count = 0;
+			member_count = 0;
+		};
+
+		uint32_t end = range.first_index + range.index_count - range.index_count % 3;
+		for(uint32_t i = range.first_index; i < end; i += 3)
+		{
+			// Vertices of this triangle not yet in the meshlet
+			uint32_t added[3];
+			uint32_t added_count = 0;
+			for(int c = 0; c < 3; c++)
+			{
+				uint32_t v = indices[i+c];
+				bool present = false;
+				for(uint32_t m = 0; m < member_count && !present; m++)
+					present = members[m] == v;
+				for(uint32_t m = 0; m < added_count && !present; m++)
+					present = added[m] == v;
+				if(!present)
+					added[added_count++] = v;
+			}
+
+			if
+			(
+				member_count + added_count > TOS_MESHLET_MAX_VERTICES ||
+				meshlet.range.index_count / 3 == TOS_MESHLET_MAX_TRIANGLES
+			)
+			{
+				close_meshlet();
+				// Every vertex of the triangle is new to the fresh meshlet
+				added_count = 0;
+				for(int c = 0; c < 3; c++)
+				{
+					uint32_t v = indices[i+c];
+					if((c < 1 || v != indices[i]) && (c < 2 || v != indices[i+1]))
+						added[added_count++] = v;
+				}
+			}
+
+			for(uint32_t m = 0; m < added_count; m++)
+				members[member_count++] = added[m];
+			meshlet.range.index_count += 3;
+		}
+		close_meshlet();
+	}
+}
+
+TOS_meshlet_cull_stats TOS_cull_meshlets(const TOS_mesh* mesh, glm::mat4 M, TOS_camera* camera, std::vector<TOS_mesh_range>* visible)
+{
+	// Culling in the mesh's own space keeps the stored bounds untransformed.
+	// Affine maps preserve which side of a plane a point is on, so the
+	// backface test holds for any M without a mirroring scale.
+	TOS_frustum frustum = TOS_frustum::view_projection(camera->P() * camera->V() * M);
+	glm::vec3 eye = glm::vec3(glm::inverse(M) * glm::vec4(camera->transform.position, 1.0f));
+
+	TOS_meshlet_cull_stats stats = {};
+	stats.nearest = INFINITY;
+	visible->clear();
+	for(const TOS_meshlet& meshlet : mesh->meshlets)
+	{
+		if(!TOS_frustum_sphere_intersect(frustum, meshlet.sphere) || !TOS_frustum_AABB_intersect(frustum, meshlet.aabb))
+		{
+			stats.frustum_culled++;
+			continue;
+		}
+		if(meshlet.cone_cutoff < 1.0f)
+		{
+			glm::vec3 to_center = meshlet.sphere.center - eye;
+			if(glm::dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff * glm::length(to_center) + meshlet.sphere.r)
+			{
+				stats.backface_culled++;
+				continue;
+			}
+		}
+
+		stats.visible++;
+		stats.nearest = TOS_min(stats.nearest, TOS_max(glm::length(meshlet.sphere.center - eye) - meshlet.sphere.r, 0.0f));
+		if
+		(
+			!visible->empty() &&
+			visible->back().vertex_offset == meshlet.range.vertex_offset &&
+			visible->back().first_index + visible->back().index_count == meshlet.range.first_index
+		)
+		{
+			visible->back().index_count += meshlet.range.index_count;
+		}
+		else
+		{
+			visible->push_back(meshlet.range);
+		}
+	}
+	stats.range_count = visible->size();
+	return stats;
+}
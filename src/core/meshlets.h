@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vertices.h"
+#include "camera.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Partitioning of index buffers into small clusters that can be culled
+// against the view one by one. Clusters take triangles in index order,
+// which the vertex cache optimization has already made spatially coherent,
+// so they stay contiguous in the index buffer and draw as plain ranges.
+
+#define TOS_MESHLET_MAX_VERTICES 64
+#define TOS_MESHLET_MAX_TRIANGLES 124
+
+struct TOS_meshlet_cull_stats
+{
+	size_t visible;
+	size_t frustum_culled;
+	size_t backface_culled;
+	// Draws left after merging adjacent visible meshlets
+	size_t range_count;
+	// Mesh-space distance from the camera to the bounding sphere of the
+	// closest visible meshlet, 0 inside one and infinity when none is visible
+	float nearest;
+};
+
+// Builds meshlets inside each range, so none straddles a vertex offset
+void TOS_build_meshlets
+(
+	const TOS_vertex* vertices, const uint32_t* indices,
+	const TOS_mesh_range* ranges, size_t range_count,
+	std::vector<TOS_meshlet>* meshlets
+);
+// Collects the meshlets of a mesh drawn with model matrix M that are inside
+// the camera frustum and not entirely backfacing, merging neighbours into
+// as few ranges as possible
+TOS_meshlet_cull_stats TOS_cull_meshlets(const TOS_mesh* mesh, glm::mat4 M, TOS_camera* camera, std::vector<TOS_mesh_range>* visible);
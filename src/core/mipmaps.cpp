@@ -0,0 +1,371 @@
+#include "mipmaps.h"
+
+#include "threads.h"
+#include "cowtools.h"
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include <chrono>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 0
+#endif
+
+// Linear values are encoded back to sRGB through a table this fine, which
+// keeps the darkest steps of the curve within a rounding of the exact one
+#define ENCODE_TABLE_BITS 16
+#define ENCODE_TABLE_SIZE (1 << ENCODE_TABLE_BITS)
+// Rows filtered per task when a level is split across threads
+#define BAND_ROWS 16
+
+// Source texels one destination texel covers along one axis
+struct filter_taps
+{
+	uint32_t first;
+	uint32_t count;
+	float weights[3];
+};
+
+static filter_taps get_taps(uint32_t source_size, uint32_t i)
+{
+	if(source_size == 1)
+		return {0, 1, {1.0f, 0.0f, 0.0f}};
+	if(source_size % 2 == 0)
+		return {2*i, 2, {0.5f, 0.5f, 0.0f}};
+	// An odd size 2n+1 spread over n texels gives each one a span of
+	// 2+1/n source texels, which straddles three of them
+	float n = (float) (source_size / 2);
+	float size = (float) source_size;
+	return {2*i, 3, {(n - i) / size, n / size, (i + 1) / size}};
+}
+
+static float srgb_to_linear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8_t to_byte(float value)
+{
+	return (uint8_t) TOS_clamp(value * 255.0f + 0.5f, 0.0f, 255.0f);
+}
+
+struct conversion_tables
+{
+	// Indexed by byte + 256 * channel, so one lookup per byte of a texel
+	// handles colour and alpha alike
+	float srgb[1024];
+	float unorm[1024];
+	uint8_t encode[ENCODE_TABLE_SIZE];
+
+	conversion_tables()
+	{
+		for(int c = 0; c < 4; c++)
+		{
+			for(int i = 0; i < 256; i++)
+			{
+				srgb[c*256 + i] = c < 3 ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+				unorm[c*256 + i] = i / 255.0f;
+			}
+		}
+		for(int i = 0; i < ENCODE_TABLE_SIZE; i++)
+			encode[i] = to_byte(linear_to_srgb(i / (float) (ENCODE_TABLE_SIZE-1)));
+	}
+};
+
+static const conversion_tables& get_tables()
+{
+	static const conversion_tables tables;
+	return tables;
+}
+
+uint32_t TOS_get_mip_count(uint32_t width, uint32_t height)
+{
+	return (uint32_t) floor(log2(TOS_max(TOS_max(width, height), 1u))) + 1;
+}
+
+static void linearize_row(const uint8_t* row, size_t count, const float* table, float* out)
+{
+	size_t i = 0;
+#if SIMD_WIDTH == 8
+	const __m256i channels = _mm256_setr_epi32(0, 256, 512, 768, 0, 256, 512, 768);
+	for(; i + 8 <= count; i += 8)
+	{
+		__m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (row + i)));
+		_mm256_storeu_ps(out + i, _mm256_i32gather_ps(table, _mm256_add_epi32(bytes, channels), 4));
+	}
+#endif
+	for(; i < count; i++)
+		out[i] = table[row[i] + 256 * (i % 4)];
+}
+
+static void blend_rows(float* const* rows, const float* weights, uint32_t row_count, size_t count, float* out)
+{
+	size_t i = 0;
+#if SIMD_WIDTH == 8
+	for(; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_mul_ps(_mm256_loadu_ps(rows[0] + i), _mm256_set1_ps(weights[0]));
+		for(uint32_t j = 1; j < row_count; j++)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[j] + i), _mm256_set1_ps(weights[j])));
+		_mm256_storeu_ps(out + i, sum);
+	}
+#elif SIMD_WIDTH == 4
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(weights[0]));
+		for(uint32_t j = 1; j < row_count; j++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[j] + i), _mm_set1_ps(weights[j])));
+		_mm_storeu_ps(out + i, sum);
+	}
+#endif
+	for(; i < count; i++)
+	{
+		float sum = rows[0][i] * weights[0];
+		for(uint32_t j = 1; j < row_count; j++)
+			sum += rows[j][i] * weights[j];
+		out[i] = sum;
+	}
+}
+
+static void filter_row(const float* row, uint32_t source_width, uint32_t width, float* out)
+{
+	uint32_t x = 0;
+	if(source_width % 2 == 0)
+	{
+#if SIMD_WIDTH == 8
+		// Two texels per register; pairing the low and high halves of two
+		// registers lines up the texels each destination texel averages
+		const __m256 half = _mm256_set1_ps(0.5f);
+		for(; x + 2 <= width; x += 2)
+		{
+			__m256 a = _mm256_loadu_ps(row + x*8);
+			__m256 b = _mm256_loadu_ps(row + x*8 + 8);
+			__m256 lows = _mm256_permute2f128_ps(a, b, 0x20);
+			__m256 highs = _mm256_permute2f128_ps(a, b, 0x31);
+			_mm256_storeu_ps(out + x*4, _mm256_mul_ps(_mm256_add_ps(lows, highs), half));
+		}
+#elif SIMD_WIDTH == 4
+		const __m128 half = _mm_set1_ps(0.5f);
+		for(; x < width; x++)
+			_mm_storeu_ps(out + x*4, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(row + x*8), _mm_loadu_ps(row + x*8 + 4)), half));
+#endif
+	}
+	for(; x < width; x++)
+	{
+		filter_taps columns = get_taps(source_width, x);
+		const float* texel = row + (size_t) columns.first * 4;
+#if SIMD_WIDTH > 0
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(texel), _mm_set1_ps(columns.weights[0]));
+		for(uint32_t i = 1; i < columns.count; i++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texel + i*4), _mm_set1_ps(columns.weights[i])));
+		_mm_storeu_ps(out + x*4, sum);
+#else
+		for(int c = 0; c < 4; c++)
+		{
+			float sum = 0.0f;
+			for(uint32_t i = 0; i < columns.count; i++)
+				sum += texel[i*4 + c] * columns.weights[i];
+			out[x*4 + c] = sum;
+		}
+#endif
+	}
+}
+
+static void encode_row(const float* row, uint32_t width, bool srgb, uint8_t* out)
+{
+	const uint8_t* encode = get_tables().encode;
+	const float colour_scale = srgb ? (float) (ENCODE_TABLE_SIZE-1) : 255.0f;
+#if SIMD_WIDTH > 0
+	// Colour becomes an index into the encode table, alpha the byte itself
+	const __m128 scale = _mm_setr_ps(colour_scale, colour_scale, colour_scale, 255.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for(uint32_t x = 0; x < width; x++)
+	{
+		__m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(row + x*4), zero), one);
+		int32_t indices[4];
+		_mm_storeu_si128((__m128i*) indices, _mm_cvtps_epi32(_mm_mul_ps(value, scale)));
+		for(int c = 0; c < 3; c++)
+			out[x*4 + c] = srgb ? encode[indices[c]] : (uint8_t) indices[c];
+		out[x*4 + 3] = (uint8_t) indices[3];
+	}
+#else
+	for(uint32_t x = 0; x < width; x++)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			float value = TOS_clamp(row[x*4 + c], 0.0f, 1.0f);
+			out[x*4 + c] = srgb ? encode[(int) (value * colour_scale + 0.5f)] : to_byte(value);
+		}
+		out[x*4 + 3] = to_byte(row[x*4 + 3]);
+	}
+#endif
+}
+
+static void downsample_rows(const TOS_image* source, TOS_image* destination, bool srgb, uint32_t first_row, uint32_t end_row)
+{
+	const float* table = srgb ? get_tables().srgb : get_tables().unorm;
+	size_t source_floats = (size_t) source->width * 4;
+	// Consecutive source rows land in different slots, so the row shared by
+	// neighbouring taps of an odd height is linearized once
+	std::vector<float> slots[3];
+	int64_t slot_rows[3] = {-1, -1, -1};
+	for(std::vector<float>& slot : slots)
+		slot.resize(source_floats);
+	std::vector<float> blended(source_floats);
+	std::vector<float> filtered((size_t) destination->width * 4);
+
+	for(uint32_t y = first_row; y < end_row; y++)
+	{
+		filter_taps rows = get_taps(source->height, y);
+		float* tap_rows[3];
+		for(uint32_t j = 0; j < rows.count; j++)
+		{
+			uint32_t source_row = rows.first + j;
+			int slot = source_row % 3;
+			if(slot_rows[slot] != source_row)
+			{
+				linearize_row(source->pixels + source_row * source_floats, source_floats, table, slots[slot].data());
+				slot_rows[slot] = source_row;
+			}
+			tap_rows[j] = slots[slot].data();
+		}
+		blend_rows(tap_rows, rows.weights, rows.count, source_floats, blended.data());
+		filter_row(blended.data(), source->width, destination->width, filtered.data());
+		encode_row(filtered.data(), destination->width, srgb, destination->pixels + (size_t) y * destination->width * 4);
+	}
+}
+
+void TOS_downsample_image(const TOS_image* source, TOS_image* destination, bool srgb, int thread_count)
+{
+	TOS_create_image(destination, TOS_max(source->width / 2, 1u), TOS_max(source->height / 2, 1u));
+	size_t texels = (size_t) destination->width * destination->height;
+	if(texels < TOS_MIP_PARALLEL_TEXELS || thread_count == 1)
+	{
+		downsample_rows(source, destination, srgb, 0, destination->height);
+		return;
+	}
+	uint32_t band_count = (destination->height + BAND_ROWS-1) / BAND_ROWS;
+	TOS_parallel_for
+	(
+		band_count,
+		[&](size_t band)
+		{
+			uint32_t first = (uint32_t) band * BAND_ROWS;
+			downsample_rows(source, destination, srgb, first, TOS_min(first + BAND_ROWS, destination->height));
+		},
+		thread_count
+	);
+}
+
+void TOS_downsample_image_reference(const TOS_image* source, TOS_image* destination, bool srgb)
+{
+	const float* linear = get_tables().srgb;
+	TOS_create_image(destination, TOS_max(source->width / 2, 1u), TOS_max(source->height / 2, 1u));
+	for(uint32_t y = 0; y < destination->height; y++)
+	{
+		filter_taps rows = get_taps(source->height, y);
+		for(uint32_t x = 0; x < destination->width; x++)
+		{
+			filter_taps columns = get_taps(source->width, x);
+			float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+			for(uint32_t j = 0; j < rows.count; j++)
+			{
+				const uint8_t* row = source->pixels + ((size_t) (rows.first + j) * source->width + columns.first) * 4;
+				for(uint32_t i = 0; i < columns.count; i++)
+				{
+					float weight = rows.weights[j] * columns.weights[i];
+					const uint8_t* texel = row + i * 4;
+					for(int c = 0; c < 3; c++)
+						sum[c] += weight * (srgb ? linear[texel[c]] : texel[c] / 255.0f);
+					sum[3] += weight * (texel[3] / 255.0f);
+				}
+			}
+			uint8_t* texel = destination->pixels + ((size_t) y * destination->width + x) * 4;
+			for(int c = 0; c < 3; c++)
+				texel[c] = to_byte(srgb ? linear_to_srgb(sum[c]) : sum[c]);
+			texel[3] = to_byte(sum[3]);
+		}
+	}
+}
+
+void TOS_build_mip_chain(const TOS_image* image, std::vector<TOS_image>* levels, bool srgb, int thread_count)
+{
+	uint32_t count = TOS_get_mip_count(image->width, image->height);
+	levels->resize(count - 1);
+	const TOS_image* above = image;
+	for(uint32_t level = 1; level < count; level++)
+	{
+		TOS_downsample_image(above, &(*levels)[level-1], srgb, thread_count);
+		above = &(*levels)[level-1];
+	}
+}
+
+void TOS_benchmark_mipmaps(uint32_t width, uint32_t height)
+{
+	TOS_image image;
+	TOS_create_image(&image, (int) width, (int) height);
+	uint32_t state = 0x9E3779B9;
+	for(size_t i = 0; i < image.size; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		// Smooth gradients with some noise, closer to a photo than pure noise
+		size_t texel = i / 4;
+		image.pixels[i] = (uint8_t) ((texel % width + texel / width + (state & 31)) * (i % 4 + 1));
+	}
+
+	auto throughput = [&](auto run)
+	{
+		int passes = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		double elapsed = 0;
+		do
+		{
+			TOS_image level;
+			run(&level);
+			TOS_destroy_image(&level);
+			passes++;
+			elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		while(elapsed < 0.5);
+		return (double) width * height * passes / elapsed / 1e6;
+	};
+	double reference_rate = throughput([&](TOS_image* level) { TOS_downsample_image_reference(&image, level); });
+	double single_rate = throughput([&](TOS_image* level) { TOS_downsample_image(&image, level, true, 1); });
+	double threaded_rate = throughput([&](TOS_image* level) { TOS_downsample_image(&image, level); });
+
+	TOS_image reference, fast;
+	TOS_downsample_image_reference(&image, &reference);
+	TOS_downsample_image(&image, &fast);
+	int largest_difference = 0;
+	size_t differences = 0;
+	for(size_t i = 0; i < reference.size; i++)
+	{
+		int difference = abs((int) reference.pixels[i] - (int) fast.pixels[i]);
+		largest_difference = TOS_max(largest_difference, difference);
+		differences += difference != 0;
+	}
+
+	std::cout << "TOS_benchmark_mipmaps: " << width << "x" << height << " sRGB, SIMD width " << SIMD_WIDTH << "\n"
+	<< "\treference:        " << reference_rate << " MPix/s\n"
+	<< "\tfast, one thread: " << single_rate << " MPix/s (" << single_rate / reference_rate << "x)\n"
+	<< "\tfast, threaded:   " << threaded_rate << " MPix/s (" << threaded_rate / reference_rate << "x)\n"
+	<< "\tdiffering bytes:  " << differences << " of " << reference.size << ", at most " << largest_difference << std::endl;
+
+	TOS_destroy_image(&fast);
+	TOS_destroy_image(&reference);
+	TOS_destroy_image(&image);
+}
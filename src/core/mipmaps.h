@@ -0,0 +1,33 @@
+#pragma once
+
+#include "textures.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Mip chains built on the CPU for RGBA8 images. Each level halves the one
+// above it, rounding down like vkCmdBlitImage does, and every texel is the
+// area-weighted average of the texels it covers: two per axis, or three
+// with fractional weights where an odd dimension does not split evenly.
+// sRGB colour is averaged in linear space; alpha always is.
+//
+// Rows are linearized through a table, filtered vertically and then
+// horizontally with AVX2 or SSE2 when the compiler targets them, and
+// encoded back through a second table. Large levels are split into bands
+// of rows across threads.
+
+// Destination texels below which a level is filtered on one thread
+#define TOS_MIP_PARALLEL_TEXELS (1 << 16)
+
+uint32_t TOS_get_mip_count(uint32_t width, uint32_t height);
+void TOS_downsample_image(const TOS_image* source, TOS_image* destination, bool srgb=true, int thread_count=0);
+// Straightforward per-texel version with exact sRGB conversions, kept as
+// the reference the fast path is measured against
+void TOS_downsample_image_reference(const TOS_image* source, TOS_image* destination, bool srgb=true);
+// Fills levels with every level below image, smallest last. Each is freed
+// with TOS_destroy_image.
+void TOS_build_mip_chain(const TOS_image* image, std::vector<TOS_image>* levels, bool srgb=true, int thread_count=0);
+
+// Compares the fast and reference paths on a generated image of the given
+// size, in MPix/s of source texels
+void TOS_benchmark_mipmaps(uint32_t width, uint32_t height);
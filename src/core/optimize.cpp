@@ -0,0 +1,208 @@
+#include "optimize.h"
+
+#include "threads.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+TOS_vertex_cache_stats TOS_simulate_vertex_cache(const uint32_t* indices, size_t index_count, size_t vertex_count, int cache_size)
+{
+	// A vertex is resident while fewer than cache_size misses have
+	// happened since it was last loaded, which is exactly a FIFO
+	std::vector<size_t> loaded_at(vertex_count, 0);
+	std::vector<bool> used(vertex_count, false);
+	size_t misses = 0;
+	size_t used_count = 0;
+	for(size_t i = 0; i < index_count; i++)
+	{
+		uint32_t v = indices[i];
+		if(!used[v])
+		{
+			used[v] = true;
+			used_count++;
+		}
+		else if(misses - loaded_at[v] < (size_t) cache_size)
+			continue;
+		misses++;
+		loaded_at[v] = misses;
+	}
+
+	size_t triangle_count = index_count / 3;
+	return
+	{
+		.ACMR = triangle_count > 0 ? misses / (float) triangle_count : 0.0f,
+		.ATVR = used_count > 0 ? misses / (float) used_count : 0.0f
+	};
+}
+
+static void tipsify(uint32_t* indices, size_t triangle_count, size_t vertex_count, int cache_size)
+{
+	// Vertex -> triangle adjacency, in input order
+	std::vector<uint32_t> live(vertex_count, 0);
+	for(size_t i = 0; i < triangle_count * 3; i++)
+		live[indices[i]]++;
+	std::vector<size_t> adjacency_offsets(vertex_count + 1, 0);
+	for(size_t v = 0; v < vertex_count; v++)
+		adjacency_offsets[v+1] = adjacency_offsets[v] + live[v];
+	std::vector<uint32_t> adjacency(triangle_count * 3);
+	{
+		std::vector<size_t> cursor(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for(size_t i = 0; i < triangle_count * 3; i++)
+			adjacency[cursor[indices[i]]++] = (uint32_t) (i / 3);
+	}
+
+	std::vector<size_t> cache_time(vertex_count, 0);
+	std::vector<bool> emitted(triangle_count, false);
+	std::vector<uint32_t> dead_ends;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(triangle_count * 3);
+
+	// Timestamps start past the cache size so that no vertex begins resident
+	size_t time = cache_size + 1;
+	size_t cursor = 0;
+	int64_t fan = indices[0];
+	while(fan >= 0)
+	{
+		candidates.clear();
+		for(size_t a = adjacency_offsets[fan]; a < adjacency_offsets[fan+1]; a++)
+		{
+			uint32_t t = adjacency[a];
+			if(emitted[t])
+				continue;
+			for(int c = 0; c < 3; c++)
+			{
+				uint32_t v = indices[t*3+c];
+				output.push_back(v);
+				dead_ends.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if(time - cache_time[v] > (size_t) cache_size)
+					cache_time[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Prefer the candidate that stays in cache longest while its
+		// remaining triangles are emitted; vertices that would fall out
+		// of cache before then score lowest
+		fan = -1;
+		int64_t best_priority = -1;
+		for(uint32_t v : candidates)
+		{
+			if(live[v] == 0)
+				continue;
+			int64_t priority = 0;
+			if(time - cache_time[v] + 2 * live[v] <= (size_t) cache_size)
+				priority = time - cache_time[v];
+			if(priority > best_priority)
+			{
+				best_priority = priority;
+				fan = v;
+			}
+		}
+		if(fan >= 0)
+			continue;
+
+		// Dead end: back up to a recently used vertex, else scan forward
+		while(!dead_ends.empty())
+		{
+			uint32_t v = dead_ends.back();
+			dead_ends.pop_back();
+			if(live[v] > 0)
+			{
+				fan = v;
+				break;
+			}
+		}
+		while(fan < 0 && cursor < vertex_count)
+		{
+			if(live[cursor] > 0)
+				fan = cursor;
+			cursor++;
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void TOS_optimize_vertex_cache(uint32_t* indices, size_t index_count, size_t vertex_count, int cache_size, size_t window_size)
+{
+	size_t triangle_count = index_count / 3;
+	if(triangle_count == 0)
+		return;
+	window_size = std::max(window_size, (size_t) 1);
+	if(triangle_count <= window_size)
+	{
+		tipsify(indices, triangle_count, vertex_count, cache_size);
+		return;
+	}
+
+	// Each window is renumbered to the vertices it uses, so that every
+	// array Tipsify needs is sized by the window rather than the mesh
+	std::vector<uint32_t> used;
+	std::vector<uint32_t> local;
+	for(size_t first = 0; first < triangle_count; first += window_size)
+	{
+		size_t count = std::min(window_size, triangle_count - first);
+		uint32_t* window = indices + first * 3;
+		used.assign(window, window + count * 3);
+		std::sort(used.begin(), used.end());
+		used.erase(std::unique(used.begin(), used.end()), used.end());
+		local.resize(count * 3);
+		for(size_t i = 0; i < count * 3; i++)
+			local[i] = (uint32_t) (std::lower_bound(used.begin(), used.end(), window[i]) - used.begin());
+
+		tipsify(local.data(), count, used.size(), cache_size);
+		for(size_t i = 0; i < count * 3; i++)
+			window[i] = used[local[i]];
+	}
+}
+
+size_t TOS_optimize_vertex_fetch(TOS_vertex* vertices, size_t vertex_count, uint32_t* indices, size_t index_count)
+{
+	std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+	uint32_t next = 0;
+	for(size_t i = 0; i < index_count; i++)
+	{
+		uint32_t& target = remap[indices[i]];
+		if(target == UINT32_MAX)
+			target = next++;
+		indices[i] = target;
+	}
+	size_t used_count = next;
+	for(size_t v = 0; v < vertex_count; v++)
+	{
+		if(remap[v] == UINT32_MAX)
+			remap[v] = next++;
+	}
+
+	// Apply the permutation in place by following its cycles, so the
+	// vertices are never copied
+	for(size_t v = 0; v < vertex_count; v++)
+	{
+		while(remap[v] != v)
+		{
+			uint32_t target = remap[v];
+			std::swap(vertices[v], vertices[target]);
+			std::swap(remap[v], remap[target]);
+		}
+	}
+	return used_count;
+}
+
+void TOS_optimize_mesh(TOS_vertex* vertices, size_t vertex_count, uint32_t* indices, size_t index_count)
+{
+	TOS_optimize_vertex_cache(indices, index_count, vertex_count);
+	TOS_optimize_vertex_fetch(vertices, vertex_count, indices, index_count);
+}
+
+void TOS_print_optimization_report(const char* name, const TOS_mesh_optimization_report* report)
+{
+	std::ostringstream line;
+	line << "TOS_optimize_mesh: " << name
+	<< " ACMR " << report->before.ACMR << " -> " << report->after.ACMR
+	<< ", ATVR " << report->before.ATVR << " -> " << report->after.ATVR;
+	TOS_print_line(std::cout, line.str());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "vertices.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Reordering passes for the post-transform vertex cache and vertex fetch.
+// Triangle order follows Tipsify (Sander et al. 2007), fanning around
+// recently used vertices; vertices are then renumbered in first-use order.
+
+#define TOS_VERTEX_CACHE_SIZE 16
+// Triangles Tipsify reorders at a time. Each window needs around 60 bytes of
+// state per triangle; cache locality across window edges is lost.
+#define TOS_VERTEX_CACHE_WINDOW (1 << 20)
+// Bytes per vertex that TOS_simulate_vertex_cache and TOS_optimize_vertex_fetch
+// need at most, since both track every vertex of the mesh at once
+#define TOS_OPTIMIZE_VERTEX_STATE_SIZE (sizeof(size_t) + 1)
+
+struct TOS_vertex_cache_stats
+{
+	// Average cache miss ratio: transformed vertices per triangle, 0.5 at best
+	float ACMR;
+	// Average transform to vertex ratio: transformed vertices per vertex, 1 at best
+	float ATVR;
+};
+
+struct TOS_mesh_optimization_report
+{
+	TOS_vertex_cache_stats before;
+	TOS_vertex_cache_stats after;
+};
+
+// Replays the index buffer through a FIFO cache of the given size
+TOS_vertex_cache_stats TOS_simulate_vertex_cache(const uint32_t* indices, size_t index_count, size_t vertex_count, int cache_size=TOS_VERTEX_CACHE_SIZE);
+void TOS_optimize_vertex_cache(uint32_t* indices, size_t index_count, size_t vertex_count, int cache_size=TOS_VERTEX_CACHE_SIZE, size_t window_size=TOS_VERTEX_CACHE_WINDOW);
+// Renumbers vertices in the order the index buffer first uses them.
+// Unreferenced vertices move to the end; returns the number referenced.
+size_t TOS_optimize_vertex_fetch(TOS_vertex* vertices, size_t vertex_count, uint32_t* indices, size_t index_count);
+// Runs both passes in place
+void TOS_optimize_mesh(TOS_vertex* vertices, size_t vertex_count, uint32_t* indices, size_t index_count);
+void TOS_print_optimization_report(const char* name, const TOS_mesh_optimization_report* report);
@@ -14,15 +14,15 @@ void TOS_create_uniform_buffer(TOS_device* device, TOS_uniform_buffer* buffer)
 		device, buffer_size,
 		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		buffer->buffer, buffer->memory
+		buffer->buffer, buffer->allocation
 	);
-	vkMapMemory(device->logical, buffer->memory, 0, buffer_size, 0, &buffer->pointer);
+	buffer->pointer = buffer->allocation.mapped;
 }
 
 void TOS_destroy_uniform_buffer(TOS_device* device, TOS_uniform_buffer* buffer)
 {
-	vkFreeMemory(device->logical, buffer->memory, nullptr);
 	vkDestroyBuffer(device->logical, buffer->buffer, nullptr);
+	TOS_free_memory(device, &buffer->allocation);
 }
 
 void TOS_create_descriptors(TOS_descriptors* pipeline, uint32_t concurrency)
@@ -173,8 +173,8 @@ void TOS_create_pipeline
 	VkPipelineVertexInputStateCreateInfo vertex_input_info {};
 	vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	
-	VkVertexInputBindingDescription binding_description = TOS_get_vertex_binding_description();
-	std::vector<VkVertexInputAttributeDescription> attribute_descriptions = TOS_get_vertex_attribute_descriptions();
+	VkVertexInputBindingDescription binding_description = TOS_get_vertex_binding_description(specification.vertex_format);
+	std::vector<VkVertexInputAttributeDescription> attribute_descriptions = TOS_get_vertex_attribute_descriptions(specification.vertex_format);
 	vertex_input_info.vertexBindingDescriptionCount = 1;
 	vertex_input_info.pVertexBindingDescriptions = &binding_description;
 	vertex_input_info.vertexAttributeDescriptionCount = (uint32_t) attribute_descriptions.size();
@@ -309,6 +309,7 @@ void TOS_create_pipeline
 	result = vkCreateGraphicsPipelines(device->logical, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline->pipeline);
 	if(result != VK_SUCCESS)
 		throw std::runtime_error("TOS_create_pipeline: failed to create pipeline");
+	pipeline->vertex_format = specification.vertex_format;
 	
 	vkDestroyShaderModule(device->logical, vert_shader, nullptr);
 	vkDestroyShaderModule(device->logical, frag_shader, nullptr);
@@ -16,7 +16,7 @@ struct TOS_UBO
 struct TOS_uniform_buffer
 {
 	VkBuffer buffer;
-	VkDeviceMemory memory;
+	TOS_allocation allocation;
 	void* pointer;
 };
 
@@ -29,6 +29,9 @@ struct TOS_push_constants
 	int texture_idx;
 	float wireframe;
 	uint32_t flags;
+	// Bounds that packed vertex positions decode into, set by TOS_draw_mesh
+	alignas(16) glm::vec4 quantization_min;
+	alignas(16) glm::vec4 quantization_extent;
 };
 
 struct TOS_descriptors
@@ -56,12 +59,14 @@ struct TOS_pipeline_specification
 	VkPrimitiveTopology topology;
 	VkPolygonMode polygon_mode;
 	VkCompareOp depth_compare_op;
+	TOS_vertex_format vertex_format;
 };
 
 struct TOS_pipeline
 {
 	VkPipelineLayout pipeline_layout;
 	VkPipeline pipeline;
+	TOS_vertex_format vertex_format;
 };
 
 void TOS_create_pipeline
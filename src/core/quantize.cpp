@@ -0,0 +1,137 @@
+#include "quantize.h"
+
+#include "cowtools.h"
+#include <glm/gtc/packing.hpp>
+#include <iostream>
+#include <math.h>
+
+// A flat axis keeps a unit extent so it never divides by zero
+static glm::vec3 quantization_extent(glm::vec3 min, glm::vec3 max)
+{
+	glm::vec3 extent = max - min;
+	for(int i = 0; i < 3; i++)
+	{
+		if(!(extent[i] > 0.0f))
+			extent[i] = 1.0f;
+	}
+	return extent;
+}
+
+// Folds the lower hemisphere over the upper so the unit sphere maps onto [-1, 1]^2
+static glm::vec2 encode_octahedral(glm::vec3 n)
+{
+	n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	glm::vec2 e = glm::vec2(n.x, n.y);
+	if(n.z < 0.0f)
+	{
+		e.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+static glm::vec3 decode_octahedral(glm::vec2 e)
+{
+	glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+	float t = TOS_max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+void TOS_pack_vertices(const TOS_vertex* vertices, size_t count, glm::vec3 min, glm::vec3 max, TOS_packed_vertex* packed)
+{
+	glm::vec3 extent = quantization_extent(min, max);
+	for(size_t i = 0; i < count; i++)
+	{
+		const TOS_vertex& vertex = vertices[i];
+		TOS_packed_vertex& out = packed[i];
+
+		glm::vec3 t = (vertex.position - min) / extent;
+		for(int j = 0; j < 3; j++)
+			out.position[j] = glm::packUnorm1x16(t[j]);
+
+		out.uv[0] = glm::packHalf1x16(vertex.uv.x);
+		out.uv[1] = glm::packHalf1x16(vertex.uv.y);
+
+		out.material = (uint16_t) TOS_min(vertex.material_idx, (uint32_t) TOS_PACKED_MATERIAL_MASK);
+		float length = glm::length(vertex.normal);
+		if(length > 0.0f)
+		{
+			glm::vec2 e = encode_octahedral(vertex.normal / length);
+			out.normal[0] = (int16_t) glm::packSnorm1x16(e.x);
+			out.normal[1] = (int16_t) glm::packSnorm1x16(e.y);
+		}
+		else
+		{
+			out.normal[0] = 0;
+			out.normal[1] = 0;
+			out.material |= TOS_PACKED_MATERIAL_NO_NORMAL;
+		}
+	}
+}
+
+TOS_vertex TOS_unpack_vertex(const TOS_packed_vertex& packed, glm::vec3 min, glm::vec3 max)
+{
+	glm::vec3 extent = quantization_extent(min, max);
+	glm::vec3 t
+	(
+		glm::unpackUnorm1x16(packed.position[0]),
+		glm::unpackUnorm1x16(packed.position[1]),
+		glm::unpackUnorm1x16(packed.position[2])
+	);
+
+	glm::vec3 normal = glm::vec3(0);
+	if(!(packed.material & TOS_PACKED_MATERIAL_NO_NORMAL))
+	{
+		normal = decode_octahedral
+		(
+			glm::vec2(
+				glm::unpackSnorm1x16((uint16_t) packed.normal[0]),
+				glm::unpackSnorm1x16((uint16_t) packed.normal[1])
+			)
+		);
+	}
+
+	return
+	{
+		.position = min + t * extent,
+		.uv = glm::vec2(glm::unpackHalf1x16(packed.uv[0]), glm::unpackHalf1x16(packed.uv[1])),
+		.normal = normal,
+		.material_idx = (uint32_t) (packed.material & TOS_PACKED_MATERIAL_MASK)
+	};
+}
+
+TOS_quantization_error TOS_measure_quantization_error(const TOS_vertex* vertices, const TOS_packed_vertex* packed, size_t count, glm::vec3 min, glm::vec3 max)
+{
+	TOS_quantization_error error = {};
+	float min_cosine = 1.0f;
+	for(size_t i = 0; i < count; i++)
+	{
+		const TOS_vertex& vertex = vertices[i];
+		TOS_vertex decoded = TOS_unpack_vertex(packed[i], min, max);
+
+		error.position = TOS_max(error.position, glm::length(decoded.position - vertex.position));
+		glm::vec2 duv = glm::abs(decoded.uv - vertex.uv);
+		error.uv = TOS_max(error.uv, TOS_max(duv.x, duv.y));
+
+		float length = glm::length(vertex.normal);
+		if(length > 0.0f)
+			min_cosine = TOS_min(min_cosine, glm::dot(vertex.normal / length, decoded.normal));
+		if(vertex.material_idx > TOS_PACKED_MATERIAL_MASK)
+			error.clamped_materials++;
+	}
+	error.normal_degrees = acosf(TOS_clamp(min_cosine, -1.0f, 1.0f)) * 180.0f / (float) M_PI;
+	return error;
+}
+
+void TOS_print_quantization_error(const char* name, const TOS_quantization_error* error)
+{
+	std::cout << "TOS_pack_vertices: " << name
+	<< " position error " << error->position
+	<< ", uv error " << error->uv
+	<< ", normal error " << error->normal_degrees << " degrees";
+	if(error->clamped_materials > 0)
+		std::cout << ", " << error->clamped_materials << " materials clamped";
+	std::cout << std::endl;
+}
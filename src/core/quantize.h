@@ -0,0 +1,26 @@
+#pragma once
+
+#include "vertices.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Conversion between TOS_vertex and TOS_packed_vertex. Positions are
+// quantized against a bounding box, which the packed vertex shader takes
+// back as push constants to decode them.
+
+struct TOS_quantization_error
+{
+	// Largest distance between a position and its decoded value
+	float position;
+	// Largest per-component difference in uv
+	float uv;
+	// Largest angle between a unit normal and its decoded value
+	float normal_degrees;
+	// Vertices whose material index did not fit and was clamped
+	size_t clamped_materials;
+};
+
+void TOS_pack_vertices(const TOS_vertex* vertices, size_t count, glm::vec3 min, glm::vec3 max, TOS_packed_vertex* packed);
+TOS_vertex TOS_unpack_vertex(const TOS_packed_vertex& packed, glm::vec3 min, glm::vec3 max);
+TOS_quantization_error TOS_measure_quantization_error(const TOS_vertex* vertices, const TOS_packed_vertex* packed, size_t count, glm::vec3 min, glm::vec3 max);
+void TOS_print_quantization_error(const char* name, const TOS_quantization_error* error);
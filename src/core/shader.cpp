@@ -5,7 +5,7 @@
 VkShaderModule TOS_load_shader(TOS_device* device, const char* path)
 {
 	size_t file_size;
-	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_PRIVATE, &file_size);
+	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_READ, &file_size, TOS_FILE_MAP_POPULATE);
 
 	VkShaderModuleCreateInfo create_info {};
 	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -0,0 +1,308 @@
+#include "simplify.h"
+
+#include "optimize.h"
+#include "threads.h"
+#include "cowtools.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <math.h>
+
+// Symmetric 4x4 matrix summing the squared distances to a set of planes,
+// with the number of planes so errors can be read as a mean
+struct quadric
+{
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+	double weight;
+};
+
+static void add_plane(quadric* q, glm::vec3 n, float d)
+{
+	q->a00 += n.x * n.x; q->a01 += n.x * n.y; q->a02 += n.x * n.z; q->a03 += n.x * d;
+	q->a11 += n.y * n.y; q->a12 += n.y * n.z; q->a13 += n.y * d;
+	q->a22 += n.z * n.z; q->a23 += n.z * d;
+	q->a33 += (double) d * d;
+	q->weight += 1.0;
+}
+
+static void add_quadric(quadric* q, const quadric& other)
+{
+	q->a00 += other.a00; q->a01 += other.a01; q->a02 += other.a02; q->a03 += other.a03;
+	q->a11 += other.a11; q->a12 += other.a12; q->a13 += other.a13;
+	q->a22 += other.a22; q->a23 += other.a23;
+	q->a33 += other.a33;
+	q->weight += other.weight;
+}
+
+static double evaluate_quadric(const quadric& q, glm::vec3 p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	double error =
+	q.a00*x*x + 2*q.a01*x*y + 2*q.a02*x*z + 2*q.a03*x +
+	q.a11*y*y + 2*q.a12*y*z + 2*q.a13*y +
+	q.a22*z*z + 2*q.a23*z +
+	q.a33;
+	return q.weight > 0.0 ? TOS_max(error, 0.0) / q.weight : 0.0;
+}
+
+struct collapse
+{
+	double cost;
+	double error;
+	uint32_t from;
+	uint32_t to;
+};
+
+// Locks both ends of every edge not shared by exactly two triangles.
+// Edges are counted by vertex index, so a uv or normal seam, where one
+// position is split into several vertices, shows up as a border too.
+static void lock_borders(const uint32_t* indices, size_t index_count, std::vector<uint8_t>* locked)
+{
+	std::vector<uint64_t> edges;
+	edges.reserve(index_count);
+	for(size_t i = 0; i+2 < index_count; i += 3)
+	{
+		for(int e = 0; e < 3; e++)
+		{
+			uint64_t a = indices[i+e];
+			uint64_t b = indices[i+(e+1)%3];
+			edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for(size_t i = 0; i < edges.size();)
+	{
+		size_t run = i+1;
+		while(run < edges.size() && edges[run] == edges[i])
+			run++;
+		if(run - i != 2)
+		{
+			(*locked)[edges[i] >> 32] = 1;
+			(*locked)[edges[i] & UINT32_MAX] = 1;
+		}
+		i = run;
+	}
+}
+
+// Collapsing from onto to must not fold any surviving triangle of from over
+static bool collapse_flips
+(
+	const TOS_vertex* vertices, const uint32_t* indices,
+	const uint32_t* triangles, size_t triangle_count,
+	uint32_t from, uint32_t to
+)
+{
+	for(size_t t = 0; t < triangle_count; t++)
+	{
+		const uint32_t* triangle = &indices[triangles[t] * 3];
+		if(triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			continue;
+		glm::vec3 p[3];
+		glm::vec3 q[3];
+		for(int c = 0; c < 3; c++)
+		{
+			p[c] = vertices[triangle[c]].position;
+			q[c] = triangle[c] == from ? vertices[to].position : p[c];
+		}
+		glm::vec3 before = glm::cross(p[1]-p[0], p[2]-p[0]);
+		glm::vec3 after = glm::cross(q[1]-q[0], q[2]-q[0]);
+		if(glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+			return true;
+	}
+	return false;
+}
+
+float TOS_simplify
+(
+	const TOS_vertex* vertices, size_t vertex_count,
+	const uint32_t* indices, size_t index_count,
+	size_t target_index_count, float target_error,
+	std::vector<uint32_t>* destination
+)
+{
+	index_count -= index_count % 3;
+	std::vector<uint32_t>& result = *destination;
+	result.assign(indices, indices + index_count);
+
+	std::vector<uint8_t> locked(vertex_count, 0);
+	lock_borders(indices, index_count, &locked);
+
+	glm::vec3 min = glm::vec3(INFINITY, INFINITY, INFINITY);
+	glm::vec3 max = -min;
+	std::vector<quadric> quadrics(vertex_count, quadric {});
+	for(size_t i = 0; i < index_count; i += 3)
+	{
+		glm::vec3 a = vertices[indices[i+0]].position;
+		glm::vec3 b = vertices[indices[i+1]].position;
+		glm::vec3 c = vertices[indices[i+2]].position;
+		min = glm::min(min, glm::min(a, glm::min(b, c)));
+		max = glm::max(max, glm::max(a, glm::max(b, c)));
+		glm::vec3 n = glm::cross(b-a, c-a);
+		float length = glm::length(n);
+		if(length == 0.0f)
+			continue;
+		n /= length;
+		for(int k = 0; k < 3; k++)
+			add_plane(&quadrics[indices[i+k]], n, -glm::dot(n, a));
+	}
+	double attribute_scale = index_count > 0 ? glm::length(max - min) * TOS_SIMPLIFY_ATTRIBUTE_WEIGHT : 0.0;
+	attribute_scale *= attribute_scale;
+	double error_limit = (double) target_error * target_error;
+
+	std::vector<uint32_t> live(vertex_count);
+	std::vector<size_t> adjacency_offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<collapse> collapses;
+	std::vector<uint8_t> touched(vertex_count);
+	std::vector<uint32_t> remap(vertex_count);
+	double max_error = 0.0;
+
+	while(result.size() > target_index_count)
+	{
+		// Vertex -> triangle adjacency of the current index list
+		std::fill(live.begin(), live.end(), 0);
+		for(uint32_t v : result)
+			live[v]++;
+		adjacency_offsets[0] = 0;
+		for(size_t v = 0; v < vertex_count; v++)
+			adjacency_offsets[v+1] = adjacency_offsets[v] + live[v];
+		adjacency.resize(result.size());
+		{
+			std::vector<size_t> cursor(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+			for(size_t i = 0; i < result.size(); i++)
+				adjacency[cursor[result[i]]++] = (uint32_t) (i / 3);
+		}
+
+		collapses.clear();
+		for(size_t i = 0; i < result.size(); i += 3)
+		{
+			for(int e = 0; e < 3; e++)
+			{
+				uint32_t a = result[i+e];
+				uint32_t b = result[i+(e+1)%3];
+				for(int direction = 0; direction < 2; direction++)
+				{
+					uint32_t from = direction == 0 ? a : b;
+					uint32_t to = direction == 0 ? b : a;
+					if(locked[from])
+						continue;
+
+					quadric q = quadrics[from];
+					add_quadric(&q, quadrics[to]);
+					double error = evaluate_quadric(q, vertices[to].position);
+					glm::vec2 duv = vertices[from].uv - vertices[to].uv;
+					glm::vec3 dn = vertices[from].normal - vertices[to].normal;
+					double attribute = (glm::dot(duv, duv) + glm::dot(dn, dn)) * attribute_scale;
+					collapses.push_back({error + attribute, error, from, to});
+				}
+			}
+		}
+		std::sort
+		(
+			collapses.begin(), collapses.end(),
+			[](const collapse& a, const collapse& b)
+			{
+				return a.cost < b.cost || (a.cost == b.cost && (a.from < b.from || (a.from == b.from && a.to < b.to)));
+			}
+		);
+
+		// Take the cheapest collapses whose neighbourhoods do not overlap,
+		// so every flip test sees the positions the collapse will produce
+		std::fill(touched.begin(), touched.end(), 0);
+		for(size_t v = 0; v < vertex_count; v++)
+			remap[v] = (uint32_t) v;
+		size_t removal_goal = (result.size() - target_index_count) / 3;
+		size_t removed = 0;
+		size_t applied = 0;
+		for(const collapse& c : collapses)
+		{
+			if(removed >= removal_goal)
+				break;
+			if(c.error > error_limit || touched[c.from] || touched[c.to])
+				continue;
+			const uint32_t* triangles = &adjacency[adjacency_offsets[c.from]];
+			size_t triangle_count = adjacency_offsets[c.from+1] - adjacency_offsets[c.from];
+			if(collapse_flips(vertices, result.data(), triangles, triangle_count, c.from, c.to))
+				continue;
+
+			remap[c.from] = c.to;
+			add_quadric(&quadrics[c.to], quadrics[c.from]);
+			max_error = TOS_max(max_error, c.error);
+			applied++;
+			for(size_t t = 0; t < triangle_count; t++)
+			{
+				const uint32_t* triangle = &result[triangles[t] * 3];
+				bool degenerate = false;
+				for(int k = 0; k < 3; k++)
+				{
+					touched[triangle[k]] = 1;
+					degenerate = degenerate || triangle[k] == c.to;
+				}
+				removed += degenerate;
+			}
+		}
+		if(applied == 0)
+			break;
+
+		size_t write = 0;
+		for(size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = remap[result[i+0]];
+			uint32_t b = remap[result[i+1]];
+			uint32_t c = remap[result[i+2]];
+			if(a == b || b == c || c == a)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+	return (float) sqrt(max_error);
+}
+
+void TOS_build_lod_chain
+(
+	const TOS_vertex* vertices, size_t vertex_count,
+	std::vector<uint32_t>* indices, int lod_count, float ratio,
+	std::vector<TOS_lod_span>* lods
+)
+{
+	lod_count = TOS_clamp(lod_count, 1, TOS_LOD_MAX_COUNT);
+	uint32_t base_count = (uint32_t) (indices->size() - indices->size() % 3);
+	lods->clear();
+	lods->push_back({0, base_count, 0.0f});
+
+	std::vector<uint32_t> level;
+	for(int l = 1; l < lod_count; l++)
+	{
+		uint32_t previous = lods->back().index_count;
+		size_t target = (size_t) (previous * ratio) / 3 * 3;
+		// Each level starts over from the full mesh, so its error is
+		// measured against the original surface and not the level before
+		float error = TOS_simplify(vertices, vertex_count, indices->data(), base_count, target, INFINITY, &level);
+		if(level.empty() || level.size() > previous * 0.9f)
+			break;
+		TOS_optimize_vertex_cache(level.data(), level.size(), vertex_count);
+
+		uint32_t first = (uint32_t) indices->size();
+		indices->insert(indices->end(), level.begin(), level.end());
+		lods->push_back({first, (uint32_t) level.size(), TOS_max(error, lods->back().error)});
+	}
+}
+
+void TOS_print_lod_chain(const char* name, const TOS_lod_span* lods, size_t lod_count)
+{
+	std::ostringstream line;
+	line << "TOS_simplify: " << name;
+	for(size_t l = 0; l < lod_count; l++)
+	{
+		line << (l == 0 ? " " : ", ")
+		<< "LOD" << l << " " << lods[l].index_count / 3 << " triangles"
+		<< " error " << lods[l].error;
+	}
+	TOS_print_line(std::cout, line.str());
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "vertices.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Mesh simplification by quadric error metrics (Garland and Heckbert 1997).
+// Vertices collapse onto a neighbour, so every level of detail reuses the
+// original vertex array and only needs a new index list. Vertices on open
+// borders and on uv or normal seams are locked in place, and differences
+// in uv and normal add to the cost of a collapse so that attributes stay
+// continuous where geometry alone would allow a collapse.
+
+#define TOS_LOD_MAX_COUNT 8
+// Scale of attribute differences relative to the mesh extent in collapse costs
+#define TOS_SIMPLIFY_ATTRIBUTE_WEIGHT 0.01f
+
+// Simplifies towards target_index_count indices, never collapsing past
+// target_error in mesh units. Returns the largest geometric error of any
+// collapse taken, as the root mean square distance of the collapsed vertex
+// from the original planes around it.
+float TOS_simplify
+(
+	const TOS_vertex* vertices, size_t vertex_count,
+	const uint32_t* indices, size_t index_count,
+	size_t target_index_count, float target_error,
+	std::vector<uint32_t>* destination
+);
+
+// Appends up to lod_count-1 levels to indices, each about ratio times the
+// index count of the one before, stopping early once a level no longer
+// shrinks. The spans describe every level including the original one.
+void TOS_build_lod_chain
+(
+	const TOS_vertex* vertices, size_t vertex_count,
+	std::vector<uint32_t>* indices, int lod_count, float ratio,
+	std::vector<TOS_lod_span>* lods
+);
+void TOS_print_lod_chain(const char* name, const TOS_lod_span* lods, size_t lod_count);
@@ -0,0 +1,179 @@
+#include "split.h"
+
+#include <algorithm>
+
+// Packs triangles, given as vertex triples, into chunks in order, writing
+// each triangle's chunk and chunk-relative corners. local must hold
+// UINT32_MAX for every vertex and does again on return.
+static void chunk_triangles
+(
+	const uint32_t* triangles, size_t triangle_count,
+	std::vector<uint32_t>* local, std::vector<std::vector<uint32_t>>* chunks,
+	uint32_t* triangle_chunks, uint32_t* corners
+)
+{
+	size_t first_chunk = chunks->size();
+	auto close_chunk = [&]()
+	{
+		for(uint32_t v : chunks->back())
+			(*local)[v] = UINT32_MAX;
+		chunks->emplace_back();
+	};
+	chunks->emplace_back();
+
+	for(size_t t = 0; t < triangle_count; t++)
+	{
+		const uint32_t* triangle = &triangles[t*3];
+		size_t added = 0;
+		for(int c = 0; c < 3; c++)
+		{
+			bool repeated = (c > 0 && triangle[c] == triangle[0]) || (c > 1 && triangle[c] == triangle[1]);
+			if((*local)[triangle[c]] == UINT32_MAX && !repeated)
+				added++;
+		}
+		if(chunks->back().size() + added > TOS_INDEX16_VERTEX_LIMIT)
+			close_chunk();
+
+		std::vector<uint32_t>& chunk = chunks->back();
+		for(int c = 0; c < 3; c++)
+		{
+			uint32_t v = triangle[c];
+			if((*local)[v] == UINT32_MAX)
+			{
+				(*local)[v] = (uint32_t) chunk.size();
+				chunk.push_back(v);
+			}
+			corners[t*3+c] = (*local)[v];
+		}
+		triangle_chunks[t] = (uint32_t) chunks->size() - 1;
+	}
+	for(uint32_t v : chunks->back())
+		(*local)[v] = UINT32_MAX;
+	if(chunks->back().empty() && chunks->size() > first_chunk)
+		chunks->pop_back();
+}
+
+void TOS_split_mesh
+(
+	const TOS_vertex* vertices, size_t vertex_count, const uint32_t* indices,
+	const TOS_lod_span* lods, uint32_t lod_count,
+	TOS_split_result* result
+)
+{
+	result->vertices.clear();
+	result->indices.clear();
+	result->ranges.clear();
+	result->lods.clear();
+
+	std::vector<std::vector<uint32_t>> chunks;
+	std::vector<uint32_t> local(vertex_count, UINT32_MAX);
+	std::vector<std::vector<uint32_t>> triangle_chunks(lod_count);
+	std::vector<std::vector<uint32_t>> corners(lod_count);
+	for(uint32_t l = 0; l < lod_count; l++)
+	{
+		size_t triangle_count = lods[l].index_count / 3;
+		triangle_chunks[l].resize(triangle_count);
+		corners[l].resize(triangle_count * 3);
+	}
+	if(lod_count == 0)
+		return;
+
+	chunk_triangles(indices + lods[0].first_index, lods[0].index_count / 3, &local, &chunks, triangle_chunks[0].data(), corners[0].data());
+
+	// The chunk each vertex first landed in and its place there
+	std::vector<uint32_t> home(vertex_count, UINT32_MAX);
+	std::vector<uint32_t> home_local(vertex_count);
+	for(uint32_t c = 0; c < chunks.size(); c++)
+	{
+		for(uint32_t i = 0; i < chunks[c].size(); i++)
+		{
+			uint32_t v = chunks[c][i];
+			if(home[v] == UINT32_MAX)
+			{
+				home[v] = c;
+				home_local[v] = i;
+			}
+		}
+	}
+
+	for(uint32_t l = 1; l < lod_count; l++)
+	{
+		const uint32_t* level = indices + lods[l].first_index;
+		std::vector<uint32_t> straddling;
+		std::vector<size_t> straddling_at;
+		for(size_t t = 0; t < triangle_chunks[l].size(); t++)
+		{
+			const uint32_t* triangle = &level[t*3];
+			uint32_t chunk = home[triangle[0]];
+			if(chunk != UINT32_MAX && home[triangle[1]] == chunk && home[triangle[2]] == chunk)
+			{
+				triangle_chunks[l][t] = chunk;
+				for(int c = 0; c < 3; c++)
+					corners[l][t*3+c] = home_local[triangle[c]];
+			}
+			else
+			{
+				straddling.insert(straddling.end(), triangle, triangle + 3);
+				straddling_at.push_back(t);
+			}
+		}
+		if(straddling_at.empty())
+			continue;
+
+		std::vector<uint32_t> straddling_chunks(straddling_at.size());
+		std::vector<uint32_t> straddling_corners(straddling.size());
+		chunk_triangles(straddling.data(), straddling_at.size(), &local, &chunks, straddling_chunks.data(), straddling_corners.data());
+		for(size_t s = 0; s < straddling_at.size(); s++)
+		{
+			size_t t = straddling_at[s];
+			triangle_chunks[l][t] = straddling_chunks[s];
+			for(int c = 0; c < 3; c++)
+				corners[l][t*3+c] = straddling_corners[s*3+c];
+		}
+	}
+
+	std::vector<int32_t> chunk_offsets(chunks.size());
+	for(size_t c = 0; c < chunks.size(); c++)
+	{
+		chunk_offsets[c] = (int32_t) result->vertices.size();
+		for(uint32_t v : chunks[c])
+			result->vertices.push_back(vertices[v]);
+	}
+
+	// Each level's triangles are grouped by chunk, keeping their order
+	// within it, so every chunk a level uses becomes one range
+	std::vector<uint32_t> chunk_starts(chunks.size() + 1);
+	for(uint32_t l = 0; l < lod_count; l++)
+	{
+		std::fill(chunk_starts.begin(), chunk_starts.end(), 0);
+		for(uint32_t chunk : triangle_chunks[l])
+			chunk_starts[chunk+1]++;
+		for(size_t c = 0; c < chunks.size(); c++)
+			chunk_starts[c+1] += chunk_starts[c];
+
+		size_t level_start = result->indices.size();
+		TOS_mesh_lod lod = {(uint32_t) result->ranges.size(), 0, (uint32_t) triangle_chunks[l].size() * 3, lods[l].error};
+		for(size_t c = 0; c < chunks.size(); c++)
+		{
+			if(chunk_starts[c+1] > chunk_starts[c])
+			{
+				result->ranges.push_back
+				({
+					.first_index = (uint32_t) (level_start + chunk_starts[c] * 3),
+					.index_count = (chunk_starts[c+1] - chunk_starts[c]) * 3,
+					.vertex_offset = chunk_offsets[c]
+				});
+				lod.range_count++;
+			}
+		}
+		result->lods.push_back(lod);
+
+		result->indices.resize(level_start + lod.index_count);
+		for(size_t t = 0; t < triangle_chunks[l].size(); t++)
+		{
+			size_t at = level_start + (size_t) chunk_starts[triangle_chunks[l][t]]++ * 3;
+			for(int c = 0; c < 3; c++)
+				result->indices[at+c] = corners[l][t*3+c];
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "vertices.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Splitting of meshes too large for 16-bit indices. Triangles of the full
+// detail level are taken in order into chunks of at most
+// TOS_INDEX16_VERTEX_LIMIT distinct vertices, each chunk's vertices are
+// copied out contiguously, and its indices are rewritten relative to the
+// chunk. Vertices shared across a chunk boundary are duplicated, so the
+// input should already be in cache-friendly order.
+//
+// Coarser levels reuse those chunks: a triangle whose vertices all landed
+// in one chunk is drawn from it, and only the triangles that straddle
+// chunks go into extra chunks of their own. Levels therefore share nearly
+// all of their vertices, as they do before the split.
+
+struct TOS_split_result
+{
+	std::vector<TOS_vertex> vertices;
+	// Chunk-relative, each below TOS_INDEX16_VERTEX_LIMIT, level after level
+	std::vector<uint32_t> indices;
+	std::vector<TOS_mesh_range> ranges;
+	// One per input level, as runs of ranges
+	std::vector<TOS_mesh_lod> lods;
+};
+
+void TOS_split_mesh
+(
+	const TOS_vertex* vertices, size_t vertex_count, const uint32_t* indices,
+	const TOS_lod_span* lods, uint32_t lod_count,
+	TOS_split_result* result
+);
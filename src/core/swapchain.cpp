@@ -271,8 +271,8 @@ void TOS_destroy_swapchain(TOS_device* device, TOS_swapchain* swapchain)
 	vkDestroyRenderPass(device->logical, swapchain->render_pass, nullptr);
 
 	vkDestroyImageView(device->logical, swapchain->depth_image_view, nullptr);
-	vkFreeMemory(device->logical, swapchain->depth_memory, nullptr);
 	vkDestroyImage(device->logical, swapchain->depth_image, nullptr);
+	TOS_free_memory(device, &swapchain->depth_memory);
 
 	for(VkImageView view : swapchain->image_views)
 	{
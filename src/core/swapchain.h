@@ -4,6 +4,7 @@
 #include <vector>
 #include "context.h"
 #include "device.h"
+#include "allocator.h"
 
 struct TOS_swapchain
 {
@@ -17,7 +18,7 @@ struct TOS_swapchain
 	std::vector<VkFramebuffer> framebuffers;
 
 	VkImage depth_image;
-	VkDeviceMemory depth_memory;
+	TOS_allocation depth_memory;
 	VkImageView depth_image_view;
 };
 
@@ -0,0 +1,251 @@
+#include "texturefile.h"
+
+#include "memory.h"
+#include "mipmaps.h"
+#include "fileio.h"
+#include "threads.h"
+#include "cowtools.h"
+#include <sys/stat.h>
+#include <stdio.h>
+#include <iostream>
+#include <stdexcept>
+
+#define SECTION_ALIGNMENT 16
+
+static uint64_t align_up(uint64_t offset, uint64_t alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Nanoseconds, so a source edited within the second it was baked in still
+// reads as changed
+static bool stat_source(const char* source_path, uint64_t* size, int64_t* mtime_ns)
+{
+	struct stat info;
+	if(stat(source_path, &info) != 0)
+		return false;
+	*size = (uint64_t) info.st_size;
+	*mtime_ns = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+	return true;
+}
+
+static bool check_header(const TOS_texture_file_header* header, size_t size, const char* source_path)
+{
+	bool valid =
+	size >= sizeof(TOS_texture_file_header) &&
+	header->magic == TOS_TEXTURE_FILE_MAGIC &&
+	header->version == TOS_TEXTURE_FILE_VERSION &&
+	header->level_count > 0 && header->level_count <= TOS_TEXTURE_FILE_MAX_LEVELS &&
+	header->data_offset % SECTION_ALIGNMENT == 0 &&
+	header->data_offset <= size && header->data_size <= size - header->data_offset &&
+	(header->format == VK_FORMAT_R8G8B8A8_SRGB || TOS_get_block_size((VkFormat) header->format) > 0);
+	// Every level must have the extent the mip chain gives it and exactly
+	// the bytes its format needs, since uploads copy by extent
+	for(uint32_t l = 0; valid && l < header->level_count; l++)
+	{
+		const TOS_texture_level& level = header->levels[l];
+		uint32_t width = TOS_max(header->levels[0].width >> l, 1u);
+		uint32_t height = TOS_max(header->levels[0].height >> l, 1u);
+		uint64_t level_size = header->format == VK_FORMAT_R8G8B8A8_SRGB ?
+		(uint64_t) width * height * TOS_TEXTURE_CHANNELS :
+		TOS_get_compressed_size((VkFormat) header->format, width, height);
+		valid =
+		level.width > 0 && level.height > 0 &&
+		level.width == width && level.height == height &&
+		level.size == level_size &&
+		level.offset % SECTION_ALIGNMENT == 0 &&
+		level.offset <= header->data_size && level.size <= header->data_size - level.offset;
+	}
+
+	// A missing source is fine; the cache can ship on its own
+	uint64_t source_size;
+	int64_t source_mtime_ns;
+	if(valid && stat_source(source_path, &source_size, &source_mtime_ns))
+		valid = header->source_size == source_size && header->source_mtime_ns == source_mtime_ns;
+	return valid;
+}
+
+bool TOS_open_texture_file(TOS_texture_file* file, const char* path, const char* source_path)
+{
+	*file = {};
+
+	struct stat info;
+	if(stat(path, &info) != 0 || info.st_size < 0 || (size_t) info.st_size < sizeof(TOS_texture_file_header))
+		return false;
+
+	size_t size;
+	void* data;
+	try
+	{
+		data = TOS_map_file(path, TOS_FILE_MAP_READ, &size, TOS_FILE_MAP_WILLNEED);
+	}
+	catch(const std::exception& e)
+	{
+		TOS_print_line(std::cerr, e.what());
+		return false;
+	}
+
+	const TOS_texture_file_header* header = (const TOS_texture_file_header*) data;
+	if(!check_header(header, size, source_path))
+	{
+		TOS_unmap_file(data, size);
+		return false;
+	}
+
+	*file =
+	{
+		.data = data,
+		.size = size,
+		.header = header,
+		.levels = (const uint8_t*) data + header->data_offset
+	};
+	return true;
+}
+
+void TOS_close_texture_file(TOS_texture_file* file)
+{
+	if(file->data != nullptr)
+		TOS_unmap_file(file->data, file->size);
+	*file = {};
+}
+
+bool TOS_texture_file_is_current(const char* path, const char* source_path, VkFormat* format)
+{
+	FILE* in = fopen(path, "rb");
+	if(in == nullptr)
+		return false;
+	TOS_texture_file_header header;
+	bool read = fread(&header, sizeof(header), 1, in) == 1;
+	bool sized = fseek(in, 0, SEEK_END) == 0;
+	long size = ftell(in);
+	fclose(in);
+	bool current = read && sized && size > 0 && check_header(&header, (size_t) size, source_path);
+	if(current && format != nullptr)
+		*format = (VkFormat) header.format;
+	return current;
+}
+
+static const uint8_t padding[SECTION_ALIGNMENT] = {};
+
+bool TOS_write_texture_file(const char* path, const char* source_path, const TOS_image* levels, uint32_t level_count, VkFormat format)
+{
+	if(level_count == 0 || level_count > TOS_TEXTURE_FILE_MAX_LEVELS)
+		return false;
+	TOS_texture_file_header header {};
+	header.magic = TOS_TEXTURE_FILE_MAGIC;
+	header.version = TOS_TEXTURE_FILE_VERSION;
+	if(!stat_source(source_path, &header.source_size, &header.source_mtime_ns))
+		return false;
+	header.format = (uint32_t) format;
+	header.level_count = level_count;
+	header.data_offset = align_up(sizeof(TOS_texture_file_header), SECTION_ALIGNMENT);
+	uint64_t offset = 0;
+	for(uint32_t l = 0; l < level_count; l++)
+	{
+		header.levels[l] =
+		{
+			.width = levels[l].width,
+			.height = levels[l].height,
+			.offset = offset,
+			.size = levels[l].size
+		};
+		offset = align_up(offset + levels[l].size, SECTION_ALIGNMENT);
+	}
+	header.data_size = offset;
+
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE* out = fopen(temp_path.c_str(), "wb");
+	if(out == nullptr)
+	{
+		TOS_print_line(std::cerr, "TOS_write_texture_file: failed to open " + temp_path);
+		return false;
+	}
+	size_t header_padding = header.data_offset - sizeof(header);
+	bool written =
+	fwrite(&header, sizeof(header), 1, out) == 1 &&
+	fwrite(padding, 1, header_padding, out) == header_padding;
+	for(uint32_t l = 0; written && l < level_count; l++)
+	{
+		size_t level_padding = align_up(levels[l].size, SECTION_ALIGNMENT) - levels[l].size;
+		written =
+		fwrite(levels[l].pixels, 1, levels[l].size, out) == levels[l].size &&
+		fwrite(padding, 1, level_padding, out) == level_padding;
+	}
+
+	// Moved over the destination only once complete, so a reader never
+	// maps a partial file
+	written = fclose(out) == 0 && written;
+	if(!written || rename(temp_path.c_str(), path) != 0)
+	{
+		TOS_print_line(std::cerr, std::string("TOS_write_texture_file: failed to write ") + path);
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool TOS_bake_texture(const char* path, const char* source_path, const TOS_image* image, TOS_texture_compression compression, int thread_count)
+{
+	std::vector<TOS_image> mips;
+	TOS_build_mip_chain(image, &mips, true, thread_count);
+	std::vector<TOS_image> levels;
+	levels.push_back(*image);
+	levels.insert(levels.end(), mips.begin(), mips.end());
+
+	// Compressed levels stand in for the texels they were made from, with
+	// the same extent
+	VkFormat format = TOS_get_compressed_format(compression, image);
+	std::vector<std::vector<uint8_t>> blocks;
+	if(TOS_get_block_size(format) > 0)
+	{
+		blocks.resize(levels.size());
+		for(size_t l = 0; l < levels.size(); l++)
+		{
+			blocks[l].resize(TOS_get_compressed_size(format, levels[l].width, levels[l].height));
+			TOS_compress_image(&levels[l], format, blocks[l].data(), thread_count);
+		}
+		TOS_compression_report report = TOS_measure_compression(image, format, blocks[0].data());
+		TOS_print_compression_report(source_path, &report);
+		for(size_t l = 0; l < levels.size(); l++)
+		{
+			levels[l].size = blocks[l].size();
+			levels[l].pixels = blocks[l].data();
+		}
+	}
+
+	bool written = TOS_write_texture_file(path, source_path, levels.data(), (uint32_t) levels.size(), format);
+	for(TOS_image& mip : mips)
+		TOS_destroy_image(&mip);
+	return written;
+}
+
+void TOS_bake_textures(const std::vector<std::string>& source_paths, TOS_texture_compression compression)
+{
+	std::vector<std::string> stale;
+	for(const std::string& source_path : source_paths)
+	{
+		VkFormat format;
+		if(!TOS_texture_file_is_current((source_path + TOS_TEXTURE_FILE_EXTENSION).c_str(), source_path.c_str(), &format))
+			stale.push_back(source_path);
+		else if(compression != TOS_TEXTURE_COMPRESSION_AUTO && format != TOS_get_compressed_format(compression, nullptr))
+			stale.push_back(source_path);
+	}
+	if(stale.empty())
+		return;
+
+	TOS_read_backend backend = TOS_read_files
+	(
+		stale,
+		[&](size_t i, const uint8_t* data, size_t size)
+		{
+			TOS_image image;
+			TOS_decode_image(&image, data, size);
+			std::string path = stale[i] + TOS_TEXTURE_FILE_EXTENSION;
+			// One thread per bake, since the workers already fill the cores
+			if(!TOS_bake_texture(path.c_str(), stale[i].c_str(), &image, compression, 1))
+				TOS_print_line(std::cerr, "TOS_bake_textures: could not cache " + stale[i]);
+			TOS_destroy_image(&image);
+		}
+	);
+	std::cout << "TOS_bake_textures: baked " << stale.size() << " textures through " << TOS_get_read_backend_name(backend) << std::endl;
+}
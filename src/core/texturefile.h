@@ -0,0 +1,73 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "textures.h"
+#include "bcn.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// A cache of a texture with its whole mip chain filtered offline, written
+// next to the source image. The levels follow one another in a single
+// section, largest first, in the layout vkCmdCopyBufferToImage takes, so
+// loading is one copy into staging and one copy command. Levels are block
+// compressed unless baked with TOS_TEXTURE_COMPRESSION_NONE.
+
+#define TOS_TEXTURE_FILE_MAGIC 0x58455454 // "TTEX"
+#define TOS_TEXTURE_FILE_VERSION 3
+#define TOS_TEXTURE_FILE_EXTENSION ".ttex"
+// Enough for 32768 texels on a side
+#define TOS_TEXTURE_FILE_MAX_LEVELS 16
+
+struct TOS_texture_level
+{
+	uint32_t width;
+	uint32_t height;
+	// Relative to the start of the level section
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct TOS_texture_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime_ns;
+	// VkFormat of every level
+	uint32_t format;
+	uint32_t level_count;
+	uint64_t data_offset;
+	uint64_t data_size;
+	TOS_texture_level levels[TOS_TEXTURE_FILE_MAX_LEVELS];
+};
+
+struct TOS_texture_file
+{
+	void* data;
+	size_t size;
+
+	const TOS_texture_file_header* header;
+	const uint8_t* levels;
+};
+
+// Returns false if the file is missing, malformed, or older than its source
+bool TOS_open_texture_file(TOS_texture_file* file, const char* path, const char* source_path);
+void TOS_close_texture_file(TOS_texture_file* file);
+// Checks the header alone, without mapping the levels, and reports the
+// format of a current file
+bool TOS_texture_file_is_current(const char* path, const char* source_path, VkFormat* format=nullptr);
+// levels holds the full chain, largest first, each in the layout of format:
+// tightly packed texels, or rows of 4x4 blocks for compressed formats
+bool TOS_write_texture_file(const char* path, const char* source_path, const TOS_image* levels, uint32_t level_count, VkFormat format);
+
+// Filters the mip chain of a decoded source image, compresses every level
+// and writes its cache, printing the error of the base level. Filtering and
+// compression run on thread_count threads, all cores by default; callers
+// baking several textures at once pass 1.
+bool TOS_bake_texture(const char* path, const char* source_path, const TOS_image* image, TOS_texture_compression compression=TOS_TEXTURE_COMPRESSION_AUTO, int thread_count=0);
+// Decodes and bakes every source whose cache is missing or stale, reading
+// and decoding them concurrently. Unless compression is AUTO, caches in
+// another format count as stale.
+void TOS_bake_textures(const std::vector<std::string>& source_paths, TOS_texture_compression compression=TOS_TEXTURE_COMPRESSION_AUTO);
@@ -1,12 +1,25 @@
 #include "textures.h"
 
 #include "memory.h"
+#include "upload.h"
+#include "texturefile.h"
+#include "mipmaps.h"
+#include "bcn.h"
+#include "fileio.h"
+#include "threads.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 #include "cowtools.h"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
 
 void TOS_create_image(TOS_image* image, int width, int height)
 {
@@ -44,6 +57,22 @@ void TOS_load_image(TOS_image* image, const char* path)
 	};
 }
 
+void TOS_decode_image(TOS_image* image, const uint8_t* data, size_t size)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load_from_memory(data, (int) size, &width, &height, &channels, STBI_rgb_alpha);
+	if(pixels == nullptr)
+		throw std::runtime_error("TOS_decode_image: STBI failed to decode image");
+	size_t pixels_size = width * height * 4;
+	*image = 
+	{
+		.width = (uint32_t) width,
+		.height = (uint32_t) height,
+		.size = pixels_size,
+		.pixels = pixels
+	};
+}
+
 void TOS_write_image(TOS_image* image, const char* path)
 {
 	stbi_write_png
@@ -81,164 +110,79 @@ void TOS_set_pixel(TOS_image* image, int x, int y, uint8_t r, uint8_t g, uint8_t
 	px[3] = a;
 }
 
-void copy_buffer_to_image
-(
-	TOS_device* device,
-	VkBuffer buffer, VkImage image,
-	uint32_t width, uint32_t height
-)
+static VkBufferImageCopy level_region(VkDeviceSize offset, uint32_t level, uint32_t width, uint32_t height)
 {
-	VkCommandBuffer command_buffer = TOS_create_command_buffer(device, device->command_pools.transfer);
-	TOS_begin_command_buffer(device, command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	
 	VkBufferImageCopy copy_region {};
-	copy_region.bufferOffset = 0;
+	copy_region.bufferOffset = offset;
 	copy_region.bufferRowLength = 0;
 	copy_region.bufferImageHeight = 0;
 	
 	copy_region.imageSubresource =
 	{
 		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-		.mipLevel = 0,
+		.mipLevel = level,
 		.baseArrayLayer = 0,
 		.layerCount = 1
 	};
 	
 	copy_region.imageOffset = {0, 0, 0};
 	copy_region.imageExtent = {width, height, 1};
-	
+	return copy_region;
+}
+
+// Fills every level of the image in one copy and leaves it ready to sample.
+// Whatever the image held before is discarded.
+static void copy_levels_to_image
+(
+	VkCommandBuffer command_buffer,
+	VkBuffer buffer, VkImage image, VkFormat format,
+	const VkBufferImageCopy* regions, uint32_t level_count
+)
+{
+	TOS_record_image_transition(command_buffer, image, format, level_count, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 	vkCmdCopyBufferToImage
 	(
 		command_buffer, buffer, image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1, &copy_region
+		level_count, regions
 	);
-	
-	TOS_end_command_buffer(device, device->queues.transfer, command_buffer);
-	TOS_destroy_command_buffer(device, device->command_pools.transfer, command_buffer);
+	TOS_record_image_transition(command_buffer, image, format, level_count, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 }
-	
-void generate_mipmaps
-(
-	TOS_device* device,
-	VkImage image, VkFormat format,
-	int32_t width, int32_t height,
-	uint32_t mip_levels
-)
+
+// Stages levels of texels in format, largest first, and copies all of them in
+static void upload_levels(TOS_device* device, VkImage image, VkFormat format, const TOS_image* levels, uint32_t level_count)
 {
-	VkFormatProperties format_properties;
-	vkGetPhysicalDeviceFormatProperties(device->physical, format, &format_properties);
-	if(!(format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-		throw std::runtime_error("Requested mipmap format does not support linear filtering!");
-	
-	VkCommandBuffer command_buffer = TOS_create_command_buffer(device, device->command_pools.transfer);
-	TOS_begin_command_buffer(device, command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	
-	VkImageMemoryBarrier barrier {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange =
-	{
-		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-		.baseArrayLayer = 0,
-		.layerCount = 1,
-		.levelCount = 1
-	};
-	
-	int32_t mip_width = width;
-	int32_t mip_height = height;
-	for(uint32_t level = 1; level < mip_levels; level++)
+	VkDeviceSize staging_size = 0;
+	for(uint32_t level = 0; level < level_count; level++)
+		staging_size += (levels[level].size + TOS_STAGING_ALIGNMENT-1) / TOS_STAGING_ALIGNMENT * TOS_STAGING_ALIGNMENT;
+	VkBuffer staging_buffer;
+	VkDeviceSize staging_offset;
+	uint8_t* staging = (uint8_t*) TOS_stage_upload(device, staging_size, TOS_STAGING_ALIGNMENT, &staging_buffer, &staging_offset);
+
+	std::vector<VkBufferImageCopy> regions;
+	VkDeviceSize offset = 0;
+	for(uint32_t level = 0; level < level_count; level++)
 	{
-		barrier.subresourceRange.baseMipLevel = level - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		
-		vkCmdPipelineBarrier
-		(
-			command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-			0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier
-		);
-		
-		VkImageBlit blit {};
-		blit.srcOffsets[0] = {0, 0, 0};
-		blit.srcOffsets[1] = {mip_width, mip_height, 1};
-		blit.srcSubresource =
-		{
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.mipLevel = level - 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1
-		};
-		blit.dstOffsets[0] = {0, 0, 0};
-		blit.dstOffsets[1] =
-		{
-			mip_width > 1 ? mip_width / 2 : 1,
-			mip_height > 1 ? mip_height / 2 : 1,
-			1
-		};
-		blit.dstSubresource =
-		{
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.mipLevel = level,
-			.baseArrayLayer = 0,
-			.layerCount = 1
-		};
-		
-		vkCmdBlitImage
-		(
-			command_buffer,
-			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1, &blit, VK_FILTER_LINEAR
-		);
-		
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		
-		vkCmdPipelineBarrier
-		(
-			command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier
-		);
-		
-		if(mip_width > 1)
-			mip_width /= 2;
-		if(mip_height > 1)
-			mip_height /= 2;
+		memcpy(staging + offset, levels[level].pixels, levels[level].size);
+		regions.push_back(level_region(staging_offset + offset, level, levels[level].width, levels[level].height));
+		offset += (levels[level].size + TOS_STAGING_ALIGNMENT-1) / TOS_STAGING_ALIGNMENT * TOS_STAGING_ALIGNMENT;
 	}
-	
-	barrier.subresourceRange.baseMipLevel = mip_levels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	
-	vkCmdPipelineBarrier
-	(
-		command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
-	
-	TOS_end_command_buffer(device, device->queues.transfer, command_buffer);
-	TOS_destroy_command_buffer(device, device->command_pools.transfer, command_buffer);
+	copy_levels_to_image(TOS_get_upload_command_buffer(device), staging_buffer, image, format, regions.data(), level_count);
+}
+
+// Filters the mip chain of the image on the CPU and uploads it with the image
+static void upload_mip_chain(TOS_device* device, VkImage image, const TOS_image* base)
+{
+	std::vector<TOS_image> levels(1, *base);
+	std::vector<TOS_image> mips;
+	TOS_build_mip_chain(base, &mips);
+	levels.insert(levels.end(), mips.begin(), mips.end());
+	upload_levels(device, image, VK_FORMAT_R8G8B8A8_SRGB, levels.data(), (uint32_t) levels.size());
+	for(TOS_image& mip : mips)
+		TOS_destroy_image(&mip);
 }
 	
-VkResult create_sampler(TOS_device* device, TOS_texture* texture, int mip_levels)
+VkSampler TOS_create_texture_sampler(TOS_device* device, uint32_t mip_levels, float min_lod)
 {
 	VkSamplerCreateInfo create_info {};
 	create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -259,88 +203,345 @@ VkResult create_sampler(TOS_device* device, TOS_texture* texture, int mip_levels
 	create_info.compareOp = VK_COMPARE_OP_ALWAYS;
 	create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	create_info.mipLodBias = 0.0f;
-	create_info.minLod = 0.0f;
+	create_info.minLod = min_lod;
 	create_info.maxLod = (float) mip_levels;
 	
-	return vkCreateSampler(device->logical, &create_info, nullptr, &texture->sampler);
+	VkSampler sampler;
+	VkResult result = vkCreateSampler(device->logical, &create_info, nullptr, &sampler);
+	if(result != VK_SUCCESS)
+		throw std::runtime_error("TOS_create_texture_sampler: failed to create sampler");
+	return sampler;
 }
 
 void TOS_create_texture(TOS_device* device, TOS_texture* texture, TOS_image* image)
 {
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_memory;
-	TOS_create_buffer
-	(
-		device, image->size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer, staging_memory
-	);
-	void* data;
-	vkMapMemory(device->logical, staging_memory, 0, image->size, 0, &data);
-	memcpy(data, image->pixels, image->size);
-	vkUnmapMemory(device->logical, staging_memory);
-	
-	int mip_levels = std::floor(std::log2(std::max(image->width, image->height))) + 1;
+	uint32_t mip_levels = TOS_get_mip_count(image->width, image->height);
 	TOS_create_image
 	(
 		device,
 		image->width, image->height, VK_FORMAT_R8G8B8A8_SRGB,
 		mip_levels,
-		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		texture->image, texture->memory
 	);
-	TOS_transition_image_layout(device, texture->image, VK_FORMAT_R8G8B8A8_SRGB, mip_levels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	copy_buffer_to_image(device, staging_buffer, texture->image, image->width, image->height);
-	generate_mipmaps(device, texture->image, VK_FORMAT_R8G8B8A8_SRGB, image->width, image->height, mip_levels);
-
-	vkFreeMemory(device->logical, staging_memory, nullptr);
-	vkDestroyBuffer(device->logical, staging_buffer, nullptr);
+	upload_mip_chain(device, texture->image, image);
 
 	texture->view = TOS_create_image_view(device, texture->image, VK_FORMAT_R8G8B8A8_SRGB, mip_levels, VK_IMAGE_ASPECT_COLOR_BIT);
-	create_sampler(device, texture, mip_levels);
+	texture->sampler = TOS_create_texture_sampler(device, mip_levels);
+}
+
+bool TOS_can_sample_texture_format(TOS_device* device, VkFormat format)
+{
+	return TOS_get_block_size(format) == 0 || (device->texture_compression_bc && TOS_supports_sampled_format(device, format));
+}
+
+// Block compressed levels the device cannot sample are decoded to RGBA8
+static void decode_levels(const TOS_texture_file* file, std::vector<TOS_image>* levels)
+{
+	const TOS_texture_file_header* header = file->header;
+	levels->resize(header->level_count);
+	for(uint32_t level = 0; level < header->level_count; level++)
+	{
+		const TOS_texture_level& file_level = header->levels[level];
+		TOS_decompress_image(file->levels + file_level.offset, (VkFormat) header->format, file_level.width, file_level.height, &(*levels)[level]);
+	}
+}
+
+// Uploads the levels of the file as they are stored, or the decoded ones
+// in their place when there are any
+static void create_texture_from_levels(TOS_device* device, TOS_texture* texture, const TOS_texture_file* file, const std::vector<TOS_image>& decoded)
+{
+	const TOS_texture_file_header* header = file->header;
+	VkFormat format = decoded.empty() ? (VkFormat) header->format : VK_FORMAT_R8G8B8A8_SRGB;
+
+	TOS_create_image
+	(
+		device,
+		header->levels[0].width, header->levels[0].height, format,
+		header->level_count,
+		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		texture->image, texture->memory
+	);
+
+	if(!decoded.empty())
+		upload_levels(device, texture->image, format, decoded.data(), header->level_count);
+	else
+	{
+		VkBuffer staging_buffer;
+		VkDeviceSize staging_offset;
+		void* staging = TOS_stage_upload(device, header->data_size, TOS_STAGING_ALIGNMENT, &staging_buffer, &staging_offset);
+		memcpy(staging, file->levels, header->data_size);
+
+		// Extents stay in texels for compressed formats; the copy rounds
+		// partial blocks at the edges up to whole ones
+		VkBufferImageCopy copy_regions[TOS_TEXTURE_FILE_MAX_LEVELS];
+		for(uint32_t level = 0; level < header->level_count; level++)
+		{
+			const TOS_texture_level& file_level = header->levels[level];
+			copy_regions[level] = level_region(staging_offset + file_level.offset, level, file_level.width, file_level.height);
+		}
+		copy_levels_to_image(TOS_get_upload_command_buffer(device), staging_buffer, texture->image, format, copy_regions, header->level_count);
+	}
+
+	texture->view = TOS_create_image_view(device, texture->image, format, header->level_count, VK_IMAGE_ASPECT_COLOR_BIT);
+	texture->sampler = TOS_create_texture_sampler(device, header->level_count);
+}
+
+void TOS_create_texture_from_file(TOS_device* device, TOS_texture* texture, const TOS_texture_file* file)
+{
+	std::vector<TOS_image> decoded;
+	if(!TOS_can_sample_texture_format(device, (VkFormat) file->header->format))
+		decode_levels(file, &decoded);
+	create_texture_from_levels(device, texture, file, decoded);
+	for(TOS_image& level : decoded)
+		TOS_destroy_image(&level);
 }
 
 void TOS_destroy_texture(TOS_device* device, TOS_texture* texture)
 {
 	vkDestroySampler(device->logical, texture->sampler, nullptr);
 	vkDestroyImageView(device->logical, texture->view, nullptr);
-	vkFreeMemory(device->logical, texture->memory, nullptr);
 	vkDestroyImage(device->logical, texture->image, nullptr);
+	TOS_free_memory(device, &texture->memory);
+	*texture = {};
 }
 
 void TOS_load_texture(TOS_device* device, TOS_texture* texture, const char* path)
 {
+	std::string cache_path = std::string(path) + TOS_TEXTURE_FILE_EXTENSION;
+	TOS_texture_file file;
+	if(TOS_open_texture_file(&file, cache_path.c_str(), path))
+	{
+		TOS_create_texture_from_file(device, texture, &file);
+		TOS_close_texture_file(&file);
+		return;
+	}
+
 	TOS_image image;
 	TOS_load_image(&image, path);
-	TOS_create_texture(device, texture, &image);
+	if(TOS_bake_texture(cache_path.c_str(), path, &image) && TOS_open_texture_file(&file, cache_path.c_str(), path))
+	{
+		TOS_create_texture_from_file(device, texture, &file);
+		TOS_close_texture_file(&file);
+	}
+	else
+	{
+		std::cerr << "TOS_load_texture: could not cache " << path << std::endl;
+		TOS_create_texture(device, texture, &image);
+	}
 	TOS_destroy_image(&image);
 }
 
+// What a worker leaves for the upload of one texture: its open cache, with
+// the levels decoded if the device cannot sample them, or the decoded
+// source alone when no cache could be written
+struct prepared_texture
+{
+	bool cached;
+	TOS_texture_file file;
+	std::vector<TOS_image> decoded;
+	TOS_image image;
+};
+
+static void prepare_cached_texture(TOS_device* device, prepared_texture* prepared)
+{
+	prepared->cached = true;
+	// The loading benchmark runs without a device and keeps levels as stored
+	if(device != nullptr && !TOS_can_sample_texture_format(device, (VkFormat) prepared->file.header->format))
+		decode_levels(&prepared->file, &prepared->decoded);
+}
+
+static void release_prepared_texture(prepared_texture* prepared)
+{
+	for(TOS_image& level : prepared->decoded)
+		TOS_destroy_image(&level);
+	TOS_close_texture_file(&prepared->file);
+	TOS_destroy_image(&prepared->image);
+	*prepared = {};
+}
+
+// Opens every current cache and reads, decodes and bakes the rest on worker
+// threads, returning how many were baked. Nothing stays open or allocated
+// if any of it throws.
+static size_t prepare_textures
+(
+	TOS_device* device, std::vector<prepared_texture>* prepared,
+	const std::vector<std::string>& paths, const std::vector<std::string>& cache_paths,
+	int thread_count
+)
+{
+	prepared->assign(paths.size(), {});
+	std::vector<size_t> stale;
+	try
+	{
+		TOS_parallel_for
+		(
+			paths.size(),
+			[&](size_t i)
+			{
+				if(TOS_open_texture_file(&(*prepared)[i].file, cache_paths[i].c_str(), paths[i].c_str()))
+					prepare_cached_texture(device, &(*prepared)[i]);
+			},
+			thread_count
+		);
+
+		std::vector<std::string> stale_paths;
+		for(size_t i = 0; i < paths.size(); i++)
+		{
+			if(!(*prepared)[i].cached)
+			{
+				stale.push_back(i);
+				stale_paths.push_back(paths[i]);
+			}
+		}
+		if(!stale.empty())
+		{
+			TOS_read_files
+			(
+				stale_paths,
+				[&](size_t s, const uint8_t* data, size_t size)
+				{
+					size_t i = stale[s];
+					prepared_texture& texture = (*prepared)[i];
+					TOS_image image;
+					TOS_decode_image(&image, data, size);
+					try
+					{
+						// Bakes stay single-threaded, as the read workers already use every core
+						if(TOS_bake_texture(cache_paths[i].c_str(), paths[i].c_str(), &image, TOS_TEXTURE_COMPRESSION_AUTO, 1) && TOS_open_texture_file(&texture.file, cache_paths[i].c_str(), paths[i].c_str()))
+						{
+							prepare_cached_texture(device, &texture);
+							TOS_destroy_image(&image);
+						}
+						else
+						{
+							TOS_print_line(std::cerr, "TOS_load_textures: could not cache " + paths[i]);
+							texture.image = image;
+						}
+					}
+					catch(...)
+					{
+						TOS_destroy_image(&image);
+						throw;
+					}
+				},
+				thread_count
+			);
+		}
+	}
+	catch(...)
+	{
+		for(prepared_texture& texture : *prepared)
+			release_prepared_texture(&texture);
+		throw;
+	}
+	return stale.size();
+}
+
+void TOS_load_textures(TOS_device* device, TOS_texture* textures, const std::vector<std::string>& paths, int thread_count)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::string> cache_paths;
+	for(const std::string& path : paths)
+		cache_paths.push_back(path + TOS_TEXTURE_FILE_EXTENSION);
+	std::vector<prepared_texture> prepared;
+	size_t baked = prepare_textures(device, &prepared, paths, cache_paths, thread_count);
+	auto decoded = std::chrono::steady_clock::now();
+
+	// Vulkan objects and the staging ring stay on this thread
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		if(prepared[i].cached)
+			create_texture_from_levels(device, &textures[i], &prepared[i].file, prepared[i].decoded);
+		else
+			TOS_create_texture(device, &textures[i], &prepared[i].image);
+		release_prepared_texture(&prepared[i]);
+	}
+	auto uploaded = std::chrono::steady_clock::now();
+
+	std::cout << "TOS_load_textures: " << paths.size() << " textures, " << baked << " baked, "
+	<< std::chrono::duration<double, std::milli>(decoded - start).count() << " ms decoding, "
+	<< std::chrono::duration<double, std::milli>(uploaded - decoded).count() << " ms uploading" << std::endl;
+}
+
+void TOS_benchmark_texture_loading(const char* directory)
+{
+	std::vector<std::string> names;
+	DIR* listing = opendir(directory);
+	if(listing == nullptr)
+		throw std::runtime_error("TOS_benchmark_texture_loading: could not open " + std::string(directory));
+	while(dirent* entry = readdir(listing))
+	{
+		const char* extension = strrchr(entry->d_name, '.');
+		if(extension != nullptr && (strcasecmp(extension, ".png") == 0 || strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".tga") == 0))
+			names.push_back(entry->d_name);
+	}
+	closedir(listing);
+	std::sort(names.begin(), names.end());
+
+	// Caches are written next to their sources, so the sources are linked
+	// into a scratch directory and the directory's own caches are left alone
+	char scratch[] = "/tmp/tos_texture_bench_XXXXXX";
+	if(mkdtemp(scratch) == nullptr)
+		throw std::runtime_error("TOS_benchmark_texture_loading: could not create a scratch directory");
+	std::string source_directory = directory;
+	if(source_directory[0] != '/')
+	{
+		char working_directory[4096];
+		if(getcwd(working_directory, sizeof(working_directory)) != nullptr)
+			source_directory = std::string(working_directory) + "/" + source_directory;
+	}
+	std::vector<std::string> paths, cache_paths;
+	for(const std::string& name : names)
+	{
+		paths.push_back(std::string(scratch) + "/" + name);
+		cache_paths.push_back(paths.back() + TOS_TEXTURE_FILE_EXTENSION);
+		if(symlink((source_directory + "/" + name).c_str(), paths.back().c_str()) != 0)
+			std::cerr << "TOS_benchmark_texture_loading: could not link " << name << std::endl;
+	}
+
+	std::vector<int> thread_counts;
+	for(int count = 1; count < TOS_get_thread_count(); count *= 2)
+		thread_counts.push_back(count);
+	thread_counts.push_back(TOS_get_thread_count());
+
+	// Uploads run on the calling thread either way, so only the preparation
+	// of the batch is timed: baking every source, then opening every cache
+	std::cout << "TOS_benchmark_texture_loading: " << names.size() << " textures from " << directory
+	<< ", " << TOS_get_thread_count() << " cores" << std::endl;
+	for(int thread_count : thread_counts)
+	{
+		for(const std::string& cache_path : cache_paths)
+			unlink(cache_path.c_str());
+		std::vector<prepared_texture> prepared;
+		auto start = std::chrono::steady_clock::now();
+		size_t baked = prepare_textures(nullptr, &prepared, paths, cache_paths, thread_count);
+		auto bake_end = std::chrono::steady_clock::now();
+		for(prepared_texture& texture : prepared)
+			release_prepared_texture(&texture);
+
+		auto open_start = std::chrono::steady_clock::now();
+		prepare_textures(nullptr, &prepared, paths, cache_paths, thread_count);
+		auto open_end = std::chrono::steady_clock::now();
+		for(prepared_texture& texture : prepared)
+			release_prepared_texture(&texture);
+
+		std::cout << "\t" << thread_count << " threads: " << baked << " baked in "
+		<< std::chrono::duration<double, std::milli>(bake_end - start).count() << " ms, opened in "
+		<< std::chrono::duration<double, std::milli>(open_end - open_start).count() << " ms" << std::endl;
+	}
+
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		unlink(cache_paths[i].c_str());
+		unlink(paths[i].c_str());
+	}
+	rmdir(scratch);
+}
+
 void TOS_update_texture(TOS_device* device, TOS_texture* texture, TOS_image* image)
-{	
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_memory;
-	TOS_create_buffer
-	(
-		device, image->size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer, staging_memory
-	);
-	void* data;
-	vkMapMemory(device->logical, staging_memory, 0, image->size, 0, &data);
-	memcpy(data, image->pixels, image->size);
-	vkUnmapMemory(device->logical, staging_memory);
-	
-	int mip_levels = std::floor(std::log2(std::max(image->width, image->height))) + 1;
-	TOS_transition_image_layout(device, texture->image, VK_FORMAT_R8G8B8A8_SRGB, mip_levels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	copy_buffer_to_image(device, staging_buffer, texture->image, image->width, image->height);
-	generate_mipmaps(device, texture->image, VK_FORMAT_R8G8B8A8_SRGB, image->width, image->height, mip_levels);
-
-	vkFreeMemory(device->logical, staging_memory, nullptr);
-	vkDestroyBuffer(device->logical, staging_buffer, nullptr);
-}
\ No newline at end of file
+{
+	upload_mip_chain(device, texture->image, image);
+}
@@ -2,6 +2,9 @@
 
 #include <GLFW/glfw3.h>
 #include "device.h"
+#include "allocator.h"
+#include <string>
+#include <vector>
 
 #define MAX_TEXTURE_COUNT 16
 #define TOS_TEXTURE_CHANNELS 4
@@ -17,9 +20,9 @@ struct TOS_image
 
 struct TOS_texture
 {
-	VkDeviceMemory memory;
+	TOS_allocation memory;
 	VkBuffer staging_buffer;
-	VkDeviceMemory staging_memory;
+	TOS_allocation staging_memory;
 	VkImage image;
 	VkImageView view;
 	VkSampler sampler;
@@ -28,12 +31,35 @@ struct TOS_texture
 void TOS_create_image(TOS_image* image, int width, int height);
 void TOS_destroy_image(TOS_image* image);
 void TOS_load_image(TOS_image* image, const char* path);
+// Decodes an encoded image already in memory, such as one from TOS_read_files
+void TOS_decode_image(TOS_image* image, const uint8_t* data, size_t size);
 void TOS_write_image(TOS_image* image, const char* path);
 
 void TOS_get_pixel(TOS_image* image, int x, int y, uint8_t* r, uint8_t* g, uint8_t* b, uint8_t* a);
 void TOS_set_pixel(TOS_image* image, int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
 
+struct TOS_texture_file;
+
+// Sampling never reaches levels finer than min_lod, which keeps it off
+// levels that are not resident yet
+VkSampler TOS_create_texture_sampler(TOS_device* device, uint32_t mip_levels, float min_lod=0.0f);
 void TOS_create_texture(TOS_device* device, TOS_texture* texture, TOS_image* image);
+// False for block compressed formats the device cannot sample, which are
+// decoded to RGBA8 before upload
+bool TOS_can_sample_texture_format(TOS_device* device, VkFormat format);
+// Uploads every level the file holds as it is, with no blits. Block
+// compressed levels are decoded first only when the device cannot sample them.
+void TOS_create_texture_from_file(TOS_device* device, TOS_texture* texture, const TOS_texture_file* file);
+// Leaves the texture zeroed, so destroying it again does nothing
 void TOS_destroy_texture(TOS_device* device, TOS_texture* texture);
+// Loads the baked cache next to path, baking it first if it is missing or
+// stale, and falls back to decoding path when the cache cannot be written
 void TOS_load_texture(TOS_device* device, TOS_texture* texture, const char* path);
+// Loads textures[i] from paths[i] as TOS_load_texture does, with the caches
+// opened and the stale sources read, decoded and baked on worker threads.
+// Only the uploads run on the calling thread.
+void TOS_load_textures(TOS_device* device, TOS_texture* textures, const std::vector<std::string>& paths, int thread_count=0);
+// Bakes, then opens, every image in the directory as a batch at 1, 2, 4...
+// threads up to the core count, with the caches in a scratch directory
+void TOS_benchmark_texture_loading(const char* directory);
 void TOS_update_texture(TOS_device* device, TOS_texture* texture, TOS_image* image);
@@ -0,0 +1,250 @@
+#include "texturestream.h"
+
+#include "memory.h"
+#include "upload.h"
+#include "pipeline.h"
+#include "bcn.h"
+#include "cowtools.h"
+#include <string.h>
+#include <math.h>
+#include <iostream>
+
+// A sampler replaced in one frame may sit in the descriptor sets of the next
+// MAX_CONCURRENT_FRAMES frames, which may in turn still be in flight
+#define RETIRE_FRAMES (2 * MAX_CONCURRENT_FRAMES)
+
+TOS_texture_streamer texture_streamer;
+
+void TOS_create_texture_streamer(TOS_device* device, VkDeviceSize frame_budget)
+{
+	texture_streamer = {};
+	texture_streamer.frame_budget = frame_budget;
+}
+
+void TOS_destroy_texture_streamer(TOS_device* device)
+{
+	for(TOS_retired_sampler& retired : texture_streamer.retired_samplers)
+		vkDestroySampler(device->logical, retired.sampler, nullptr);
+	for(TOS_texture_stream& stream : texture_streamer.streams)
+		TOS_close_texture_file(&stream.file);
+	texture_streamer = {};
+}
+
+static VkDeviceSize get_level_size(const TOS_texture_stream* stream, uint32_t level)
+{
+	const TOS_texture_level& file_level = stream->file.header->levels[level];
+	if(stream->decode)
+		return (VkDeviceSize) file_level.width * file_level.height * TOS_TEXTURE_CHANNELS;
+	return file_level.size;
+}
+
+// Stages one level, decoded if need be, and records its copy. The level
+// must already be in TRANSFER_DST_OPTIMAL.
+static void copy_level(TOS_device* device, const TOS_texture_stream* stream, uint32_t level)
+{
+	const TOS_texture_level& file_level = stream->file.header->levels[level];
+	const uint8_t* data = stream->file.levels + file_level.offset;
+	VkDeviceSize size = file_level.size;
+	TOS_image decoded {};
+	if(stream->decode)
+	{
+		TOS_decompress_image(data, (VkFormat) stream->file.header->format, file_level.width, file_level.height, &decoded);
+		data = decoded.pixels;
+		size = decoded.size;
+	}
+
+	VkBuffer staging_buffer;
+	VkDeviceSize staging_offset;
+	void* staging = TOS_stage_upload(device, size, TOS_STAGING_ALIGNMENT, &staging_buffer, &staging_offset);
+	memcpy(staging, data, size);
+	if(stream->decode)
+		TOS_destroy_image(&decoded);
+
+	VkBufferImageCopy copy_region {};
+	copy_region.bufferOffset = staging_offset;
+	copy_region.imageSubresource =
+	{
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.mipLevel = level,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+	copy_region.imageOffset = {0, 0, 0};
+	copy_region.imageExtent = {file_level.width, file_level.height, 1};
+	vkCmdCopyBufferToImage
+	(
+		TOS_get_upload_command_buffer(device), staging_buffer, stream->texture->image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		1, &copy_region
+	);
+}
+
+void TOS_stream_texture(TOS_device* device, TOS_texture* texture, const char* path)
+{
+	std::string cache_path = std::string(path) + TOS_TEXTURE_FILE_EXTENSION;
+	TOS_texture_stream stream {};
+	if(!TOS_open_texture_file(&stream.file, cache_path.c_str(), path))
+	{
+		TOS_image image;
+		TOS_load_image(&image, path);
+		if(!TOS_bake_texture(cache_path.c_str(), path, &image) || !TOS_open_texture_file(&stream.file, cache_path.c_str(), path))
+		{
+			std::cerr << "TOS_stream_texture: could not cache " << path << ", loading it whole" << std::endl;
+			TOS_create_texture(device, texture, &image);
+			TOS_destroy_image(&image);
+			return;
+		}
+		TOS_destroy_image(&image);
+	}
+
+	const TOS_texture_file_header* header = stream.file.header;
+	stream.texture = texture;
+	stream.path = path;
+	stream.decode = !TOS_can_sample_texture_format(device, (VkFormat) header->format);
+	stream.format = stream.decode ? VK_FORMAT_R8G8B8A8_SRGB : (VkFormat) header->format;
+	stream.level_count = header->level_count;
+	stream.first_frame = texture_streamer.frame;
+
+	uint32_t tail = stream.level_count - 1;
+	while(tail > 0 && TOS_max(header->levels[tail-1].width, header->levels[tail-1].height) <= TOS_STREAMING_TAIL_SIZE)
+		tail--;
+
+	TOS_create_image
+	(
+		device,
+		header->levels[0].width, header->levels[0].height, stream.format,
+		stream.level_count,
+		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		texture->image, texture->memory
+	);
+
+	// Every level is moved to SHADER_READ_ONLY_OPTIMAL so the view matches
+	// its descriptor, but only the tail holds anything yet
+	TOS_record_image_transition(TOS_get_upload_command_buffer(device), texture->image, stream.format, stream.level_count, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	for(uint32_t level = tail; level < stream.level_count; level++)
+		copy_level(device, &stream, level);
+	TOS_record_image_transition(TOS_get_upload_command_buffer(device), texture->image, stream.format, stream.level_count, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	texture->view = TOS_create_image_view(device, texture->image, stream.format, stream.level_count, VK_IMAGE_ASPECT_COLOR_BIT);
+	texture->sampler = TOS_create_texture_sampler(device, stream.level_count, (float) tail);
+	stream.resident_level = tail;
+	stream.requested_level = tail;
+
+	if(tail == 0)
+	{
+		TOS_close_texture_file(&stream.file);
+		return;
+	}
+	texture_streamer.streams.push_back(stream);
+}
+
+void TOS_request_texture_level(TOS_texture* texture, uint32_t level)
+{
+	for(TOS_texture_stream& stream : texture_streamer.streams)
+	{
+		if(stream.texture == texture)
+			stream.requested_level = TOS_min(level, stream.level_count - 1);
+	}
+}
+
+void TOS_request_texture_coverage(TOS_texture* texture, float pixels)
+{
+	for(TOS_texture_stream& stream : texture_streamer.streams)
+	{
+		if(stream.texture != texture)
+			continue;
+		const TOS_texture_level& top = stream.file.header->levels[0];
+		float texels = (float) TOS_max(top.width, top.height);
+		// Also catches infinite coverage, from a camera inside the surface
+		uint32_t level = 0;
+		if(pixels < texels)
+			level = pixels > 0.0f ? (uint32_t) log2f(texels / pixels) : stream.level_count - 1;
+		stream.requested_level = TOS_min(level, stream.level_count - 1);
+	}
+}
+
+bool TOS_update_texture_streaming(TOS_device* device)
+{
+	texture_streamer.frame++;
+	std::vector<TOS_retired_sampler>& retired = texture_streamer.retired_samplers;
+	for(size_t i = 0; i < retired.size();)
+	{
+		if(texture_streamer.frame >= retired[i].frame + RETIRE_FRAMES)
+		{
+			vkDestroySampler(device->logical, retired[i].sampler, nullptr);
+			retired[i] = retired.back();
+			retired.pop_back();
+		}
+		else
+			i++;
+	}
+
+	std::vector<TOS_texture_stream>& streams = texture_streamer.streams;
+	std::vector<uint32_t> previous_levels;
+	for(const TOS_texture_stream& stream : streams)
+		previous_levels.push_back(stream.resident_level);
+
+	// The cheapest next level across every texture goes first, so coarse
+	// levels reach all of them before fine levels reach any. The first
+	// upload of a frame may exceed the budget on its own, or levels larger
+	// than it would never arrive.
+	VkDeviceSize spent = 0;
+	for(;;)
+	{
+		TOS_texture_stream* next = nullptr;
+		VkDeviceSize next_size = 0;
+		for(TOS_texture_stream& stream : streams)
+		{
+			if(stream.resident_level <= stream.requested_level)
+				continue;
+			VkDeviceSize size = get_level_size(&stream, stream.resident_level - 1);
+			if(next == nullptr || size < next_size)
+			{
+				next = &stream;
+				next_size = size;
+			}
+		}
+		if(next == nullptr)
+			break;
+		if(spent > 0 && spent + next_size > texture_streamer.frame_budget)
+		{
+			texture_streamer.stats.saturated_frames++;
+			break;
+		}
+
+		uint32_t level = next->resident_level - 1;
+		TOS_record_image_transition(TOS_get_upload_command_buffer(device), next->texture->image, next->format, 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, level);
+		copy_level(device, next, level);
+		TOS_record_image_transition(TOS_get_upload_command_buffer(device), next->texture->image, next->format, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, level);
+		next->resident_level = level;
+		spent += next_size;
+		texture_streamer.stats.uploads++;
+		texture_streamer.stats.bytes += next_size;
+	}
+
+	bool changed = false;
+	for(size_t i = 0; i < streams.size();)
+	{
+		TOS_texture_stream& stream = streams[i];
+		if(stream.resident_level != previous_levels[i])
+		{
+			retired.push_back({stream.texture->sampler, texture_streamer.frame});
+			stream.texture->sampler = TOS_create_texture_sampler(device, stream.level_count, (float) stream.resident_level);
+			changed = true;
+		}
+		if(stream.resident_level == 0)
+		{
+			std::cout << "TOS_update_texture_streaming: " << stream.path << " fully resident after "
+			<< texture_streamer.frame - stream.first_frame << " frames" << std::endl;
+			TOS_close_texture_file(&stream.file);
+			streams[i] = streams.back();
+			streams.pop_back();
+			previous_levels[i] = previous_levels.back();
+			previous_levels.pop_back();
+		}
+		else
+			i++;
+	}
+	return changed;
+}
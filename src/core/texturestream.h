@@ -0,0 +1,92 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "device.h"
+#include "textures.h"
+#include "texturefile.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Textures that become usable before their full resolution is resident.
+// The image is created with its whole mip chain, but only the small levels
+// at the end of it are uploaded up front; the sampler's minLod keeps
+// sampling off the rest. Each frame the streamer uploads the next finer
+// level of the textures that asked for more detail, smallest first across
+// all of them and within a budget of bytes, and swaps in samplers with
+// lower minLods as levels land. Uploads go through the staging ring, so
+// the frame that first samples a level waits on its copy.
+//
+// Residency only grows: the image's memory covers every level from the
+// start, so dropping levels a texture no longer asks for would free nothing.
+
+#define TOS_STREAMING_FRAME_BUDGET (4ull << 20)
+// Levels no larger than this on either side are uploaded with the texture
+#define TOS_STREAMING_TAIL_SIZE 64
+
+struct TOS_texture_stream
+{
+	TOS_texture* texture;
+	std::string path;
+	// Kept mapped until every level is resident
+	TOS_texture_file file;
+	// Set when the device cannot sample the file's format, so levels are
+	// decoded to RGBA8 as they are uploaded
+	bool decode;
+	VkFormat format;
+	uint32_t level_count;
+	// Finest level uploaded, which is also the sampler's minLod
+	uint32_t resident_level;
+	// Finest level the renderer has asked for
+	uint32_t requested_level;
+	uint64_t first_frame;
+};
+
+struct TOS_retired_sampler
+{
+	VkSampler sampler;
+	uint64_t frame;
+};
+
+struct TOS_streaming_stats
+{
+	size_t uploads;
+	VkDeviceSize bytes;
+	// Frames in which the budget ran out with levels still requested
+	size_t saturated_frames;
+};
+
+struct TOS_texture_streamer
+{
+	VkDeviceSize frame_budget;
+	uint64_t frame;
+	std::vector<TOS_texture_stream> streams;
+	// Replaced samplers stay alive while descriptors of frames in flight
+	// may still hold them
+	std::vector<TOS_retired_sampler> retired_samplers;
+	TOS_streaming_stats stats;
+};
+
+extern TOS_texture_streamer texture_streamer;
+
+void TOS_create_texture_streamer(TOS_device* device, VkDeviceSize frame_budget=TOS_STREAMING_FRAME_BUDGET);
+// Call once the device is idle. The textures themselves are left to their
+// owners to destroy.
+void TOS_destroy_texture_streamer(TOS_device* device);
+
+// Creates the texture from the baked cache next to path, baking it first if
+// needed, with only its mip tail resident. When no cache can be written, the
+// decoded source is uploaded whole through TOS_create_texture instead.
+void TOS_stream_texture(TOS_device* device, TOS_texture* texture, const char* path);
+// Feedback from the renderer: the finest level the texture needs. Ignored
+// for textures that are not streamed.
+void TOS_request_texture_level(TOS_texture* texture, uint32_t level);
+// The same feedback given as the number of pixels one repeat of the texture
+// spans on screen where it is closest. The finest level requested is the
+// one whose texels are no smaller than those pixels.
+void TOS_request_texture_coverage(TOS_texture* texture, float pixels);
+// Records this frame's uploads and retires samplers no frame can still use.
+// Call once per frame before TOS_begin_frame; returns true when samplers
+// changed, in which case texture descriptors must be rewritten.
+bool TOS_update_texture_streaming(TOS_device* device);
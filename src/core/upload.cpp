@@ -0,0 +1,258 @@
+#include "upload.h"
+
+#include "memory.h"
+#include "cowtools.h"
+#include <string.h>
+#include <stdexcept>
+
+static TOS_upload_batch* recording_batch(TOS_device* device)
+{
+	TOS_upload_queue* queue = device->uploads;
+	TOS_upload_batch* batch = &queue->batches[queue->current];
+	if(batch->command_buffer == VK_NULL_HANDLE)
+	{
+		batch->command_buffer = TOS_create_command_buffer(device, device->command_pools.transfer);
+		TOS_begin_command_buffer(device, batch->command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	}
+	return batch;
+}
+
+// Waits for the batch and hands its command buffer, overflow staging and
+// ring space back
+static void retire_batch(TOS_device* device, TOS_upload_batch* batch)
+{
+	TOS_upload_queue* queue = device->uploads;
+	vkWaitForFences(device->logical, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device->logical, 1, &batch->fence);
+	if(batch->command_buffer != VK_NULL_HANDLE)
+		TOS_destroy_command_buffer(device, device->command_pools.transfer, batch->command_buffer);
+	batch->command_buffer = VK_NULL_HANDLE;
+	for(size_t i = 0; i < batch->overflow_buffers.size(); i++)
+	{
+		vkDestroyBuffer(device->logical, batch->overflow_buffers[i], nullptr);
+		TOS_free_memory(device, &batch->overflow_memory[i]);
+	}
+	batch->overflow_buffers.clear();
+	batch->overflow_memory.clear();
+	queue->tail = TOS_max(queue->tail, batch->ring_head);
+	batch->submitted = false;
+}
+
+// Batches are submitted round robin, so the oldest in flight follows the
+// one being recorded
+static TOS_upload_batch* oldest_submitted(TOS_upload_queue* queue)
+{
+	for(uint32_t i = 1; i < TOS_UPLOAD_BATCH_COUNT; i++)
+	{
+		TOS_upload_batch* batch = &queue->batches[(queue->current + i) % TOS_UPLOAD_BATCH_COUNT];
+		if(batch->submitted)
+			return batch;
+	}
+	return nullptr;
+}
+
+static void retire_completed(TOS_device* device)
+{
+	TOS_upload_batch* batch;
+	while((batch = oldest_submitted(device->uploads)) != nullptr)
+	{
+		if(vkGetFenceStatus(device->logical, batch->fence) != VK_SUCCESS)
+			break;
+		retire_batch(device, batch);
+	}
+}
+
+static void submit_batch(TOS_device* device, bool signal)
+{
+	TOS_upload_queue* queue = device->uploads;
+	TOS_upload_batch* batch = &queue->batches[queue->current];
+
+	VkSubmitInfo submission {};
+	submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	if(batch->command_buffer != VK_NULL_HANDLE)
+	{
+		vkEndCommandBuffer(batch->command_buffer);
+		submission.commandBufferCount = 1;
+		submission.pCommandBuffers = &batch->command_buffer;
+	}
+	if(signal)
+	{
+		submission.signalSemaphoreCount = 1;
+		submission.pSignalSemaphores = &batch->semaphore;
+	}
+	batch->ring_head = queue->head;
+	VkResult result = vkQueueSubmit(device->queues.transfer, 1, &submission, batch->fence);
+	if(result != VK_SUCCESS)
+		throw std::runtime_error("TOS_flush_uploads: failed to submit upload batch");
+	batch->submitted = true;
+	queue->stats.submits++;
+	// A signal covers every submission before it on the queue
+	queue->unsignalled_submits = !signal;
+
+	queue->current = (queue->current + 1) % TOS_UPLOAD_BATCH_COUNT;
+	TOS_upload_batch* next = &queue->batches[queue->current];
+	if(next->submitted)
+		retire_batch(device, next);
+}
+
+void TOS_create_upload_queue(TOS_device* device)
+{
+	TOS_upload_queue* queue = new TOS_upload_queue {};
+	device->uploads = queue;
+	TOS_create_buffer
+	(
+		device, TOS_STAGING_RING_SIZE,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		queue->ring_buffer, queue->ring_memory
+	);
+
+	VkFenceCreateInfo fence_info {};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VkSemaphoreCreateInfo semaphore_info {};
+	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	for(TOS_upload_batch& batch : queue->batches)
+	{
+		if
+		(
+			vkCreateFence(device->logical, &fence_info, nullptr, &batch.fence) != VK_SUCCESS ||
+			vkCreateSemaphore(device->logical, &semaphore_info, nullptr, &batch.semaphore) != VK_SUCCESS
+		)
+		{
+			throw std::runtime_error("TOS_create_upload_queue: failed to create synchronization objects");
+		}
+	}
+}
+
+void TOS_destroy_upload_queue(TOS_device* device)
+{
+	TOS_upload_queue* queue = device->uploads;
+	TOS_wait_uploads(device);
+	for(TOS_upload_batch& batch : queue->batches)
+	{
+		vkDestroySemaphore(device->logical, batch.semaphore, nullptr);
+		vkDestroyFence(device->logical, batch.fence, nullptr);
+	}
+	vkDestroyBuffer(device->logical, queue->ring_buffer, nullptr);
+	TOS_free_memory(device, &queue->ring_memory);
+	delete queue;
+	device->uploads = nullptr;
+}
+
+void* TOS_stage_upload(TOS_device* device, VkDeviceSize size, VkDeviceSize alignment, VkBuffer* buffer, VkDeviceSize* offset)
+{
+	TOS_upload_queue* queue = device->uploads;
+	alignment = TOS_max(alignment, (VkDeviceSize) 1);
+	queue->stats.copies++;
+	queue->stats.bytes += size;
+
+	if(size > TOS_STAGING_RING_SIZE)
+	{
+		TOS_upload_batch* batch = recording_batch(device);
+		VkBuffer staging_buffer;
+		TOS_allocation staging_memory;
+		TOS_create_buffer
+		(
+			device, size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			staging_buffer, staging_memory
+		);
+		batch->overflow_buffers.push_back(staging_buffer);
+		batch->overflow_memory.push_back(staging_memory);
+		*buffer = staging_buffer;
+		*offset = 0;
+		return staging_memory.mapped;
+	}
+
+	retire_completed(device);
+	while(true)
+	{
+		// With nothing staged the ring can restart at its beginning
+		if(queue->head == queue->tail)
+			queue->head = queue->tail = (queue->head + TOS_STAGING_RING_SIZE-1) / TOS_STAGING_RING_SIZE * TOS_STAGING_RING_SIZE;
+
+		VkDeviceSize ring_offset = queue->head % TOS_STAGING_RING_SIZE;
+		VkDeviceSize aligned = (ring_offset + alignment-1) / alignment * alignment;
+		VkDeviceSize start = queue->head + (aligned - ring_offset);
+		// Staging never straddles the end of the ring
+		if(aligned + size > TOS_STAGING_RING_SIZE)
+		{
+			start = queue->head + (TOS_STAGING_RING_SIZE - ring_offset);
+			aligned = 0;
+		}
+		if(start + size - queue->tail <= TOS_STAGING_RING_SIZE)
+		{
+			queue->head = start + size;
+			recording_batch(device);
+			*buffer = queue->ring_buffer;
+			*offset = aligned;
+			return (uint8_t*) queue->ring_memory.mapped + aligned;
+		}
+
+		// The ring is full: send what has been recorded and wait for the
+		// oldest batch in flight to give its space back
+		queue->stats.stalls++;
+		if(queue->batches[queue->current].command_buffer != VK_NULL_HANDLE)
+			submit_batch(device, false);
+		TOS_upload_batch* oldest = oldest_submitted(queue);
+		if(oldest == nullptr)
+			throw std::runtime_error("TOS_stage_upload: staging ring exhausted with nothing in flight");
+		retire_batch(device, oldest);
+	}
+}
+
+VkCommandBuffer TOS_get_upload_command_buffer(TOS_device* device)
+{
+	return recording_batch(device)->command_buffer;
+}
+
+void TOS_upload_buffer(TOS_device* device, VkBuffer destination, VkDeviceSize destination_offset, const void* data, VkDeviceSize size)
+{
+	if(size == 0)
+		return;
+	VkBuffer staging_buffer;
+	VkDeviceSize staging_offset;
+	void* staging = TOS_stage_upload(device, size, TOS_STAGING_ALIGNMENT, &staging_buffer, &staging_offset);
+	memcpy(staging, data, size);
+
+	VkBufferCopy copy_region {};
+	copy_region.srcOffset = staging_offset;
+	copy_region.dstOffset = destination_offset;
+	copy_region.size = size;
+	vkCmdCopyBuffer(TOS_get_upload_command_buffer(device), staging_buffer, destination, 1, &copy_region);
+}
+
+void TOS_flush_uploads(TOS_device* device)
+{
+	TOS_upload_queue* queue = device->uploads;
+	if(queue->batches[queue->current].command_buffer != VK_NULL_HANDLE)
+		submit_batch(device, false);
+}
+
+VkSemaphore TOS_flush_frame_uploads(TOS_device* device)
+{
+	TOS_upload_queue* queue = device->uploads;
+	TOS_upload_batch* batch = &queue->batches[queue->current];
+	if(batch->command_buffer == VK_NULL_HANDLE && !queue->unsignalled_submits)
+		return VK_NULL_HANDLE;
+	// An empty batch still signals once everything before it is done
+	VkSemaphore semaphore = batch->semaphore;
+	submit_batch(device, true);
+	return semaphore;
+}
+
+void TOS_wait_uploads(TOS_device* device)
+{
+	TOS_flush_uploads(device);
+	TOS_upload_batch* batch;
+	while((batch = oldest_submitted(device->uploads)) != nullptr)
+		retire_batch(device, batch);
+}
+
+TOS_upload_stats TOS_get_upload_stats(TOS_device* device)
+{
+	return device->uploads->stats;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include "device.h"
+#include "allocator.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Batched uploads through a persistently mapped staging ring. Copies and
+// layout transitions are recorded into the batch being built and go to the
+// transfer queue together when it is flushed, each batch with a fence that
+// returns its part of the ring once the GPU is done with it. Nothing waits
+// for the queue to go idle; TOS_flush_frame_uploads hands the frame a
+// semaphore to wait on instead.
+//
+// Like the rest of the renderer this assumes the transfer and graphics
+// queues share a family, so no ownership transfers are recorded.
+
+#define TOS_STAGING_RING_SIZE (64ull << 20)
+#define TOS_UPLOAD_BATCH_COUNT 4
+#define TOS_STAGING_ALIGNMENT 16
+
+struct TOS_upload_batch
+{
+	VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+	// Signalled only by batches flushed for a frame, which waits on it
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	// Ring position the tail may advance to once the batch completes
+	VkDeviceSize ring_head = 0;
+	// Staging for uploads larger than the whole ring, freed on completion
+	std::vector<VkBuffer> overflow_buffers;
+	std::vector<TOS_allocation> overflow_memory;
+	bool submitted = false;
+};
+
+struct TOS_upload_stats
+{
+	size_t submits;
+	size_t copies;
+	VkDeviceSize bytes;
+	// Times staging had to wait for the GPU to free ring space
+	size_t stalls;
+};
+
+struct TOS_upload_queue
+{
+	VkBuffer ring_buffer;
+	TOS_allocation ring_memory;
+	// Positions grow without wrapping; the ring offset is their remainder
+	VkDeviceSize head;
+	VkDeviceSize tail;
+
+	TOS_upload_batch batches[TOS_UPLOAD_BATCH_COUNT];
+	uint32_t current;
+	// Batches submitted since the last frame flush, which must be covered
+	// by the semaphore the frame waits on
+	bool unsignalled_submits;
+	TOS_upload_stats stats;
+};
+
+void TOS_create_upload_queue(TOS_device* device);
+// Waits for every batch still in flight
+void TOS_destroy_upload_queue(TOS_device* device);
+
+// Reserves size bytes of staging in the batch being recorded and returns
+// where to write them, with the buffer and offset to copy them from.
+// Staging may flush the batch to free ring space, so fetch the command
+// buffer with TOS_get_upload_command_buffer afterwards.
+void* TOS_stage_upload(TOS_device* device, VkDeviceSize size, VkDeviceSize alignment, VkBuffer* buffer, VkDeviceSize* offset);
+VkCommandBuffer TOS_get_upload_command_buffer(TOS_device* device);
+void TOS_upload_buffer(TOS_device* device, VkBuffer destination, VkDeviceSize destination_offset, const void* data, VkDeviceSize size);
+
+// Submits the batch being recorded, if it holds anything
+void TOS_flush_uploads(TOS_device* device);
+// Submits everything recorded so far and returns a semaphore that signals
+// once all of it has completed, or VK_NULL_HANDLE when nothing is pending.
+// The caller's next submission must wait on it.
+VkSemaphore TOS_flush_frame_uploads(TOS_device* device);
+// Blocks until every submitted batch has completed
+void TOS_wait_uploads(TOS_device* device);
+TOS_upload_stats TOS_get_upload_stats(TOS_device* device);
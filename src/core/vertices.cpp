@@ -2,6 +2,24 @@
 
 #include "obj/obj.h"
 #include "memory.h"
+#include "meshfile.h"
+#include "weld.h"
+#include "optimize.h"
+#include "quantize.h"
+#include "split.h"
+#include "meshlets.h"
+#include "simplify.h"
+#include "threads.h"
+#include "cowtools.h"
+#include "fileio.h"
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <unordered_map>
 
 bool TOS_vertex::operator==(const TOS_vertex& other) const
 {
@@ -12,17 +30,127 @@ bool TOS_vertex::operator==(const TOS_vertex& other) const
 	material_idx == other.material_idx;
 }
 
-VkVertexInputBindingDescription TOS_get_vertex_binding_description()
+static uint64_t mix_word(uint64_t h, uint32_t word)
+{
+	h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+	return h ^ (h >> 32);
+}
+
+static uint32_t float_bits(float value)
+{
+	if(value == 0.0f)
+		value = 0.0f;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+uint32_t TOS_hash_vertex(const TOS_vertex& vertex)
+{
+	uint64_t h = 0xCBF29CE484222325ull;
+	for(int i = 0; i < 3; i++)
+		h = mix_word(h, float_bits(vertex.position[i]));
+	for(int i = 0; i < 2; i++)
+		h = mix_word(h, float_bits(vertex.uv[i]));
+	for(int i = 0; i < 3; i++)
+		h = mix_word(h, float_bits(vertex.normal[i]));
+	h = mix_word(h, vertex.material_idx);
+
+	// Final avalanche so the low bits used for slot selection depend on all input
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return (uint32_t) h;
+}
+
+static void resize_vertex_table(TOS_vertex_table* table, size_t slot_count)
+{
+	std::vector<TOS_vertex_table_slot> old = std::move(table->slots);
+	table->slots.assign(slot_count, {0, TOS_VERTEX_TABLE_EMPTY});
+	table->mask = slot_count-1;
+	for(TOS_vertex_table_slot slot : old)
+	{
+		if(slot.index == TOS_VERTEX_TABLE_EMPTY)
+			continue;
+		size_t i = slot.hash & table->mask;
+		while(table->slots[i].index != TOS_VERTEX_TABLE_EMPTY)
+			i = (i+1) & table->mask;
+		table->slots[i] = slot;
+	}
+}
+
+void TOS_create_vertex_table(TOS_vertex_table* table, size_t expected_count)
+{
+	size_t slot_count = 16;
+	while(slot_count < expected_count * 2)
+		slot_count <<= 1;
+	*table = {};
+	resize_vertex_table(table, slot_count);
+}
+
+uint32_t TOS_weld_vertex(TOS_vertex_table* table, std::vector<TOS_vertex>* vertices, const TOS_vertex& vertex)
+{
+	uint32_t hash = TOS_hash_vertex(vertex);
+	size_t i = hash & table->mask;
+	while(table->slots[i].index != TOS_VERTEX_TABLE_EMPTY)
+	{
+		TOS_vertex_table_slot slot = table->slots[i];
+		if(slot.hash == hash && (*vertices)[slot.index] == vertex)
+			return slot.index;
+		i = (i+1) & table->mask;
+	}
+
+	uint32_t index = (uint32_t) vertices->size();
+	vertices->push_back(vertex);
+	table->slots[i] = {hash, index};
+	table->count++;
+	// Linear probing degrades quickly past half full
+	if(table->count * 2 > table->slots.size())
+		resize_vertex_table(table, table->slots.size() * 2);
+	return index;
+}
+
+VkVertexInputBindingDescription TOS_get_vertex_binding_description(TOS_vertex_format format)
 {
 	VkVertexInputBindingDescription description {};
 	description.binding = 0;
-	description.stride = sizeof(TOS_vertex);
+	description.stride = format == TOS_VERTEX_FORMAT_PACKED ? sizeof(TOS_packed_vertex) : sizeof(TOS_vertex);
 	description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	return description;
 }
 
-std::vector<VkVertexInputAttributeDescription> TOS_get_vertex_attribute_descriptions()
+std::vector<VkVertexInputAttributeDescription> TOS_get_vertex_attribute_descriptions(TOS_vertex_format format)
 {
+	if(format == TOS_VERTEX_FORMAT_PACKED)
+	{
+		// Material rides in the fourth position component
+		std::vector<VkVertexInputAttributeDescription> descriptions =
+		{
+			(VkVertexInputAttributeDescription)
+			{
+				.binding = 0,
+				.location = 0,
+				.format = VK_FORMAT_R16G16B16A16_UINT,
+				.offset = offsetof(TOS_packed_vertex, position)
+			},
+			(VkVertexInputAttributeDescription)
+			{
+				.binding = 0,
+				.location = 1,
+				.format = VK_FORMAT_R16G16_SFLOAT,
+				.offset = offsetof(TOS_packed_vertex, uv)
+			},
+			(VkVertexInputAttributeDescription)
+			{
+				.binding = 0,
+				.location = 2,
+				.format = VK_FORMAT_R16G16_SNORM,
+				.offset = offsetof(TOS_packed_vertex, normal)
+			},
+		};
+		return descriptions;
+	}
+
 	std::vector<VkVertexInputAttributeDescription> descriptions =
 	{
 		(VkVertexInputAttributeDescription)
@@ -57,163 +185,801 @@ std::vector<VkVertexInputAttributeDescription> TOS_get_vertex_attribute_descript
 	return descriptions;
 }
 
-void create_vertex_buffer(TOS_device* device, TOS_mesh* mesh)
+static void create_vertex_buffer(TOS_device* device, TOS_mesh* mesh, const void* vertices, size_t stride)
 {
-	VkDeviceSize buffer_size = sizeof(TOS_vertex) * mesh->vertices.size();
-	
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_memory;
-	TOS_create_buffer
-	(
-		device, buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer,
-		staging_memory
-	);
-	
-	void* data;
-	vkMapMemory(device->logical, staging_memory, 0, buffer_size, 0, &data);
-	memcpy(data, mesh->vertices.data(), buffer_size);
-	vkUnmapMemory(device->logical, staging_memory);
-	
-	TOS_create_buffer
+	mesh->vertex_allocation = TOS_upload_vertices(device, vertices, stride * mesh->vertex_count, stride);
+	mesh->base_vertex = (int32_t) (mesh->vertex_allocation.offset / stride);
+}
+
+// Narrows the indices before upload when the mesh uses 16-bit indices
+static void create_index_buffer(TOS_device* device, TOS_mesh* mesh, const uint32_t* indices)
+{
+	if(mesh->index_type == VK_INDEX_TYPE_UINT16)
+	{
+		std::vector<uint16_t> narrow(indices, indices + mesh->index_count);
+		mesh->index_allocation = TOS_upload_indices(device, narrow.data(), sizeof(uint16_t) * mesh->index_count, sizeof(uint16_t));
+		mesh->first_index = (uint32_t) (mesh->index_allocation.offset / sizeof(uint16_t));
+	}
+	else
+	{
+		mesh->index_allocation = TOS_upload_indices(device, indices, sizeof(uint32_t) * mesh->index_count, sizeof(uint32_t));
+		mesh->first_index = (uint32_t) (mesh->index_allocation.offset / sizeof(uint32_t));
+	}
+}
+
+void TOS_create_mesh(TOS_device* device, TOS_mesh* mesh, const std::vector<TOS_vertex>& vertices, const std::vector<uint32_t>& indices, TOS_vertex_format format)
+{
+	TOS_create_mesh(device, mesh, vertices.data(), (uint32_t) vertices.size(), indices.data(), (uint32_t) indices.size(), format);
+}
+
+// Ratio of summed edge lengths in mesh space to those in UV space, so long
+// edges weigh more than slivers. Edges with no extent in UV are skipped, and
+// a mesh with none left spans 0.
+static float compute_texture_span(const TOS_vertex* vertices, const uint32_t* indices, uint32_t index_count)
+{
+	double position_length = 0;
+	double uv_length = 0;
+	for(uint32_t i = 0; i+2 < index_count; i += 3)
+	{
+		for(uint32_t e = 0; e < 3; e++)
+		{
+			const TOS_vertex& a = vertices[indices[i+e]];
+			const TOS_vertex& b = vertices[indices[i+(e+1)%3]];
+			float uv = glm::length(b.uv - a.uv);
+			if(uv <= 0.0f)
+				continue;
+			position_length += glm::length(b.position - a.position);
+			uv_length += uv;
+		}
+	}
+	return uv_length > 0 ? (float) (position_length / uv_length) : 0.0f;
+}
+
+// Expects mesh->min and mesh->max to be set already, since packed
+// positions are quantized against them. Every level of detail becomes one
+// range, or several when the mesh is split for 16-bit indices.
+static void upload_mesh
+(
+	TOS_device* device, TOS_mesh* mesh,
+	const TOS_vertex* vertices, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count,
+	const TOS_lod_span* lods, uint32_t lod_count,
+	TOS_mesh_specification specification, TOS_quantization_error* error=nullptr
+)
+{
+	mesh->ranges.clear();
+	mesh->lods.clear();
+	mesh->texture_span = compute_texture_span(vertices, indices + lods[0].first_index, lods[0].index_count);
+	TOS_split_result split_result;
+	bool split = specification.split_indices && vertex_count > TOS_INDEX16_VERTEX_LIMIT;
+	if(split)
+	{
+		// All levels are split together so that they keep sharing vertices,
+		// with no range straddling two of them
+		TOS_split_mesh(vertices, vertex_count, indices, lods, lod_count, &split_result);
+		mesh->ranges = split_result.ranges;
+		mesh->lods = split_result.lods;
+		vertices = split_result.vertices.data();
+		vertex_count = (uint32_t) split_result.vertices.size();
+		indices = split_result.indices.data();
+		index_count = (uint32_t) split_result.indices.size();
+	}
+	else
+	{
+		for(uint32_t l = 0; l < lod_count; l++)
+		{
+			mesh->ranges.push_back({lods[l].first_index, lods[l].index_count, 0});
+			mesh->lods.push_back({l, 1, lods[l].index_count, lods[l].error});
+		}
+	}
+
+	mesh->vertex_format = specification.vertex_format;
+	mesh->vertex_count = vertex_count;
+	mesh->index_count = index_count;
+	bool narrow = vertex_count <= TOS_INDEX16_VERTEX_LIMIT || split;
+	mesh->index_type = narrow ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	mesh->meshlets.clear();
+	if(specification.build_meshlets)
+	{
+		const TOS_mesh_lod& full = mesh->lods[0];
+		TOS_build_meshlets(vertices, indices, &mesh->ranges[full.first_range], full.range_count, &mesh->meshlets);
+	}
+	if(mesh->vertex_format == TOS_VERTEX_FORMAT_PACKED)
+	{
+		std::vector<TOS_packed_vertex> packed(vertex_count);
+		TOS_pack_vertices(vertices, vertex_count, mesh->min, mesh->max, packed.data());
+		if(error != nullptr)
+			*error = TOS_measure_quantization_error(vertices, packed.data(), vertex_count, mesh->min, mesh->max);
+		create_vertex_buffer(device, mesh, packed.data(), sizeof(TOS_packed_vertex));
+	}
+	else
+	{
+		create_vertex_buffer(device, mesh, vertices, sizeof(TOS_vertex));
+	}
+	create_index_buffer(device, mesh, indices);
+}
+
+static void compute_bounds(const TOS_vertex* vertices, uint32_t vertex_count, glm::vec3* min, glm::vec3* max)
+{
+	*min = glm::vec3(INFINITY, INFINITY, INFINITY);
+	*max = -*min;
+	for(uint32_t i = 0; i < vertex_count; i++)
+	{
+		*min = glm::min(*min, vertices[i].position);
+		*max = glm::max(*max, vertices[i].position);
+	}
+}
+
+void TOS_create_mesh(TOS_device* device, TOS_mesh* mesh, const TOS_vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, TOS_vertex_format format)
+{
+	compute_bounds(vertices, vertex_count, &mesh->min, &mesh->max);
+	TOS_lod_span whole = {0, index_count, 0.0f};
+	upload_mesh(device, mesh, vertices, vertex_count, indices, index_count, &whole, 1, {.vertex_format = format});
+}
+
+void TOS_destroy_mesh(TOS_device* device, TOS_mesh* mesh)
+{
+	TOS_free_indices(&mesh->index_allocation);
+	TOS_free_vertices(&mesh->vertex_allocation);
+	mesh->ranges.clear();
+	mesh->lods.clear();
+	mesh->meshlets.clear();
+}
+
+// Builds the vertex for one face point from 1-based v/vt/vn indices,
+// where 0 marks an absent texture coordinate or normal
+static TOS_vertex make_vertex(const TOS_OBJ* obj, const int* point)
+{
+	int v_idx = (point[0]-1)*3;
+	int vt_idx = (point[1]-1)*2;
+	int vn_idx = (point[2]-1)*3;
+
+	glm::vec3 v
 	(
-		device, buffer_size,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		mesh->vertex_buffer,
-		mesh->vertex_memory
+		obj->v[v_idx+0],
+		obj->v[v_idx+1],
+		obj->v[v_idx+2]
 	);
-	
-	TOS_copy_buffer(device, staging_buffer, mesh->vertex_buffer, buffer_size);
-	vkDestroyBuffer(device->logical, staging_buffer, nullptr);
-	vkFreeMemory(device->logical, staging_memory, nullptr);
+
+	glm::vec2 vt = vt_idx >= 0 ?
+	glm::vec2(
+		obj->vt[vt_idx+0],
+		1.0f - obj->vt[vt_idx+1]
+	) : glm::vec2(0);
+
+	glm::vec3 vn = vn_idx >= 0 ?
+	glm::vec3(
+		obj->vn[vn_idx+0],
+		obj->vn[vn_idx+1],
+		obj->vn[vn_idx+2]
+	) : glm::vec3(0);
+
+	return
+	{
+		.position = v,
+		.uv = vt,
+		.normal = vn
+	};
+}
+
+// Marks a point in the route that the resident table resolved
+#define ROUTE_RESIDENT 0xFF
+#define SPILL_PARTITION_BITS 6
+#define SPILL_PARTITION_COUNT (1 << SPILL_PARTITION_BITS)
+
+// Temporary files of one hash partition of the points the resident table
+// could not take. Each partition is welded on its own once parsing ends.
+struct spill_partition
+{
+	// Points in arrival order, replaced by their welded values after welding
+	FILE* points;
+	// Index of each point among the partition's unique vertices
+	FILE* locals;
+	// Final index of each of the partition's unique vertices
+	FILE* globals;
+	uint32_t unique_count;
+	uint32_t seen_count;
+};
+
+struct weld_spill
+{
+	// Partition of every point after the resident table filled up
+	FILE* route;
+	// Final indices of the routed points the resident table resolved
+	FILE* resident;
+	spill_partition partitions[SPILL_PARTITION_COUNT];
+};
+
+static FILE* open_spill_file()
+{
+	FILE* file = tmpfile();
+	if(file == nullptr)
+		throw std::runtime_error("TOS_stream_mesh: failed to create spill file");
+	return file;
+}
+
+static void close_spill_file(FILE** file)
+{
+	if(*file != nullptr)
+		fclose(*file);
+	*file = nullptr;
+}
+
+static void close_weld_spill(weld_spill* spill)
+{
+	close_spill_file(&spill->route);
+	close_spill_file(&spill->resident);
+	for(spill_partition& partition : spill->partitions)
+	{
+		close_spill_file(&partition.points);
+		close_spill_file(&partition.locals);
+		close_spill_file(&partition.globals);
+	}
+}
+
+static void write_spill(FILE* file, const void* data, size_t size, size_t count)
+{
+	if(fwrite(data, size, count, file) != count)
+		throw std::runtime_error("TOS_stream_mesh: failed to write spill file");
+}
+
+static void read_spill(FILE* file, void* data, size_t size, size_t count)
+{
+	if(fread(data, size, count, file) != count)
+		throw std::runtime_error("TOS_stream_mesh: failed to read spill file");
+}
+
+static void rewind_spill(FILE* file)
+{
+	if(fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0)
+		throw std::runtime_error("TOS_stream_mesh: failed to rewind spill file");
+}
+
+// Welds each partition's points by value in memory, leaving the partition's
+// unique vertices in first-arrival order in place of its points
+static void weld_partitions(weld_spill* spill, uint32_t block_size)
+{
+	std::vector<TOS_vertex> block(block_size);
+	for(spill_partition& partition : spill->partitions)
+	{
+		if(partition.points == nullptr)
+			continue;
+		rewind_spill(partition.points);
+		partition.locals = open_spill_file();
+
+		std::vector<TOS_vertex> vertices;
+		TOS_vertex_table table;
+		TOS_create_vertex_table(&table, block_size);
+		size_t read;
+		while((read = fread(block.data(), sizeof(TOS_vertex), block_size, partition.points)) > 0)
+		{
+			for(size_t i = 0; i < read; i++)
+			{
+				uint32_t local = TOS_weld_vertex(&table, &vertices, block[i]);
+				write_spill(partition.locals, &local, sizeof(local), 1);
+			}
+		}
+		if(ferror(partition.points))
+			throw std::runtime_error("TOS_stream_mesh: failed to read spill file");
+
+		close_spill_file(&partition.points);
+		partition.points = open_spill_file();
+		write_spill(partition.points, vertices.data(), sizeof(TOS_vertex), vertices.size());
+		partition.unique_count = (uint32_t) vertices.size();
+	}
 }
 
-void create_index_buffer(TOS_device* device, TOS_mesh* mesh)
+// Numbers the spilled unique vertices in the order the route first reaches
+// them, which is the order an in-memory weld would have appended them in,
+// and emits them after the resident ones
+static void number_spilled_vertices(TOS_mesh_stream* stream, weld_spill* spill, std::vector<TOS_vertex>* vertex_block, uint32_t block_size)
 {
-	VkDeviceSize buffer_size = sizeof(uint32_t) * mesh->indices.size();
-	
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_memory;
-	TOS_create_buffer
+	rewind_spill(spill->route);
+	for(spill_partition& partition : spill->partitions)
+	{
+		if(partition.points == nullptr)
+			continue;
+		rewind_spill(partition.points);
+		rewind_spill(partition.locals);
+		partition.globals = open_spill_file();
+	}
+
+	uint8_t p;
+	while(fread(&p, sizeof(p), 1, spill->route) == 1)
+	{
+		if(p == ROUTE_RESIDENT)
+			continue;
+		spill_partition& partition = spill->partitions[p];
+		uint32_t local;
+		read_spill(partition.locals, &local, sizeof(local), 1);
+		if(local != partition.seen_count)
+			continue;
+
+		TOS_vertex vertex;
+		read_spill(partition.points, &vertex, sizeof(vertex), 1);
+		write_spill(partition.globals, &stream->vertex_count, sizeof(uint32_t), 1);
+		partition.seen_count++;
+		stream->vertex_count++;
+		vertex_block->push_back(vertex);
+		if(vertex_block->size() == block_size)
+		{
+			stream->emit_vertices(vertex_block->data(), block_size);
+			vertex_block->clear();
+		}
+	}
+	if(ferror(spill->route))
+		throw std::runtime_error("TOS_stream_mesh: failed to read spill file");
+}
+
+// Rewrites each partition's local indices as final ones, one partition's
+// index map in memory at a time
+static void resolve_partitions(weld_spill* spill, uint32_t block_size)
+{
+	std::vector<uint32_t> block(block_size);
+	for(spill_partition& partition : spill->partitions)
+	{
+		if(partition.points == nullptr)
+			continue;
+		close_spill_file(&partition.points);
+		std::vector<uint32_t> globals(partition.unique_count);
+		rewind_spill(partition.globals);
+		read_spill(partition.globals, globals.data(), sizeof(uint32_t), globals.size());
+		close_spill_file(&partition.globals);
+
+		rewind_spill(partition.locals);
+		partition.points = open_spill_file();
+		size_t read;
+		while((read = fread(block.data(), sizeof(uint32_t), block_size, partition.locals)) > 0)
+		{
+			for(size_t i = 0; i < read; i++)
+				block[i] = globals[block[i]];
+			write_spill(partition.points, block.data(), sizeof(uint32_t), read);
+		}
+		if(ferror(partition.locals))
+			throw std::runtime_error("TOS_stream_mesh: failed to read spill file");
+		close_spill_file(&partition.locals);
+		rewind_spill(partition.points);
+	}
+}
+
+// Emits the indices of the routed points in their original order
+static void emit_spilled_indices(TOS_mesh_stream* stream, weld_spill* spill, std::vector<uint32_t>* index_block, uint32_t block_size)
+{
+	rewind_spill(spill->route);
+	rewind_spill(spill->resident);
+	uint8_t p;
+	while(fread(&p, sizeof(p), 1, spill->route) == 1)
+	{
+		uint32_t index;
+		read_spill(p == ROUTE_RESIDENT ? spill->resident : spill->partitions[p].points, &index, sizeof(index), 1);
+		index_block->push_back(index);
+		if(index_block->size() == block_size)
+		{
+			stream->emit_indices(index_block->data(), block_size);
+			index_block->clear();
+		}
+	}
+	if(ferror(spill->route))
+		throw std::runtime_error("TOS_stream_mesh: failed to read spill file");
+}
+
+void TOS_stream_mesh(TOS_mesh_stream* stream, const char* path)
+{
+	uint32_t block_size = TOS_max(stream->block_size, 3u);
+	std::vector<TOS_vertex> vertex_block;
+	std::vector<uint32_t> index_block;
+	vertex_block.reserve(block_size);
+	index_block.reserve(block_size);
+
+	// The resident table keeps every vertex it holds for comparison, along
+	// with up to four slots each once it has grown
+	size_t resident_limit = TOS_max(stream->weld_budget / (sizeof(TOS_vertex) + 4 * sizeof(TOS_vertex_table_slot)), (size_t) 1);
+	std::vector<TOS_vertex> resident;
+	TOS_vertex_table table;
+	TOS_create_vertex_table(&table, TOS_min(resident_limit, (size_t) block_size));
+	weld_spill spill {};
+
+	stream->vertex_count = 0;
+	stream->index_count = 0;
+	stream->min = glm::vec3(INFINITY, INFINITY, INFINITY);
+	stream->max = -stream->min;
+
+	// Points go through the resident table until it is full. After that,
+	// points it already holds still resolve there, and the rest are spilled
+	// by hash so that equal vertices always meet in the same partition.
+	auto weld_point = [&](const TOS_vertex& vertex)
+	{
+		stream->index_count++;
+		if(spill.route == nullptr)
+		{
+			uint32_t index = TOS_weld_vertex(&table, &resident, vertex);
+			if(index == stream->vertex_count)
+			{
+				stream->min = glm::min(stream->min, vertex.position);
+				stream->max = glm::max(stream->max, vertex.position);
+				vertex_block.push_back(vertex);
+				stream->vertex_count++;
+				if(vertex_block.size() == block_size)
+				{
+					stream->emit_vertices(vertex_block.data(), block_size);
+					vertex_block.clear();
+				}
+			}
+			index_block.push_back(index);
+			if(index_block.size() == block_size)
+			{
+				stream->emit_indices(index_block.data(), block_size);
+				index_block.clear();
+			}
+			if(resident.size() >= resident_limit)
+			{
+				spill.route = open_spill_file();
+				spill.resident = open_spill_file();
+			}
+			return;
+		}
+
+		uint32_t hash = TOS_hash_vertex(vertex);
+		size_t i = hash & table.mask;
+		while(table.slots[i].index != TOS_VERTEX_TABLE_EMPTY)
+		{
+			TOS_vertex_table_slot slot = table.slots[i];
+			if(slot.hash == hash && resident[slot.index] == vertex)
+			{
+				uint8_t p = ROUTE_RESIDENT;
+				write_spill(spill.route, &p, sizeof(p), 1);
+				write_spill(spill.resident, &slot.index, sizeof(slot.index), 1);
+				return;
+			}
+			i = (i+1) & table.mask;
+		}
+
+		stream->min = glm::min(stream->min, vertex.position);
+		stream->max = glm::max(stream->max, vertex.position);
+		uint8_t p = (uint8_t) (hash >> (32 - SPILL_PARTITION_BITS));
+		spill_partition& partition = spill.partitions[p];
+		if(partition.points == nullptr)
+			partition.points = open_spill_file();
+		write_spill(spill.route, &p, sizeof(p), 1);
+		write_spill(partition.points, &vertex, sizeof(vertex), 1);
+	};
+
+	try
+	{
+		TOS_OBJ obj;
+		TOS_OBJ_stream
+		(
+			&obj, path,
+			[&](const int* face)
+			{
+				for(int pt_idx = 0; pt_idx < 9; pt_idx += 3)
+					weld_point(make_vertex(&obj, &face[pt_idx]));
+			}
+		);
+
+		if(index_block.size() > 0)
+		{
+			stream->emit_indices(index_block.data(), (uint32_t) index_block.size());
+			index_block.clear();
+		}
+		if(spill.route != nullptr)
+		{
+			std::cout << "TOS_stream_mesh: " << path << " outgrew the weld budget after "
+			<< resident.size() << " vertices, spilling the rest" << std::endl;
+			// The resident vertices are only needed for comparison, which is over
+			resident = {};
+			table = {};
+			weld_partitions(&spill, block_size);
+			number_spilled_vertices(stream, &spill, &vertex_block, block_size);
+			resolve_partitions(&spill, block_size);
+			emit_spilled_indices(stream, &spill, &index_block, block_size);
+		}
+		close_weld_spill(&spill);
+	}
+	catch(...)
+	{
+		close_weld_spill(&spill);
+		throw;
+	}
+
+	if(vertex_block.size() > 0)
+		stream->emit_vertices(vertex_block.data(), (uint32_t) vertex_block.size());
+	if(index_block.size() > 0)
+		stream->emit_indices(index_block.data(), (uint32_t) index_block.size());
+}
+
+void TOS_import_mesh_data(const char* data, size_t size, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices)
+{
+	TOS_OBJ_counts counts;
+	TOS_OBJ_count(&counts, data, size);
+
+	TOS_OBJ obj;
+	obj.v.reserve(counts.v * 3);
+	obj.vt.reserve(counts.vt * 2);
+	obj.vn.reserve(counts.vn * 3);
+	// Most points are shared between faces, so the position count is a
+	// closer guess at the unique vertex count than the point count
+	vertices->clear();
+	vertices->reserve(counts.v);
+	indices->clear();
+	indices->reserve(counts.f * 3);
+	TOS_vertex_table table;
+	TOS_create_vertex_table(&table, counts.v);
+
+	// The parser only reads the text, read-only mappings included
+	TOS_OBJ_parse
 	(
-		device, buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer,
-		staging_memory
+		&obj, (char*) data, size,
+		[&](const int* face)
+		{
+			for(int pt_idx = 0; pt_idx < 9; pt_idx += 3)
+				indices->push_back(TOS_weld_vertex(&table, vertices, make_vertex(&obj, &face[pt_idx])));
+		}
 	);
-	
-	void* data;
-	vkMapMemory(device->logical, staging_memory, 0, buffer_size, 0, &data);
-	memcpy(data, mesh->indices.data(), buffer_size);
-	vkUnmapMemory(device->logical, staging_memory);
-	
-	TOS_create_buffer
+}
+
+void TOS_import_mesh(const char* path, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices)
+{
+	size_t file_size;
+	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_READ, &file_size, TOS_FILE_MAP_SEQUENTIAL | TOS_FILE_MAP_WILLNEED);
+	TOS_import_mesh_data(file_data, file_size, vertices, indices);
+	TOS_unmap_file(file_data, file_size);
+}
+
+void TOS_import_mesh_sorted(const char* path, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices, int thread_count)
+{
+	if(thread_count <= 0)
+		thread_count = TOS_get_thread_count();
+
+	TOS_OBJ obj;
+	TOS_OBJ_load_parallel(&obj, path, thread_count);
+
+	TOS_weld_result weld;
+	if(!TOS_weld_triples(obj.f.data(), obj.f.size() / 3, &weld, thread_count))
+	{
+		std::cerr << "TOS_import_mesh_sorted: indices of " << path << " too wide to sort, welding by hash" << std::endl;
+		TOS_import_mesh(path, vertices, indices);
+		return;
+	}
+
+	vertices->resize(weld.sources.size());
+	size_t block_count = TOS_max(vertices->size() / 4096, (size_t) 1);
+	TOS_parallel_for
 	(
-		device, buffer_size,
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		mesh->index_buffer,
-		mesh->index_memory
+		block_count,
+		[&](size_t b)
+		{
+			size_t start = vertices->size() * b / block_count;
+			size_t end = vertices->size() * (b+1) / block_count;
+			for(size_t i = start; i < end; i++)
+				(*vertices)[i] = make_vertex(&obj, &obj.f[(size_t) weld.sources[i] * 3]);
+		},
+		thread_count
 	);
-	
-	TOS_copy_buffer(device, staging_buffer, mesh->index_buffer, buffer_size);
-	vkFreeMemory(device->logical, staging_memory, nullptr);
-	vkDestroyBuffer(device->logical, staging_buffer, nullptr);
+	*indices = std::move(weld.remap);
 }
 
-void TOS_create_mesh(TOS_device* device, TOS_mesh* mesh, std::vector<TOS_vertex> vertices, std::vector<uint32_t> indices)
+static void print_upload(const char* path, const TOS_mesh* mesh, uint32_t source_vertex_count, const TOS_quantization_error* error)
 {
-	mesh->vertices = vertices;
-	mesh->indices = indices;
-	create_vertex_buffer(device, mesh);
-	create_index_buffer(device, mesh);
-
-	mesh->min = glm::vec3(INFINITY, INFINITY, INFINITY);
-	mesh->max = -mesh->min;
-	for(int i = 0; i < mesh->vertices.size(); i++)
+	if(mesh->vertex_format == TOS_VERTEX_FORMAT_PACKED)
+		TOS_print_quantization_error(path, error);
+	if(mesh->ranges.size() > mesh->lods.size())
 	{
-		mesh->min = glm::min(mesh->min, mesh->vertices[i].position);
-		mesh->max = glm::max(mesh->max, mesh->vertices[i].position);
+		std::cout << "TOS_split_mesh: " << path
+		<< " " << mesh->ranges.size() << " ranges, "
+		<< source_vertex_count << " -> " << mesh->vertex_count << " vertices"
+		<< std::endl;
 	}
 }
 
-void TOS_destroy_mesh(TOS_device* device, TOS_mesh* mesh)
+// Drops levels past the requested count, returning how many indices the rest use
+static uint32_t keep_lods(std::vector<TOS_lod_span>* lods, int lod_count)
 {
-	vkFreeMemory(device->logical, mesh->index_memory, nullptr);
-	vkDestroyBuffer(device->logical, mesh->index_buffer, nullptr);
-	vkFreeMemory(device->logical, mesh->vertex_memory, nullptr);
-	vkDestroyBuffer(device->logical, mesh->vertex_buffer, nullptr);
+	lods->resize(TOS_clamp((size_t) lod_count, (size_t) 1, lods->size()));
+	uint32_t used = 0;
+	for(const TOS_lod_span& lod : *lods)
+		used = TOS_max(used, lod.first_index + lod.index_count);
+	return used;
 }
 
-void TOS_load_mesh(TOS_device* device, TOS_mesh* mesh, const char* path)
+// Optimizes a freshly imported mesh and appends its levels of detail
+static void prepare_mesh(const char* path, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices, TOS_mesh_specification specification, std::vector<TOS_lod_span>* lods)
 {
-	TOS_OBJ obj;
-	TOS_OBJ_load(&obj, path);
-	
-	std::vector<TOS_vertex> vertices;
-	std::vector<uint32_t> indices;
-	std::unordered_map<TOS_vertex, uint32_t> unique;
+	TOS_optimize_mesh(vertices->data(), vertices->size(), indices->data(), indices->size());
+	TOS_build_lod_chain(vertices->data(), vertices->size(), indices, specification.lod_count, specification.lod_ratio, lods);
+	if(lods->size() > 1)
+		TOS_print_lod_chain(path, lods->data(), lods->size());
+}
 
-	for(int f_idx = 0; f_idx < obj.f.size(); f_idx += 9)
+static bool write_mesh_cache
+(
+	const char* cache_path, const char* path,
+	const std::vector<TOS_vertex>& vertices, const std::vector<uint32_t>& indices,
+	glm::vec3 min, glm::vec3 max,
+	const std::vector<TOS_lod_span>& lods, TOS_mesh_specification specification
+)
+{
+	return TOS_write_mesh_file
+	(
+		cache_path, path,
+		vertices.data(), (uint32_t) vertices.size(),
+		indices.data(), (uint32_t) indices.size(),
+		min, max,
+		lods.size() > 1 ? lods.data() : nullptr, lods.size() > 1 ? (uint32_t) lods.size() : 0,
+		(uint32_t) TOS_clamp(specification.lod_count, 1, TOS_LOD_MAX_COUNT), specification.lod_ratio
+	);
+}
+
+void TOS_load_mesh(TOS_device* device, TOS_mesh* mesh, const char* path, TOS_mesh_specification specification)
+{
+	TOS_weld_mode mode = specification.weld_mode;
+	std::string cache_path = std::string(path) + TOS_MESH_FILE_EXTENSION;
+	TOS_mesh_file file;
+	bool cached =
+	TOS_open_mesh_file(&file, cache_path.c_str(), path) ||
+	(
+		mode == TOS_WELD_STREAM &&
+		TOS_import_mesh_file(cache_path.c_str(), path) &&
+		TOS_open_mesh_file(&file, cache_path.c_str(), path)
+	);
+	TOS_quantization_error error;
+	std::vector<TOS_lod_span> lods;
+	if(cached)
 	{
-		for(int pt_idx = 0; pt_idx < 9; pt_idx += 3)
-		{
-			int v_idx = (obj.f[f_idx+pt_idx+0]-1)*3;
-			int vt_idx = (obj.f[f_idx+pt_idx+1]-1)*2;
-			int vn_idx = (obj.f[f_idx+pt_idx+2]-1)*3;
+		mesh->min = glm::vec3(file.header->min[0], file.header->min[1], file.header->min[2]);
+		mesh->max = glm::vec3(file.header->max[0], file.header->max[1], file.header->max[2]);
+		uint32_t vertex_count = file.header->vertex_count;
+		const uint32_t* indices = file.indices;
+		uint32_t index_count = file.header->index_count;
+		if(file.header->lod_count > 0)
+			lods.assign(file.lods, file.lods + file.header->lod_count);
+		else
+			lods.push_back({0, index_count, 0.0f});
 
-			glm::vec3 v
+		// Levels are simplified once and written back into the cache. A
+		// chain built for fewer levels or with another ratio is rebuilt from
+		// the full detail level; a longer one is trimmed by keep_lods.
+		std::vector<uint32_t> lod_indices;
+		uint32_t lod_request = (uint32_t) TOS_clamp(specification.lod_count, 1, TOS_LOD_MAX_COUNT);
+		bool stale_lods =
+		lod_request > 1 &&
+		(file.header->lod_request < lod_request || file.header->lod_ratio != specification.lod_ratio);
+		if(stale_lods)
+		{
+			lod_indices.assign(indices + lods[0].first_index, indices + lods[0].first_index + lods[0].index_count);
+			TOS_build_lod_chain(file.vertices, vertex_count, &lod_indices, specification.lod_count, specification.lod_ratio, &lods);
+			indices = lod_indices.data();
+			index_count = (uint32_t) lod_indices.size();
+			bool written = TOS_write_mesh_file
 			(
-				obj.v[v_idx+0],
-				obj.v[v_idx+1],
-				obj.v[v_idx+2]
+				cache_path.c_str(), path,
+				file.vertices, vertex_count,
+				indices, index_count,
+				mesh->min, mesh->max,
+				lods.data(), (uint32_t) lods.size(),
+				lod_request, specification.lod_ratio
 			);
+			if(!written)
+				std::cerr << "TOS_load_mesh: could not cache levels of detail of " << path << std::endl;
+		}
+		index_count = keep_lods(&lods, specification.lod_count);
+		if(lods.size() > 1)
+			TOS_print_lod_chain(path, lods.data(), lods.size());
+
+		upload_mesh
+		(
+			device, mesh,
+			file.vertices, vertex_count,
+			indices, index_count,
+			lods.data(), (uint32_t) lods.size(),
+			specification, &error
+		);
+		print_upload(path, mesh, vertex_count, &error);
+		TOS_close_mesh_file(&file);
+		return;
+	}
+	if(mode == TOS_WELD_STREAM)
+		std::cerr << "TOS_load_mesh: could not cache " << path << ", importing in memory" << std::endl;
 
-			glm::vec2 vt = vt_idx >= 0 ?
-			glm::vec2(
-				obj.vt[vt_idx+0],
-				1.0f - obj.vt[vt_idx+1]
-			) : glm::vec2(0);
+	std::vector<TOS_vertex> vertices;
+	std::vector<uint32_t> indices;
+	if(mode == TOS_WELD_SORT)
+		TOS_import_mesh_sorted(path, &vertices, &indices);
+	else
+		TOS_import_mesh(path, &vertices, &indices);
+	prepare_mesh(path, &vertices, &indices, specification, &lods);
 
-			glm::vec3 vn = vn_idx >= 0 ?
-			glm::vec3(
-				obj.vn[vn_idx+0],
-				obj.vn[vn_idx+1],
-				obj.vn[vn_idx+2]
-			) : glm::vec3(0);
+	compute_bounds(vertices.data(), (uint32_t) vertices.size(), &mesh->min, &mesh->max);
+	upload_mesh
+	(
+		device, mesh,
+		vertices.data(), (uint32_t) vertices.size(),
+		indices.data(), (uint32_t) indices.size(),
+		lods.data(), (uint32_t) lods.size(),
+		specification, &error
+	);
+	print_upload(path, mesh, (uint32_t) vertices.size(), &error);
 
-			TOS_vertex vertex =
-			{
-				.position = v,
-				.uv = vt,
-				.normal = vn
-			};
-			
-			if(unique.count(vertex) == 0)
-			{
-				unique[vertex] = (uint32_t) vertices.size();
-				vertices.push_back(vertex);
-			}
-			indices.push_back(unique[vertex]);
+	bool written =
+	mode == TOS_WELD_STREAM ||
+	write_mesh_cache(cache_path.c_str(), path, vertices, indices, mesh->min, mesh->max, lods, specification);
+	if(!written)
+		std::cerr << "TOS_load_mesh: could not cache " << path << std::endl;
+}
+
+void TOS_load_meshes(TOS_device* device, const std::vector<TOS_mesh_request>& requests, int thread_count)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::string> stale_paths;
+	std::vector<size_t> stale;
+	for(size_t i = 0; i < requests.size(); i++)
+	{
+		const TOS_mesh_request& request = requests[i];
+		std::string cache_path = std::string(request.path) + TOS_MESH_FILE_EXTENSION;
+		TOS_mesh_file file;
+		if(TOS_open_mesh_file(&file, cache_path.c_str(), request.path))
+		{
+			TOS_close_mesh_file(&file);
+			continue;
+		}
+		// Sorted welds thread themselves, and sources past a stream window
+		// are left to the streamed import so that they are never held whole
+		struct stat info;
+		bool batched =
+		request.specification.weld_mode != TOS_WELD_SORT &&
+		stat(request.path, &info) == 0 && info.st_size <= TOS_OBJ_STREAM_WINDOW;
+		if(batched)
+		{
+			stale_paths.push_back(request.path);
+			stale.push_back(i);
 		}
 	}
 
-	TOS_create_mesh(device, mesh, vertices, indices);
+	// Every batched source is parsed, welded, optimized and simplified on
+	// a worker as soon as its read lands, and its cache written there
+	TOS_read_backend backend = TOS_READ_BACKEND_THREADS;
+	if(!stale.empty())
+	{
+		backend = TOS_read_files
+		(
+			stale_paths,
+			[&](size_t s, const uint8_t* data, size_t size)
+			{
+				const TOS_mesh_request& request = requests[stale[s]];
+				std::vector<TOS_vertex> vertices;
+				std::vector<uint32_t> indices;
+				std::vector<TOS_lod_span> lods;
+				TOS_import_mesh_data((const char*) data, size, &vertices, &indices);
+				prepare_mesh(request.path, &vertices, &indices, request.specification, &lods);
+				glm::vec3 min, max;
+				compute_bounds(vertices.data(), (uint32_t) vertices.size(), &min, &max);
+				std::string cache_path = std::string(request.path) + TOS_MESH_FILE_EXTENSION;
+				if(!write_mesh_cache(cache_path.c_str(), request.path, vertices, indices, min, max, lods, request.specification))
+					TOS_print_line(std::cerr, std::string("TOS_load_meshes: could not cache ") + request.path);
+			},
+			thread_count
+		);
+	}
+	auto imported = std::chrono::steady_clock::now();
+
+	for(const TOS_mesh_request& request : requests)
+		TOS_load_mesh(device, request.mesh, request.path, request.specification);
+	auto uploaded = std::chrono::steady_clock::now();
+
+	std::cout << "TOS_load_meshes: " << requests.size() << " meshes, " << stale.size() << " imported";
+	if(!stale.empty())
+		std::cout << " through " << TOS_get_read_backend_name(backend);
+	std::cout << ", " << std::chrono::duration<double, std::milli>(imported - start).count() << " ms importing, "
+	<< std::chrono::duration<double, std::milli>(uploaded - imported).count() << " ms loading" << std::endl;
 }
 
 void TOS_AABB_mesh(TOS_device* device, TOS_mesh* mesh, glm::vec3 min, glm::vec3 max)
 {
 	std::vector<TOS_vertex> vertices;
 	std::vector<uint32_t> indices;
-	std::unordered_map<TOS_vertex, uint32_t> unique;
+	TOS_vertex_table table;
+	TOS_create_vertex_table(&table, 24);
 
 	glm::vec3 positions[8] =
 	{
@@ -271,12 +1037,7 @@ void TOS_AABB_mesh(TOS_device* device, TOS_mesh* mesh, glm::vec3 min, glm::vec3
 			.position = positions[pos_idx],
 			.uv = uvs[uv_idx]
 		};
-		if(unique.count(vertex) == 0)
-		{
-			unique[vertex] = (uint32_t) vertices.size();
-			vertices.push_back(vertex);
-		}
-		indices.push_back(unique[vertex]);
+		indices.push_back(TOS_weld_vertex(&table, &vertices, vertex));
 	}
 
 	TOS_create_mesh(device, mesh, vertices, indices);
@@ -286,7 +1047,8 @@ void TOS_screen_mesh(TOS_device* device, TOS_mesh* mesh)
 {
 	std::vector<TOS_vertex> vertices;
 	std::vector<uint32_t> indices;
-	std::unordered_map<TOS_vertex, uint32_t> unique;
+	TOS_vertex_table table;
+	TOS_create_vertex_table(&table, 4);
 
 	glm::vec3 positions[4] =
 	{
@@ -324,13 +1086,106 @@ void TOS_screen_mesh(TOS_device* device, TOS_mesh* mesh)
 			.position = positions[pos_idx],
 			.uv = uvs[uv_idx]
 		};
-		if(unique.count(vertex) == 0)
-		{
-			unique[vertex] = (uint32_t) vertices.size();
-			vertices.push_back(vertex);
-		}
-		indices.push_back(unique[vertex]);
+		indices.push_back(TOS_weld_vertex(&table, &vertices, vertex));
 	}
 
 	TOS_create_mesh(device, mesh, vertices, indices);
-}
\ No newline at end of file
+}
+
+void TOS_benchmark_welding(const char* path)
+{
+	TOS_OBJ obj;
+	TOS_OBJ_load_parallel(&obj, path);
+	std::vector<TOS_vertex> points;
+	points.reserve(obj.f.size() / 3);
+	for(size_t i = 0; i < obj.f.size(); i += 3)
+		points.push_back(make_vertex(&obj, &obj.f[i]));
+	if(points.empty())
+	{
+		std::cout << "TOS_benchmark_welding: no faces in " << path << std::endl;
+		return;
+	}
+
+	// The hash std::hash<TOS_vertex> used before, which ignored normals
+	struct legacy_hash
+	{
+		size_t operator()(const TOS_vertex& vertex) const
+		{
+			return std::hash<glm::vec3>()(vertex.position) ^ std::hash<glm::vec2>()(vertex.uv);
+		}
+	};
+
+	std::vector<uint32_t> reference;
+	auto run_legacy = [&](std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices)
+	{
+		std::unordered_map<TOS_vertex, uint32_t, legacy_hash> unique;
+		for(const TOS_vertex& vertex : points)
+		{
+			if(unique.count(vertex) == 0)
+			{
+				unique[vertex] = (uint32_t) vertices->size();
+				vertices->push_back(vertex);
+			}
+			indices->push_back(unique[vertex]);
+		}
+	};
+	auto run_map = [&](std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices)
+	{
+		std::unordered_map<TOS_vertex, uint32_t> unique;
+		for(const TOS_vertex& vertex : points)
+		{
+			auto [entry, inserted] = unique.try_emplace(vertex, (uint32_t) vertices->size());
+			if(inserted)
+				vertices->push_back(vertex);
+			indices->push_back(entry->second);
+		}
+	};
+	auto run_table = [&](std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices)
+	{
+		TOS_vertex_table table;
+		TOS_create_vertex_table(&table, 16);
+		for(const TOS_vertex& vertex : points)
+			indices->push_back(TOS_weld_vertex(&table, vertices, vertex));
+	};
+
+	auto measure = [&](const char* name, auto run)
+	{
+		std::vector<TOS_vertex> vertices;
+		std::vector<uint32_t> indices;
+		indices.reserve(points.size());
+		auto start = std::chrono::high_resolution_clock::now();
+		run(&vertices, &indices);
+		double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		if(reference.empty())
+			reference = indices;
+		std::cout << "\t" << name << elapsed * 1000.0 << " ms, "
+		<< points.size() / elapsed / 1e6 << " M points/s, "
+		<< vertices.size() << " vertices"
+		<< (indices == reference ? "" : " (MISMATCH)") << "\n";
+		return elapsed;
+	};
+
+	std::cout << "TOS_benchmark_welding: " << path << ", " << points.size() << " points\n";
+	double legacy = measure("unordered_map, old hash: ", run_legacy);
+	measure("unordered_map, new hash: ", run_map);
+	double table = measure("TOS_vertex_table:        ", run_table);
+	std::cout << "\tspeedup over old map:    " << legacy / table << "x" << std::endl;
+}
+
+void TOS_benchmark_vertex_cache(const char* path)
+{
+	std::vector<TOS_vertex> vertices;
+	std::vector<uint32_t> indices;
+	TOS_import_mesh(path, &vertices, &indices);
+
+	TOS_mesh_optimization_report report;
+	report.before = TOS_simulate_vertex_cache(indices.data(), indices.size(), vertices.size());
+	auto start = std::chrono::high_resolution_clock::now();
+	TOS_optimize_mesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+	double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	report.after = TOS_simulate_vertex_cache(indices.data(), indices.size(), vertices.size());
+
+	TOS_print_optimization_report(path, &report);
+	std::cout << "TOS_benchmark_vertex_cache: " << indices.size() / 3 << " triangles, " << vertices.size() << " vertices in "
+	<< elapsed * 1000.0 << " ms" << std::endl;
+}
@@ -4,6 +4,11 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 #include "device.h"
+#include "shader_common.h"
+#include "geometry.h"
+#include "arena.h"
+#include <functional>
+#include <vector>
 
 struct TOS_vertex
 {
@@ -15,38 +20,218 @@ struct TOS_vertex
 	bool operator==(const TOS_vertex& other) const;
 };
 
+// Mixes every field, with -0.0 and 0.0 hashing alike since they compare equal
+uint32_t TOS_hash_vertex(const TOS_vertex& vertex);
+
 namespace std
 {
 	template<> struct hash<TOS_vertex>
 	{
 		size_t operator()(TOS_vertex const& vertex) const
 		{
-			return
-			(hash<glm::vec3>()(vertex.position)) ^
-			(hash<glm::vec2>()(vertex.uv));
+			return TOS_hash_vertex(vertex);
 		}
 	};
 }
 
-VkVertexInputBindingDescription TOS_get_vertex_binding_description();
-std::vector<VkVertexInputAttributeDescription> TOS_get_vertex_attribute_descriptions();
+#define TOS_VERTEX_TABLE_EMPTY UINT32_MAX
 
-struct TOS_mesh
+struct TOS_vertex_table_slot
+{
+	uint32_t hash;
+	uint32_t index;
+};
+
+// Flat open-addressing map from vertex value to its index in a vertex array.
+// Slots hold the hash and index only; keys are compared in the array itself.
+struct TOS_vertex_table
+{
+	std::vector<TOS_vertex_table_slot> slots;
+	size_t mask;
+	size_t count;
+};
+
+void TOS_create_vertex_table(TOS_vertex_table* table, size_t expected_count);
+// Returns the index of vertex in vertices, appending it if no equal vertex is there yet
+uint32_t TOS_weld_vertex(TOS_vertex_table* table, std::vector<TOS_vertex>* vertices, const TOS_vertex& vertex);
+// Times TOS_vertex_table against std::unordered_map welding every face point of an OBJ
+void TOS_benchmark_welding(const char* path);
+// Times TOS_optimize_mesh on an OBJ and prints its vertex cache before and after
+void TOS_benchmark_vertex_cache(const char* path);
+
+enum TOS_vertex_format
+{
+	// TOS_vertex as is, 36 bytes
+	TOS_VERTEX_FORMAT_STANDARD,
+	// TOS_packed_vertex, 16 bytes, decoded by packed.vert
+	TOS_VERTEX_FORMAT_PACKED
+};
+
+// Position as unorm16 within the mesh bounds, uv as half floats and the
+// normal octahedral-encoded as snorm16. The top bit of material marks a
+// vertex without a normal, which the fragment shader leaves unlit.
+struct TOS_packed_vertex
+{
+	uint16_t position[3];
+	uint16_t material;
+	uint16_t uv[2];
+	int16_t normal[2];
+};
+
+VkVertexInputBindingDescription TOS_get_vertex_binding_description(TOS_vertex_format format=TOS_VERTEX_FORMAT_STANDARD);
+std::vector<VkVertexInputAttributeDescription> TOS_get_vertex_attribute_descriptions(TOS_vertex_format format=TOS_VERTEX_FORMAT_STANDARD);
+
+// Largest vertex count whose indices all fit 16 bits
+#define TOS_INDEX16_VERTEX_LIMIT 65536
+
+// A span of a mesh's index buffer drawn with its own vertex offset
+struct TOS_mesh_range
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	int32_t vertex_offset;
+};
+
+// One level of detail as a span of a mesh's index list before splitting,
+// with its geometric error in mesh units
+struct TOS_lod_span
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	float error;
+};
+
+// One level of detail of an uploaded mesh, as a run of the mesh's ranges
+struct TOS_mesh_lod
 {
-	std::vector<TOS_vertex> vertices;
-	VkBuffer vertex_buffer = VK_NULL_HANDLE;
-	VkDeviceMemory vertex_memory = VK_NULL_HANDLE;
+	uint32_t first_range;
+	uint32_t range_count;
+	uint32_t index_count;
+	float error;
+};
+
+// A cluster of a mesh's triangles with bounds for culling, see meshlets.h
+struct TOS_meshlet
+{
+	TOS_mesh_range range;
+	TOS_sphere sphere;
+	TOS_AABB aabb;
+	// Every triangle faces away from a viewer within the cone around
+	// -cone_axis; cone_cutoff is 1 or more when the normals spread too far
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
 
-	std::vector<uint32_t> indices;
-	VkBuffer index_buffer = VK_NULL_HANDLE;
-	VkDeviceMemory index_memory = VK_NULL_HANDLE;
+struct TOS_mesh
+{
+	TOS_vertex_format vertex_format = TOS_VERTEX_FORMAT_STANDARD;
+	uint32_t vertex_count = 0;
+	uint32_t index_count = 0;
+	VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+	// Blocks of the geometry arena, with their positions in vertices and
+	// indices of the mesh's own format, which draws add to every range
+	TOS_geometry_allocation vertex_allocation;
+	TOS_geometry_allocation index_allocation;
+	int32_t base_vertex = 0;
+	uint32_t first_index = 0;
+	// Index spans of every level of detail, one per level unless the mesh
+	// was split for 16-bit indices
+	std::vector<TOS_mesh_range> ranges;
+	// Levels of detail from full detail down, always at least one
+	std::vector<TOS_mesh_lod> lods;
+	// Clusters covering the full detail level, in index order
+	std::vector<TOS_meshlet> meshlets;
 
 	glm::vec3 min;
 	glm::vec3 max;
+	// Mesh-space length one unit of UV covers on average over the full
+	// detail level, which sizes textures on screen for streaming
+	float texture_span = 0.0f;
 };
 
-void TOS_create_mesh(TOS_device* device, TOS_mesh* mesh, std::vector<TOS_vertex> vertices, std::vector<uint32_t> indices);
+void TOS_create_mesh(TOS_device* device, TOS_mesh* mesh, const std::vector<TOS_vertex>& vertices, const std::vector<uint32_t>& indices, TOS_vertex_format format=TOS_VERTEX_FORMAT_STANDARD);
+void TOS_create_mesh(TOS_device* device, TOS_mesh* mesh, const TOS_vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, TOS_vertex_format format=TOS_VERTEX_FORMAT_STANDARD);
 void TOS_destroy_mesh(TOS_device* device, TOS_mesh* mesh);
-void TOS_load_mesh(TOS_device* device, TOS_mesh* mesh, const char* path);
+enum TOS_weld_mode
+{
+	// Streams the import into the cache through fixed-size blocks,
+	// welding equal vertex values with a bounded TOS_vertex_table
+	TOS_WELD_STREAM,
+	// Welds equal vertex values in memory with a TOS_vertex_table
+	TOS_WELD_HASH,
+	// Welds equal v/vt/vn index triples in memory with a parallel radix sort
+	TOS_WELD_SORT
+};
+
+struct TOS_mesh_specification
+{
+	TOS_weld_mode weld_mode = TOS_WELD_STREAM;
+	TOS_vertex_format vertex_format = TOS_VERTEX_FORMAT_STANDARD;
+	// Splits meshes past TOS_INDEX16_VERTEX_LIMIT vertices into ranges
+	// so they can still use 16-bit indices
+	bool split_indices = false;
+	// Partitions the mesh into meshlets for TOS_cull_meshlets
+	bool build_meshlets = false;
+	// Levels of detail including the full mesh, see simplify.h. Levels are
+	// simplified on first load and kept in the cache from then on.
+	int lod_count = 1;
+	float lod_ratio = 0.5f;
+};
+
+// Loads from the binary cache beside path when it is current,
+// otherwise imports the OBJ with the given weld mode and caches the result.
+// The cache always holds TOS_vertex and 32-bit indices; packing and
+// splitting happen on upload.
+void TOS_load_mesh(TOS_device* device, TOS_mesh* mesh, const char* path, TOS_mesh_specification specification={});
+
+struct TOS_mesh_request
+{
+	TOS_mesh* mesh;
+	const char* path;
+	TOS_mesh_specification specification = {};
+};
+
+// Loads each request as TOS_load_mesh does. Sources with stale caches are
+// read through TOS_read_files and imported on its workers, which weld them
+// by value and write their caches, so parsing one overlaps reading the
+// rest. Sorted welds and sources larger than a stream window are left to
+// TOS_load_mesh. Only the uploads run on the calling thread.
+void TOS_load_meshes(TOS_device* device, const std::vector<TOS_mesh_request>& requests, int thread_count=0);
+#define TOS_MESH_STREAM_BLOCK_SIZE 65536
+#define TOS_MESH_STREAM_WELD_BUDGET (256ull << 20)
+
+// Receives an OBJ import in fixed-size blocks as they fill, so neither the
+// vertex nor the index array is ever held whole. Points are welded by value
+// as TOS_import_mesh welds them, and come out numbered the same way.
+// Welding goes through a TOS_vertex_table of at most weld_budget bytes; once
+// it is full, new vertices are spilled to temporary files split by hash
+// and welded one split at a time after parsing. The OBJ's positions, texture
+// coordinates and normals are still held whole, since faces may refer back
+// to any of them.
+struct TOS_mesh_stream
+{
+	std::function<void(const TOS_vertex* vertices, uint32_t count)> emit_vertices;
+	std::function<void(const uint32_t* indices, uint32_t count)> emit_indices;
+	uint32_t block_size = TOS_MESH_STREAM_BLOCK_SIZE;
+	size_t weld_budget = TOS_MESH_STREAM_WELD_BUDGET;
+
+	uint32_t vertex_count = 0;
+	uint32_t index_count = 0;
+	glm::vec3 min;
+	glm::vec3 max;
+	// Mesh-space length one unit of UV covers on average over the full
+	// detail level, which sizes textures on screen for streaming
+	float texture_span = 0.0f;
+};
+
+void TOS_stream_mesh(TOS_mesh_stream* stream, const char* path);
+// Parses an OBJ straight into final vertex and index arrays, welded by value.
+// A counting pass sizes every array first, so none of them regrow.
+void TOS_import_mesh(const char* path, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices);
+// As TOS_import_mesh, from OBJ text already in memory such as a buffer from TOS_read_files
+void TOS_import_mesh_data(const char* data, size_t size, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices);
+// Parses an OBJ on all threads and welds it with TOS_weld_triples,
+// falling back to TOS_import_mesh when the indices are too wide to pack
+void TOS_import_mesh_sorted(const char* path, std::vector<TOS_vertex>* vertices, std::vector<uint32_t>* indices, int thread_count=0);
 void TOS_AABB_mesh(TOS_device* device, TOS_mesh* mesh, glm::vec3 min, glm::vec3 max);
 void TOS_screen_mesh(TOS_device* device, TOS_mesh* mesh);
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "weld.h"
+
+#include "threads.h"
+#include "cowtools.h"
+#include <algorithm>
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define MIN_BLOCK_SIZE (1 << 16)
+
+struct weld_entry
+{
+	uint64_t key;
+	uint32_t point;
+};
+
+struct block_range
+{
+	size_t start;
+	size_t end;
+};
+
+static int bit_width(uint32_t value)
+{
+	int bits = 0;
+	while(bits < 32 && (value >> bits) != 0)
+		bits++;
+	return bits;
+}
+
+bool TOS_weld_triples(const int* triples, size_t count, TOS_weld_result* result, int thread_count)
+{
+	if(thread_count <= 0)
+		thread_count = TOS_get_thread_count();
+	*result = {};
+	if(count == 0)
+		return true;
+
+	// Block boundaries only split the work; the sort is stable, so they never change the result
+	size_t block_count = TOS_clamp(count / MIN_BLOCK_SIZE, (size_t) 1, (size_t) thread_count * 4);
+	std::vector<block_range> blocks(block_count);
+	for(size_t b = 0; b < block_count; b++)
+		blocks[b] = {count * b / block_count, count * (b+1) / block_count};
+
+	std::vector<uint32_t> block_maxima(block_count * 3, 0);
+	TOS_parallel_for
+	(
+		block_count,
+		[&](size_t b)
+		{
+			uint32_t* maxima = &block_maxima[b * 3];
+			for(size_t i = blocks[b].start; i < blocks[b].end; i++)
+			{
+				for(int c = 0; c < 3; c++)
+					maxima[c] = TOS_max(maxima[c], (uint32_t) triples[i*3+c]);
+			}
+		},
+		thread_count
+	);
+	int widths[3] = {0, 0, 0};
+	for(size_t b = 0; b < block_count; b++)
+	{
+		for(int c = 0; c < 3; c++)
+			widths[c] = TOS_max(widths[c], bit_width(block_maxima[b*3+c]));
+	}
+	int key_bits = widths[0] + widths[1] + widths[2];
+	if(key_bits > 64)
+		return false;
+
+	std::vector<weld_entry> entries(count);
+	std::vector<weld_entry> scratch(count);
+	TOS_parallel_for
+	(
+		block_count,
+		[&](size_t b)
+		{
+			for(size_t i = blocks[b].start; i < blocks[b].end; i++)
+			{
+				uint64_t key = (uint32_t) triples[i*3+0];
+				key = widths[1] == 0 ? key : (key << widths[1]) | (uint32_t) triples[i*3+1];
+				key = widths[2] == 0 ? key : (key << widths[2]) | (uint32_t) triples[i*3+2];
+				entries[i] = {key, (uint32_t) i};
+			}
+		},
+		thread_count
+	);
+
+	// LSD radix sort, only over the bits the keys actually use. Each pass
+	// counts digits per block, lays the blocks out digit-major so equal
+	// digits keep their input order, then scatters every block in parallel.
+	std::vector<size_t> offsets(block_count * RADIX_SIZE);
+	for(int shift = 0; shift < key_bits; shift += RADIX_BITS)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		TOS_parallel_for
+		(
+			block_count,
+			[&](size_t b)
+			{
+				size_t* histogram = &offsets[b * RADIX_SIZE];
+				for(size_t i = blocks[b].start; i < blocks[b].end; i++)
+					histogram[(entries[i].key >> shift) & (RADIX_SIZE-1)]++;
+			},
+			thread_count
+		);
+
+		size_t sum = 0;
+		for(int digit = 0; digit < RADIX_SIZE; digit++)
+		{
+			for(size_t b = 0; b < block_count; b++)
+			{
+				size_t digit_count = offsets[b * RADIX_SIZE + digit];
+				offsets[b * RADIX_SIZE + digit] = sum;
+				sum += digit_count;
+			}
+		}
+
+		TOS_parallel_for
+		(
+			block_count,
+			[&](size_t b)
+			{
+				size_t* cursor = &offsets[b * RADIX_SIZE];
+				for(size_t i = blocks[b].start; i < blocks[b].end; i++)
+					scratch[cursor[(entries[i].key >> shift) & (RADIX_SIZE-1)]++] = entries[i];
+			},
+			thread_count
+		);
+		entries.swap(scratch);
+	}
+	scratch = {};
+
+	// Every run of equal keys starts a new id; count run heads per block,
+	// scan the counts, then number the runs from each block's base
+	auto is_head = [&](size_t i)
+	{
+		return i == 0 || entries[i].key != entries[i-1].key;
+	};
+	std::vector<size_t> bases(block_count + 1, 0);
+	TOS_parallel_for
+	(
+		block_count,
+		[&](size_t b)
+		{
+			size_t heads = 0;
+			for(size_t i = blocks[b].start; i < blocks[b].end; i++)
+				heads += is_head(i);
+			bases[b+1] = heads;
+		},
+		thread_count
+	);
+	for(size_t b = 0; b < block_count; b++)
+		bases[b+1] += bases[b];
+
+	result->remap.resize(count);
+	result->sources.resize(bases[block_count]);
+	TOS_parallel_for
+	(
+		block_count,
+		[&](size_t b)
+		{
+			size_t id = bases[b];
+			for(size_t i = blocks[b].start; i < blocks[b].end; i++)
+			{
+				if(is_head(i))
+					result->sources[id++] = entries[i].point;
+				result->remap[entries[i].point] = (uint32_t) (id-1);
+			}
+		},
+		thread_count
+	);
+	return true;
+}
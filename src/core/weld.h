@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Sort-based welding of OBJ face points by their v/vt/vn index triple.
+// Each triple is packed into a 64-bit key, the keys are radix sorted in
+// parallel, and unique ids are assigned to each run of equal keys with a
+// parallel scan. The sort is stable, so the result is the same for any
+// thread count.
+
+struct TOS_weld_result
+{
+	// Unique id of every point, in input order
+	std::vector<uint32_t> remap;
+	// First point carrying each unique id, in id order
+	std::vector<uint32_t> sources;
+};
+
+// Returns false when the index ranges do not fit a 64-bit key
+bool TOS_weld_triples(const int* triples, size_t count, TOS_weld_result* result, int thread_count=0);
@@ -2,6 +2,7 @@
 
 #include "glfw/glfw3.h"
 #include "pipeline.h"
+#include "upload.h"
 
 static TOS_context* context;
 static TOS_device* device;
@@ -15,6 +16,15 @@ static TOS_work_manager work_manager;
 static TOS_pipeline* pipeline;
 static uint32_t image_idx;
 static VkCommandBuffer command_buffer;
+// Arena pages bound since the last pipeline, and the type the index page is
+// bound with, since 16 and 32-bit meshes share pages but not the binding
+static uint32_t bound_vertex_page;
+static uint32_t bound_index_page;
+static VkIndexType bound_index_type;
+static TOS_lod_stats lod_stats;
+// Sets whose texture descriptors predate a texture's current sampler or
+// view, rewritten once their frame comes around again
+static bool stale_texture_descriptors[MAX_CONCURRENT_FRAMES];
 
 void TOS_create_drawing_context(TOS_context* _context, TOS_device* _device, TOS_swapchain* _swapchain)
 {
@@ -54,6 +64,12 @@ void TOS_destroy_drawing_context()
 	TOS_destroy_descriptors(device, &descriptors);
 }
 
+void TOS_invalidate_texture_descriptors()
+{
+	for(int i = 0; i < MAX_CONCURRENT_FRAMES; i++)
+		stale_texture_descriptors[i] = true;
+}
+
 void TOS_begin_frame()
 {
 	vkWaitForFences(device->logical, 1, &work_manager.frame_fences[work_manager.frame_idx], VK_TRUE, UINT64_MAX);
@@ -68,9 +84,15 @@ void TOS_begin_frame()
 		throw std::runtime_error("TOS_draw_frame: failed to acquire image from swapchain");
 	}
 	vkResetFences(device->logical, 1, &work_manager.frame_fences[work_manager.frame_idx]);
+	if(stale_texture_descriptors[work_manager.frame_idx])
+	{
+		TOS_update_image_sampler_descriptor(device, &descriptors, 1, work_manager.frame_idx, textures);
+		stale_texture_descriptors[work_manager.frame_idx] = false;
+	}
 
 	command_buffer = work_manager.render_command_buffers[work_manager.frame_idx];
 	vkResetCommandBuffer(command_buffer, 0);
+	lod_stats = {};
 
 	VkCommandBufferBeginInfo begin_info {};
 	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -134,9 +156,16 @@ void TOS_end_frame()
 	submission.commandBufferCount = 1;
 	submission.pCommandBuffers = &command_buffer;
 	
-	submission.waitSemaphoreCount = 1;
-	submission.pWaitSemaphores = &work_manager.image_semaphores[work_manager.frame_idx];
-	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+	// Uploads recorded since the last frame are submitted here, and the
+	// frame waits for them rather than the loader waiting on the queue
+	VkSemaphore wait_semaphores[] =
+	{
+		work_manager.image_semaphores[work_manager.frame_idx],
+		TOS_flush_frame_uploads(device)
+	};
+	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+	submission.waitSemaphoreCount = wait_semaphores[1] != VK_NULL_HANDLE ? 2 : 1;
+	submission.pWaitSemaphores = wait_semaphores;
 	submission.pWaitDstStageMask = wait_stages;
 	
 	submission.signalSemaphoreCount = 1;
@@ -174,6 +203,13 @@ void TOS_bind_pipeline(TOS_pipeline* _pipeline)
 {
 	pipeline = _pipeline;
 	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+
+	// Every mesh lives in the geometry arena, so descriptors are bound once
+	// per pipeline and buffers only when a draw moves to another page
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline_layout, 0, 1, &descriptors.sets[work_manager.frame_idx], 0, nullptr);
+	bound_vertex_page = UINT32_MAX;
+	bound_index_page = UINT32_MAX;
+	bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
 }
 
 void TOS_set_UBO(TOS_UBO* ubo)
@@ -200,11 +236,69 @@ void TOS_clear_depth_buffer()
 	vkCmdClearAttachments(command_buffer, 1, &depth_attachment, 1, &clear_rect);
 }
 
+void TOS_draw_mesh_ranges(TOS_mesh* mesh, const TOS_mesh_range* ranges, size_t range_count)
+{
+	if(mesh->vertex_format != pipeline->vertex_format)
+		throw std::runtime_error("TOS_draw_mesh: mesh vertex format does not match the bound pipeline");
+	if(mesh->vertex_format == TOS_VERTEX_FORMAT_PACKED)
+	{
+		glm::vec4 quantization[2] =
+		{
+			glm::vec4(mesh->min, 0),
+			glm::vec4(mesh->max - mesh->min, 0)
+		};
+		vkCmdPushConstants
+		(
+			command_buffer, pipeline->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+			offsetof(TOS_push_constants, quantization_min), sizeof(quantization), quantization
+		);
+	}
+
+	if(mesh->vertex_allocation.page != bound_vertex_page)
+	{
+		VkDeviceSize offset = 0;
+		bound_vertex_page = mesh->vertex_allocation.page;
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, &TOS_arena.vertices.pages[bound_vertex_page].buffer, &offset);
+	}
+	if(mesh->index_allocation.page != bound_index_page || mesh->index_type != bound_index_type)
+	{
+		bound_index_page = mesh->index_allocation.page;
+		bound_index_type = mesh->index_type;
+		vkCmdBindIndexBuffer(command_buffer, TOS_arena.indices.pages[bound_index_page].buffer, 0, mesh->index_type);
+	}
+	for(size_t i = 0; i < range_count; i++)
+	{
+		vkCmdDrawIndexed
+		(
+			command_buffer, ranges[i].index_count, 1,
+			mesh->first_index + ranges[i].first_index,
+			mesh->base_vertex + ranges[i].vertex_offset, 0
+		);
+	}
+}
+
 void TOS_draw_mesh(TOS_mesh* mesh)
 {
-	VkDeviceSize offset = 0;
-	vkCmdBindVertexBuffers(command_buffer, 0, 1, &mesh->vertex_buffer, &offset);
-	vkCmdBindIndexBuffer(command_buffer, mesh->index_buffer, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline_layout, 0, 1, &descriptors.sets[work_manager.frame_idx], 0, nullptr);
-	vkCmdDrawIndexed(command_buffer, (uint32_t) mesh->indices.size(), 1, 0, 0, 0);
+	const TOS_mesh_lod& full = mesh->lods[0];
+	TOS_draw_mesh_ranges(mesh, &mesh->ranges[full.first_range], full.range_count);
+}
+
+void TOS_draw_mesh_lod(TOS_mesh* mesh, int lod)
+{
+	const TOS_mesh_lod& level = mesh->lods[lod];
+	TOS_draw_mesh_lod_ranges(mesh, lod, &mesh->ranges[level.first_range], level.range_count);
+}
+
+void TOS_draw_mesh_lod_ranges(TOS_mesh* mesh, int lod, const TOS_mesh_range* ranges, size_t range_count)
+{
+	TOS_draw_mesh_ranges(mesh, ranges, range_count);
+	lod_stats.draws++;
+	for(size_t i = 0; i < range_count; i++)
+		lod_stats.triangles += ranges[i].index_count / 3;
+	lod_stats.saved_triangles += (mesh->lods[0].index_count - mesh->lods[lod].index_count) / 3;
+}
+
+TOS_lod_stats TOS_get_lod_stats()
+{
+	return lod_stats;
 }
\ No newline at end of file
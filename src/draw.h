@@ -11,6 +11,9 @@ extern TOS_texture textures[MAX_TEXTURE_COUNT];
 void TOS_create_drawing_context(TOS_context* context, TOS_device* device, TOS_swapchain* swapchain);
 void TOS_destroy_drawing_context();
 
+// Has each frame's descriptor set pick up the textures' current samplers
+// and views before it is next used
+void TOS_invalidate_texture_descriptors();
 void TOS_begin_frame();
 VkCommandBuffer TOS_get_command_buffer();
 void TOS_end_frame();
@@ -20,4 +23,21 @@ void TOS_set_UBO(TOS_UBO* ubo);
 void TOS_set_push_constants(TOS_push_constants* constants);
 
 void TOS_clear_depth_buffer();
-void TOS_draw_mesh(TOS_mesh* mesh);
\ No newline at end of file
+void TOS_draw_mesh(TOS_mesh* mesh);
+// Draws only the given spans of the mesh's index buffer
+void TOS_draw_mesh_ranges(TOS_mesh* mesh, const TOS_mesh_range* ranges, size_t range_count);
+void TOS_draw_mesh_lod(TOS_mesh* mesh, int lod);
+// Draws spans within one level, such as its visible meshlets, and counts
+// them towards the level of detail stats as TOS_draw_mesh_lod does
+void TOS_draw_mesh_lod_ranges(TOS_mesh* mesh, int lod, const TOS_mesh_range* ranges, size_t range_count);
+
+// Triangles drawn through TOS_draw_mesh_lod and TOS_draw_mesh_lod_ranges
+// this frame, against what their full detail levels would have cost
+struct TOS_lod_stats
+{
+	size_t draws;
+	size_t triangles;
+	size_t saved_triangles;
+};
+
+TOS_lod_stats TOS_get_lod_stats();
\ No newline at end of file
@@ -0,0 +1,537 @@
+#include "fileio.h"
+
+#include "threads.h"
+#include "cowtools.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define TOS_HAS_IO_URING
+#endif
+
+// The kernel caps a single read at a little under 2 GiB
+#define MAX_READ_SIZE (1ull << 30)
+
+struct read_result
+{
+	size_t index;
+	std::vector<uint8_t> data;
+};
+
+// Hands files from whichever thread read them to the workers, and holds the
+// reader back once TOS_READ_QUEUE_DEPTH files or TOS_READ_BYTE_BUDGET bytes
+// are out
+struct read_pipeline
+{
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable released;
+	std::deque<read_result> results;
+	size_t held = 0;
+	size_t held_bytes = 0;
+	bool closed = false;
+	std::atomic<bool> failed {false};
+	std::exception_ptr error = nullptr;
+};
+
+static void fail(read_pipeline* pipeline, std::exception_ptr error)
+{
+	std::lock_guard<std::mutex> lock(pipeline->mutex);
+	if(pipeline->error == nullptr)
+		pipeline->error = error;
+	pipeline->failed = true;
+	pipeline->released.notify_all();
+}
+
+static void fail_read(read_pipeline* pipeline, const std::string& path, const char* what, int error)
+{
+	fail(pipeline, std::make_exception_ptr(std::runtime_error("TOS_read_files: failed to " + std::string(what) + " " + path + ": " + strerror(error))));
+}
+
+// A file larger than the whole budget is still let through once nothing
+// else is held, so it is read alone rather than never
+static bool has_room(const read_pipeline* pipeline, size_t size)
+{
+	if(pipeline->held == 0)
+		return true;
+	return pipeline->held < TOS_READ_QUEUE_DEPTH && pipeline->held_bytes + size <= TOS_READ_BYTE_BUDGET;
+}
+
+// Blocks until a file of the given size may be read; false once reading has
+// failed
+static bool acquire_slot(read_pipeline* pipeline, size_t size)
+{
+	std::unique_lock<std::mutex> lock(pipeline->mutex);
+	pipeline->released.wait(lock, [&]() { return has_room(pipeline, size) || pipeline->failed; });
+	if(pipeline->failed)
+		return false;
+	pipeline->held++;
+	pipeline->held_bytes += size;
+	return true;
+}
+
+static bool try_acquire_slot(read_pipeline* pipeline, size_t size)
+{
+	std::lock_guard<std::mutex> lock(pipeline->mutex);
+	if(!has_room(pipeline, size) || pipeline->failed)
+		return false;
+	pipeline->held++;
+	pipeline->held_bytes += size;
+	return true;
+}
+
+static void release_slot(read_pipeline* pipeline, size_t size)
+{
+	std::lock_guard<std::mutex> lock(pipeline->mutex);
+	pipeline->held--;
+	pipeline->held_bytes -= size;
+	pipeline->released.notify_all();
+}
+
+static void deliver(read_pipeline* pipeline, read_result&& result)
+{
+	std::lock_guard<std::mutex> lock(pipeline->mutex);
+	pipeline->results.push_back(std::move(result));
+	pipeline->ready.notify_one();
+}
+
+static void close_pipeline(read_pipeline* pipeline)
+{
+	std::lock_guard<std::mutex> lock(pipeline->mutex);
+	pipeline->closed = true;
+	pipeline->ready.notify_all();
+}
+
+static void work(read_pipeline* pipeline, const TOS_read_callback& on_read)
+{
+	while(true)
+	{
+		read_result result;
+		{
+			std::unique_lock<std::mutex> lock(pipeline->mutex);
+			pipeline->ready.wait(lock, [&]() { return !pipeline->results.empty() || pipeline->closed; });
+			if(pipeline->results.empty())
+				return;
+			result = std::move(pipeline->results.front());
+			pipeline->results.pop_front();
+		}
+		// After a failure the rest are only drained
+		if(!pipeline->failed)
+		{
+			try
+			{
+				on_read(result.index, result.data.data(), result.data.size());
+			}
+			catch(...)
+			{
+				fail(pipeline, std::current_exception());
+			}
+		}
+		size_t size = result.data.size();
+		result.data = {};
+		release_slot(pipeline, size);
+	}
+}
+
+// Returns the file descriptor, or -1 with the pipeline failed
+static int open_file(read_pipeline* pipeline, const std::string& path, size_t* size)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		fail_read(pipeline, path, "open", errno);
+		return -1;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0)
+	{
+		fail_read(pipeline, path, "stat", errno);
+		close(fd);
+		return -1;
+	}
+	*size = (size_t) info.st_size;
+	return fd;
+}
+
+static void read_with_threads(read_pipeline* pipeline, const std::vector<std::string>& paths)
+{
+	TOS_parallel_for
+	(
+		paths.size(),
+		[&](size_t i)
+		{
+			// Opened first, since the budget is charged by size
+			size_t size;
+			int fd = open_file(pipeline, paths[i], &size);
+			if(fd == -1)
+				return;
+			if(!acquire_slot(pipeline, size))
+			{
+				close(fd);
+				return;
+			}
+			read_result result;
+			result.index = i;
+			result.data.resize(size);
+			size_t done = 0;
+			// A file that ends early shrank since it was opened
+			int error = EIO;
+			while(done < size)
+			{
+				ssize_t count = pread(fd, result.data.data() + done, TOS_min(size - done, (size_t) MAX_READ_SIZE), done);
+				if(count < 0 && errno == EINTR)
+					continue;
+				if(count < 0)
+					error = errno;
+				if(count <= 0)
+					break;
+				done += count;
+			}
+			if(done < size)
+			{
+				fail_read(pipeline, paths[i], "read", error);
+				close(fd);
+				release_slot(pipeline, size);
+				return;
+			}
+			close(fd);
+			deliver(pipeline, std::move(result));
+		},
+		TOS_READ_THREAD_COUNT
+	);
+}
+
+#ifdef TOS_HAS_IO_URING
+
+// The rings shared with the kernel. The application owns the submission
+// tail and the completion head; the kernel moves the other two.
+struct uring
+{
+	int fd;
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	io_uring_cqe* cqes;
+};
+
+struct uring_read
+{
+	int fd;
+	size_t index;
+	size_t done;
+	std::vector<uint8_t> data;
+	iovec iov;
+};
+
+static bool create_uring(uring* ring, unsigned entries)
+{
+	io_uring_params params {};
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+	// Kernels before 5.1 and sandboxes that filter io_uring end up here
+	if(ring->fd < 0)
+		return false;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(single_mmap)
+		ring->sq_ring_size = ring->cq_ring_size = TOS_max(ring->sq_ring_size, ring->cq_ring_size);
+	ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = single_mmap ? ring->sq_ring : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = (io_uring_sqe*) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		if(ring->sq_ring != MAP_FAILED)
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		if(!single_mmap && ring->cq_ring != MAP_FAILED)
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		if(ring->sqes != MAP_FAILED)
+			munmap(ring->sqes, ring->sqes_size);
+		close(ring->fd);
+		return false;
+	}
+
+	uint8_t* sq = (uint8_t*) ring->sq_ring;
+	ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+	uint8_t* cq = (uint8_t*) ring->cq_ring;
+	ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+	ring->cqes = (io_uring_cqe*) (cq + params.cq_off.cqes);
+	return true;
+}
+
+static void destroy_uring(uring* ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+// Queues a read of whatever the file has left; the kernel sees it on the
+// next io_uring_enter
+static void queue_read(uring* ring, uring_read* read, uint64_t slot)
+{
+	read->iov.iov_base = read->data.data() + read->done;
+	read->iov.iov_len = TOS_min(read->data.size() - read->done, (size_t) MAX_READ_SIZE);
+
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = read->fd;
+	sqe->off = read->done;
+	sqe->addr = (uint64_t) (uintptr_t) &read->iov;
+	sqe->len = 1;
+	sqe->user_data = slot;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Waits out every read the kernel still holds, since each one writes into
+// its buffer until it completes. Reads queued but never submitted are
+// left in the ring, which is destroyed with them.
+static void drain_uring(uring* ring, std::vector<uring_read>* reads, unsigned in_flight)
+{
+	while(in_flight > 0)
+	{
+		int result = (int) syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			// Leak the buffers rather than free memory the kernel may still write to
+			new std::vector<uring_read>(std::move(*reads));
+			return;
+		}
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for(unsigned head = *ring->cq_head; head != tail; head++)
+		{
+			uring_read* read = &(*reads)[ring->cqes[head & *ring->cq_mask].user_data];
+			close(read->fd);
+			read->fd = -1;
+			in_flight--;
+		}
+		__atomic_store_n(ring->cq_head, tail, __ATOMIC_RELEASE);
+	}
+	for(uring_read& read : *reads)
+	{
+		if(read.fd != -1)
+			close(read.fd);
+		read.fd = -1;
+	}
+}
+
+static void read_with_uring(uring* ring, read_pipeline* pipeline, const std::vector<std::string>& paths)
+{
+	std::vector<uring_read> reads(TOS_READ_QUEUE_DEPTH);
+	std::vector<uint64_t> free_slots;
+	for(uint64_t s = 0; s < TOS_READ_QUEUE_DEPTH; s++)
+	{
+		reads[s].fd = -1;
+		free_slots.push_back(TOS_READ_QUEUE_DEPTH-1 - s);
+	}
+	size_t next = 0;
+	unsigned in_flight = 0;
+	unsigned unsubmitted = 0;
+	// Opened but not yet let through by the budget
+	int pending_fd = -1;
+	size_t pending_index = 0;
+	size_t pending_size = 0;
+
+	try
+	{
+		while(true)
+		{
+			while(!free_slots.empty() && !pipeline->failed)
+			{
+				if(pending_fd == -1)
+				{
+					if(next == paths.size())
+						break;
+					pending_index = next++;
+					pending_fd = open_file(pipeline, paths[pending_index], &pending_size);
+					if(pending_fd == -1)
+						break;
+				}
+				if(!try_acquire_slot(pipeline, pending_size))
+					break;
+				int fd = pending_fd;
+				pending_fd = -1;
+				if(pending_size == 0)
+				{
+					close(fd);
+					deliver(pipeline, {pending_index, {}});
+					continue;
+				}
+				uint64_t slot = free_slots.back();
+				uring_read* read = &reads[slot];
+				read->fd = fd;
+				read->index = pending_index;
+				read->done = 0;
+				read->data.resize(pending_size);
+				free_slots.pop_back();
+				queue_read(ring, read, slot);
+				in_flight++;
+				unsubmitted++;
+			}
+
+			if(in_flight == 0)
+			{
+				if(pending_fd == -1 || pipeline->failed)
+					break;
+				// The workers hold the whole budget; wait for enough to come back
+				if(acquire_slot(pipeline, pending_size))
+					release_slot(pipeline, pending_size);
+				continue;
+			}
+
+			int submitted = (int) syscall(__NR_io_uring_enter, ring->fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if(submitted < 0)
+			{
+				if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+					continue;
+				throw std::runtime_error(std::string("TOS_read_files: io_uring_enter failed: ") + strerror(errno));
+			}
+			unsubmitted -= (unsigned) TOS_min((unsigned) submitted, unsubmitted);
+
+			// Each completion is consumed and its slot settled before anything
+			// that may throw, so a drain after a throw sees only live reads
+			unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+			for(unsigned head = *ring->cq_head; head != tail; head++)
+			{
+				const io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+				uint64_t slot = cqe->user_data;
+				int result = cqe->res;
+				__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+				uring_read* read = &reads[slot];
+				if(result > 0)
+					read->done += result;
+				if(result > 0 && read->done < read->data.size() && !pipeline->failed)
+				{
+					// A short read; carry on from where it stopped
+					queue_read(ring, read, slot);
+					unsubmitted++;
+					continue;
+				}
+
+				close(read->fd);
+				read->fd = -1;
+				free_slots.push_back(slot);
+				in_flight--;
+				read_result delivered = {read->index, std::move(read->data)};
+				read->data = {};
+				if(read->done < delivered.data.size())
+				{
+					// A zero result means the file shrank since it was opened
+					release_slot(pipeline, delivered.data.size());
+					if(!pipeline->failed)
+						fail_read(pipeline, paths[read->index], "read", result < 0 ? -result : EIO);
+				}
+				else
+					deliver(pipeline, std::move(delivered));
+			}
+		}
+	}
+	catch(...)
+	{
+		if(pending_fd != -1)
+			close(pending_fd);
+		drain_uring(ring, &reads, in_flight - unsubmitted);
+		throw;
+	}
+	if(pending_fd != -1)
+		close(pending_fd);
+}
+
+#endif
+
+TOS_read_backend TOS_read_files(const std::vector<std::string>& paths, TOS_read_callback on_read, int thread_count)
+{
+	if(thread_count <= 0)
+		thread_count = TOS_get_thread_count();
+	thread_count = (int) TOS_clamp(paths.size(), (size_t) 1, (size_t) thread_count);
+
+	read_pipeline pipeline;
+	std::vector<std::thread> workers;
+	for(int i = 0; i < thread_count; i++)
+		workers.emplace_back(work, &pipeline, std::cref(on_read));
+
+	TOS_read_backend backend = TOS_READ_BACKEND_THREADS;
+	try
+	{
+#ifdef TOS_HAS_IO_URING
+		uring ring;
+		if(create_uring(&ring, TOS_READ_QUEUE_DEPTH))
+		{
+			backend = TOS_READ_BACKEND_IO_URING;
+			try
+			{
+				read_with_uring(&ring, &pipeline, paths);
+			}
+			catch(...)
+			{
+				destroy_uring(&ring);
+				throw;
+			}
+			destroy_uring(&ring);
+		}
+		else
+#endif
+		{
+			read_with_threads(&pipeline, paths);
+		}
+	}
+	catch(...)
+	{
+		fail(&pipeline, std::current_exception());
+	}
+
+	close_pipeline(&pipeline);
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	if(pipeline.error != nullptr)
+		std::rethrow_exception(pipeline.error);
+	return backend;
+}
+
+const char* TOS_get_read_backend_name(TOS_read_backend backend)
+{
+	switch(backend)
+	{
+		case TOS_READ_BACKEND_IO_URING:
+			return "io_uring";
+		case TOS_READ_BACKEND_THREADS:
+			return "threads";
+	}
+	return "unknown";
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+// Asynchronous whole-file reads. Many reads are kept in flight at once, on
+// io_uring where the kernel offers it and on a pool of threads issuing
+// pread otherwise, and each file is handed to a pool of workers as soon as
+// it arrives. Parsing and decoding one file thereby overlaps the reads of
+// the others instead of waiting behind them.
+
+// Reads in flight plus files waiting for or in their callback
+#define TOS_READ_QUEUE_DEPTH 64
+// Bytes those files may hold between them, which is what bounds the memory
+// read ahead of the workers. A larger file is read once nothing else is held.
+#define TOS_READ_BYTE_BUDGET (256ull << 20)
+// Threads issuing pread when io_uring is unavailable
+#define TOS_READ_THREAD_COUNT 8
+
+enum TOS_read_backend
+{
+	TOS_READ_BACKEND_IO_URING,
+	TOS_READ_BACKEND_THREADS
+};
+
+// Called on a worker thread with the whole file; the buffer is released
+// once it returns
+typedef std::function<void(size_t index, const uint8_t* data, size_t size)> TOS_read_callback;
+
+// Reads every path and calls on_read for each as its read completes, in
+// no particular order, on up to thread_count workers. Returns once every
+// callback is done, with the backend that did the reading. The first
+// failed read or exception from a callback stops further reads and is
+// rethrown.
+TOS_read_backend TOS_read_files(const std::vector<std::string>& paths, TOS_read_callback on_read, int thread_count=0);
+const char* TOS_get_read_backend_name(TOS_read_backend backend);
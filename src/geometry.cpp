@@ -74,6 +74,33 @@ TOS_sphere TOS_sphere::center_radius(glm::vec3 center, float r)
 	return s;
 }
 
+TOS_frustum TOS_frustum::view_projection(glm::mat4 VP)
+{
+	// Gribb and Hartmann, with glm's column-major rows read across columns
+	glm::vec4 rows[4];
+	for(int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(VP[0][i], VP[1][i], VP[2][i], VP[3][i]);
+	glm::vec4 coefficients[6] =
+	{
+		rows[3] + rows[0],
+		rows[3] - rows[0],
+		rows[3] + rows[1],
+		rows[3] - rows[1],
+		rows[2],
+		rows[3] - rows[2]
+	};
+
+	TOS_frustum frustum;
+	for(int i = 0; i < 6; i++)
+	{
+		glm::vec3 n = glm::vec3(coefficients[i]);
+		float length = glm::length(n);
+		frustum.planes[i].normal = n / length;
+		frustum.planes[i].d = -coefficients[i].w / length;
+	}
+	return frustum;
+}
+
 static int intersect_ray_AABB(glm::vec3 p, glm::vec3 d, TOS_AABB a, float& tmin, glm::vec3& q)
 {
 	tmin = 0.0f;
@@ -323,4 +350,32 @@ std::optional<TOS_raycast_hit> TOS_ray_sphere_intersect(TOS_ray ray, TOS_sphere
 		};
 	}
 	return hit;
-}
\ No newline at end of file
+}
+
+bool TOS_frustum_sphere_intersect(TOS_frustum frustum, TOS_sphere sphere)
+{
+	for(int i = 0; i < 6; i++)
+	{
+		if(glm::dot(frustum.planes[i].normal, sphere.center) - frustum.planes[i].d < -sphere.r)
+			return false;
+	}
+	return true;
+}
+
+bool TOS_frustum_AABB_intersect(TOS_frustum frustum, TOS_AABB aabb)
+{
+	// Only the corner furthest along each plane's normal needs testing
+	for(int i = 0; i < 6; i++)
+	{
+		glm::vec3 n = frustum.planes[i].normal;
+		glm::vec3 p
+		(
+			n.x >= 0 ? aabb.max.x : aabb.min.x,
+			n.y >= 0 ? aabb.max.y : aabb.min.y,
+			n.z >= 0 ? aabb.max.z : aabb.min.z
+		);
+		if(glm::dot(n, p) < frustum.planes[i].d)
+			return false;
+	}
+	return true;
+}
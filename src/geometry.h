@@ -46,6 +46,16 @@ struct TOS_sphere
 	static TOS_sphere center_radius(glm::vec3 center, float r);
 };
 
+// Planes face inwards, so a point is inside when dot(normal, p) >= d for all six
+struct TOS_frustum
+{
+	// Extracts the planes from a view-projection matrix with [0, 1] depth.
+	// Given P*V*M the planes come out in M's local space.
+	static TOS_frustum view_projection(glm::mat4 VP);
+
+	TOS_plane planes[6];
+};
+
 struct TOS_raycast_hit
 {
 	glm::vec3 point;
@@ -57,4 +67,6 @@ std::optional<TOS_raycast_hit> TOS_ray_AABB_intersect(TOS_ray ray, TOS_AABB aabb
 std::optional<TOS_raycast_hit> TOS_ray_OBB_intersect(TOS_ray ray, TOS_AABB aabb, glm::mat4 T);
 std::optional<TOS_raycast_hit> TOS_ray_plane_intersect(TOS_ray ray, TOS_plane plane);
 float TOS_ray_segment_nearest(TOS_ray ray, TOS_segment segment, glm::vec3* ray_pt=nullptr, glm::vec3* segment_pt=nullptr);
-std::optional<TOS_raycast_hit> TOS_ray_sphere_intersect(TOS_ray ray, TOS_sphere sphere);
\ No newline at end of file
+std::optional<TOS_raycast_hit> TOS_ray_sphere_intersect(TOS_ray ray, TOS_sphere sphere);
+bool TOS_frustum_sphere_intersect(TOS_frustum frustum, TOS_sphere sphere);
+bool TOS_frustum_AABB_intersect(TOS_frustum frustum, TOS_AABB aabb);
\ No newline at end of file
@@ -17,9 +17,15 @@ void TOS_create_gizmo_context(TOS_device* _device, TOS_camera* _camera)
 {
 	device = _device;
 
-	TOS_load_mesh(device, &transform_gizmo_meshes[0], "assets/meshes/gizmo_translate.obj");
-	TOS_load_mesh(device, &transform_gizmo_meshes[1], "assets/meshes/gizmo_rotate.obj");
-	TOS_load_mesh(device, &transform_gizmo_meshes[2], "assets/meshes/gizmo_scale.obj");
+	TOS_load_meshes
+	(
+		device,
+		{
+			{&transform_gizmo_meshes[0], "assets/meshes/gizmo_translate.obj"},
+			{&transform_gizmo_meshes[1], "assets/meshes/gizmo_rotate.obj"},
+			{&transform_gizmo_meshes[2], "assets/meshes/gizmo_scale.obj"}
+		}
+	);
 
 	camera = _camera;
 }
@@ -0,0 +1,47 @@
+#include "lod.h"
+
+#include "cowtools.h"
+#include <math.h>
+
+float TOS_project_lod_error(const TOS_mesh* mesh, glm::mat4 M, TOS_camera* camera, float viewport_height)
+{
+	glm::vec3 center = glm::vec3(M * glm::vec4((mesh->min + mesh->max) * 0.5f, 1.0f));
+	float scale = TOS_max(glm::length(glm::vec3(M[0])), TOS_max(glm::length(glm::vec3(M[1])), glm::length(glm::vec3(M[2]))));
+	float radius = glm::length(mesh->max - mesh->min) * 0.5f * scale;
+
+	// Error is taken at the nearest point of the bounding sphere, the most
+	// any part of the mesh could be magnified
+	float distance = glm::length(center - camera->transform.position) - radius;
+	if(distance <= camera->near)
+		return INFINITY;
+	// P[1][1] is the cotangent of half the vertical field of view
+	return scale * camera->P()[1][1] * viewport_height * 0.5f / distance;
+}
+
+int TOS_select_lod
+(
+	const TOS_mesh* mesh, glm::mat4 M, TOS_camera* camera, float viewport_height,
+	TOS_lod_state* state, float pixel_error
+)
+{
+	int lod_count = (int) mesh->lods.size();
+	int current = TOS_clamp(state->lod, 0, lod_count-1);
+	float pixels_per_unit = TOS_project_lod_error(mesh, M, camera, viewport_height);
+
+	// Levels are ordered by increasing error, so take the coarsest in budget
+	auto coarsest_within = [&](float budget)
+	{
+		int lod = 0;
+		while(lod+1 < lod_count && mesh->lods[lod+1].error * pixels_per_unit <= budget)
+			lod++;
+		return lod;
+	};
+
+	int target = coarsest_within(pixel_error);
+	// Refine as soon as the current level is out of budget, but only
+	// coarsen once the coarser level is well inside it
+	if(target > current)
+		target = TOS_max(current, coarsest_within(pixel_error * (1.0f - TOS_LOD_HYSTERESIS)));
+	state->lod = target;
+	return target;
+}
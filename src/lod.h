@@ -0,0 +1,28 @@
+#pragma once
+
+#include "vertices.h"
+#include "camera.h"
+
+// Level of detail selection by projected error. A level is good enough when
+// its geometric error, projected at the distance of the mesh's bounding
+// sphere, stays under a pixel budget.
+
+#define TOS_LOD_PIXEL_ERROR 1.0f
+// Fraction of the budget a coarser level must undercut before it replaces
+// the current one, so meshes near a threshold do not flicker between levels
+#define TOS_LOD_HYSTERESIS 0.25f
+
+// Per-instance selection state, kept across frames
+struct TOS_lod_state
+{
+	int lod = 0;
+};
+
+// Projected error in pixels of one unit of mesh-space error for a mesh
+// drawn with model matrix M, or infinity when the camera is inside its bounds
+float TOS_project_lod_error(const TOS_mesh* mesh, glm::mat4 M, TOS_camera* camera, float viewport_height);
+int TOS_select_lod
+(
+	const TOS_mesh* mesh, glm::mat4 M, TOS_camera* camera, float viewport_height,
+	TOS_lod_state* state, float pixel_error=TOS_LOD_PIXEL_ERROR
+);
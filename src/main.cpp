@@ -6,6 +6,10 @@
 #include "device.h"
 #include "swapchain.h"
 #include "pipeline.h"
+#include "upload.h"
+#include "texturefile.h"
+#include "texturestream.h"
+#include "mipmaps.h"
 #include "input.h"
 #include "gui.h"
 #include "timing.h"
@@ -15,6 +19,9 @@
 #include "gizmos.h"
 #include "draw.h"
 #include "shader_common.h"
+#include "obj/obj.h"
+#include "meshlets.h"
+#include "lod.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -31,7 +38,13 @@ static TOS_mesh sphere_mesh;
 static TOS_mesh aabb_mesh;
 static TOS_mesh screen_mesh;
 
+static std::vector<TOS_mesh_range> sponza_visible;
+static TOS_meshlet_cull_stats sponza_cull_stats;
+static TOS_lod_state sponza_lod;
+static TOS_lod_state sphere_lod;
+
 static TOS_pipeline pipeline;
+static TOS_pipeline packed_pipeline;
 
 static TOS_camera camera;
 static TOS_UBO uniforms;
@@ -182,6 +195,8 @@ void logic_tick()
 
 void render_tick()
 {
+	if(TOS_update_texture_streaming(&device))
+		TOS_invalidate_texture_descriptors();
 	TOS_begin_frame();
 	TOS_bind_pipeline(&pipeline);
 
@@ -195,8 +210,27 @@ void render_tick()
 	push_constant.M = model.M();
 	push_constant.texture_idx = 0;
 	push_constant.wireframe = wireframe_timeline.normalized();
+	TOS_bind_pipeline(&packed_pipeline);
 	TOS_set_push_constants(&push_constant);
-	TOS_draw_mesh(&sponza_mesh);
+	// Meshlets cover the full detail level only, so coarser levels draw whole
+	int lod = TOS_select_lod(&sponza_mesh, push_constant.M, &camera, (float) swapchain.extent.height, &sponza_lod);
+	if(lod == 0)
+	{
+		sponza_cull_stats = TOS_cull_meshlets(&sponza_mesh, push_constant.M, &camera, &sponza_visible);
+		TOS_draw_mesh_lod_ranges(&sponza_mesh, 0, sponza_visible.data(), sponza_visible.size());
+	}
+	else
+	{
+		sponza_cull_stats = {};
+		TOS_draw_mesh_lod(&sponza_mesh, lod);
+	}
+	// Feedback for the next frame's streaming, from the closest part of
+	// sponza drawn. The model's scale cancels out of the meshlet distance.
+	float pixels_per_unit = lod == 0 ?
+		camera.P()[1][1] * (float) swapchain.extent.height * 0.5f / sponza_cull_stats.nearest :
+		TOS_project_lod_error(&sponza_mesh, push_constant.M, &camera, (float) swapchain.extent.height);
+	TOS_request_texture_coverage(&textures[0], pixels_per_unit * sponza_mesh.texture_span);
+	TOS_bind_pipeline(&pipeline);
 
 	if(!rt_latch.state)
 	{
@@ -204,7 +238,7 @@ void render_tick()
 		push_constant.texture_idx = 1;
 		push_constant.wireframe = wireframe_timeline.normalized();
 		TOS_set_push_constants(&push_constant);
-		TOS_draw_mesh(&sphere_mesh);
+		TOS_draw_mesh_lod(&sphere_mesh, TOS_select_lod(&sphere_mesh, push_constant.M, &camera, (float) swapchain.extent.height, &sphere_lod));
 
 		if(TOS_is_transform_gizmo_active())
 		{
@@ -232,6 +266,26 @@ void render_tick()
 		TOS_gui_begin_overlay();
 		ImGui::Text("[SHIFT]+[TAB] to toggle overlay");
 		ImGui::Text("FPS: %d", TOS_get_FPS());
+		ImGui::Text
+		(
+			"Meshlets: %zu visible, %zu outside frustum, %zu backfacing, %zu draws",
+			sponza_cull_stats.visible, sponza_cull_stats.frustum_culled,
+			sponza_cull_stats.backface_culled, sponza_cull_stats.range_count
+		);
+		TOS_lod_stats lod_stats = TOS_get_lod_stats();
+		ImGui::Text
+		(
+			"LOD: %zu triangles in %zu draws, %zu saved, sponza at LOD%d",
+			lod_stats.triangles, lod_stats.draws, lod_stats.saved_triangles, sponza_lod.lod
+		);
+		TOS_memory_stats memory_stats = TOS_get_memory_stats(&device);
+		ImGui::Text
+		(
+			"Memory: %.1f of %.1f MiB in %zu blocks and %zu dedicated, %zu allocations, %.0f%% fragmented",
+			memory_stats.used / (1024.0 * 1024.0), memory_stats.reserved / (1024.0 * 1024.0),
+			memory_stats.block_count, memory_stats.dedicated_count, memory_stats.allocation_count,
+			memory_stats.fragmentation * 100.0f
+		);
 		ImGui::Checkbox("Raytracing", &rt_latch.state);
 		if(!rt_latch.state)
 			ImGui::Checkbox("Wireframe", &wireframe_latch.state);
@@ -246,18 +300,71 @@ int main(int argc, const char * argv[])
 {	
 	try
 	{
+		if(argc >= 3 && strcmp(argv[1], "--bench-obj-numbers") == 0)
+		{
+			TOS_OBJ_benchmark_numbers(argv[2]);
+			return 0;
+		}
+		if(argc >= 3 && strcmp(argv[1], "--bench-weld") == 0)
+		{
+			TOS_benchmark_welding(argv[2]);
+			return 0;
+		}
+		if(argc >= 3 && strcmp(argv[1], "--bench-vertex-cache") == 0)
+		{
+			TOS_benchmark_vertex_cache(argv[2]);
+			return 0;
+		}
+		if(argc >= 2 && strcmp(argv[1], "--bench-mipmaps") == 0)
+		{
+			uint32_t width = argc >= 4 ? (uint32_t) atoi(argv[2]) : 4096;
+			uint32_t height = argc >= 4 ? (uint32_t) atoi(argv[3]) : 4096;
+			TOS_benchmark_mipmaps(width, height);
+			return 0;
+		}
+		if(argc >= 2 && strcmp(argv[1], "--bench-textures") == 0)
+		{
+			TOS_benchmark_texture_loading(argc >= 3 ? argv[2] : "assets/textures/sponza");
+			return 0;
+		}
+		if(argc >= 3 && strcmp(argv[1], "--bake-textures") == 0)
+		{
+			// An optional format flag ahead of the files overrides the
+			// automatic choice
+			TOS_texture_compression compression = TOS_TEXTURE_COMPRESSION_AUTO;
+			int first = 2;
+			const char* flags[] = {"--rgba", "--bc1", "--bc3", "--bc7"};
+			const TOS_texture_compression choices[] = {TOS_TEXTURE_COMPRESSION_NONE, TOS_TEXTURE_COMPRESSION_BC1, TOS_TEXTURE_COMPRESSION_BC3, TOS_TEXTURE_COMPRESSION_BC7};
+			for(int i = 0; i < 4; i++)
+			{
+				if(strcmp(argv[2], flags[i]) == 0)
+				{
+					compression = choices[i];
+					first = 3;
+				}
+			}
+			TOS_bake_textures(std::vector<std::string>(argv + first, argv + argc), compression);
+			return 0;
+		}
+
 		TOS_create_context(&context, 1280, 720, "Renderer");
 		TOS_create_device(&context, &device);
 		TOS_create_swapchain(&context, &device, &swapchain);
+		TOS_create_geometry_arena(&device);
+		TOS_create_texture_streamer(&device);
 
 		logic_init();
 
 		TOS_create_image(&rt_frame, context.window_width, context.window_height);
 		TOS_create_texture(&device, &textures[3], &rt_frame);
 
-		TOS_load_texture(&device, &textures[0], "assets/textures/sponza/spnza_bricks_a_diff.png");
-		TOS_load_texture(&device, &textures[1], "assets/textures/red.png");
-		TOS_load_texture(&device, &textures[2], "assets/textures/gizmo.png");
+		TOS_stream_texture(&device, &textures[0], "assets/textures/sponza/spnza_bricks_a_diff.png");
+		std::vector<std::string> texture_paths =
+		{
+			"assets/textures/red.png",
+			"assets/textures/gizmo.png"
+		};
+		TOS_load_textures(&device, &textures[1], texture_paths);
 
 		TOS_create_drawing_context(&context, &device, &swapchain);
 
@@ -270,15 +377,35 @@ int main(int argc, const char * argv[])
 			.depth_compare_op = VK_COMPARE_OP_LESS
 		};
 		TOS_create_pipeline(&device, &swapchain, &descriptors, pipeline_spec, &pipeline);
+		pipeline_spec.vert_path = "build/assets/shaders/packed.vert.spv";
+		pipeline_spec.vertex_format = TOS_VERTEX_FORMAT_PACKED;
+		TOS_create_pipeline(&device, &swapchain, &descriptors, pipeline_spec, &packed_pipeline);
 
-		TOS_load_mesh(&device, &sponza_mesh, "assets/meshes/sponza.obj");
-		TOS_load_mesh(&device, &sphere_mesh, "assets/meshes/sphere.obj");
+		TOS_load_meshes
+		(
+			&device,
+			{
+				{&sponza_mesh, "assets/meshes/sponza.obj", {.vertex_format = TOS_VERTEX_FORMAT_PACKED, .split_indices = true, .build_meshlets = true, .lod_count = 4}},
+				{&sphere_mesh, "assets/meshes/sphere.obj", {.lod_count = 4}}
+			}
+		);
 		TOS_AABB_mesh(&device, &aabb_mesh, sphere_mesh.min, sphere_mesh.max);
 		TOS_screen_mesh(&device, &screen_mesh);
 
 		TOS_create_gui_context(&context, &device, &swapchain);
 
 		TOS_create_gizmo_context(&device, &camera);
+		TOS_flush_uploads(&device);
+		TOS_upload_stats upload_stats = TOS_get_upload_stats(&device);
+		std::cout << "TOS_upload: " << upload_stats.copies << " uploads, "
+		<< upload_stats.bytes / (1024.0 * 1024.0) << " MiB in "
+		<< upload_stats.submits << " submits, " << upload_stats.stalls << " stalls" << std::endl;
+		const TOS_geometry_upload_stats& geometry_stats = TOS_arena.stats;
+		std::cout << "TOS_geometry_arena: " << TOS_arena.vertices.pages.size() << " vertex and "
+		<< TOS_arena.indices.pages.size() << " index pages, "
+		<< geometry_stats.direct_uploads << " direct writes of " << geometry_stats.direct_bytes / (1024.0 * 1024.0) << " MiB, "
+		<< geometry_stats.staged_uploads << " staged of " << geometry_stats.staged_bytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+		TOS_print_memory_stats(&device);
 
 		while(!glfwWindowShouldClose(context.window_handle))
 		{
@@ -288,6 +415,15 @@ int main(int argc, const char * argv[])
 			render_tick();
 		}
 		vkDeviceWaitIdle(device.logical);
+		const TOS_streaming_stats& streaming_stats = texture_streamer.stats;
+		std::cout << "TOS_texture_streamer: " << streaming_stats.uploads << " level uploads, "
+		<< streaming_stats.bytes / (1024.0 * 1024.0) << " MiB, budget saturated in "
+		<< streaming_stats.saturated_frames << " frames" << std::endl;
+
+		// The textures loaded above, while their memory blocks still exist
+		for(int i = 0; i < 4; i++)
+			TOS_destroy_texture(&device, &textures[i]);
+		TOS_destroy_image(&rt_frame);
 
 		TOS_destroy_gizmo_context();
 
@@ -297,8 +433,11 @@ int main(int argc, const char * argv[])
 		TOS_destroy_mesh(&device, &aabb_mesh);
 		TOS_destroy_mesh(&device, &sphere_mesh);
 		TOS_destroy_mesh(&device, &screen_mesh);
+		TOS_destroy_pipeline(&device, &packed_pipeline);
 		TOS_destroy_pipeline(&device, &pipeline);
 		TOS_destroy_drawing_context();
+		TOS_destroy_texture_streamer(&device);
+		TOS_destroy_geometry_arena(&device);
 
 		TOS_destroy_swapchain(&device, &swapchain);
 		TOS_destroy_device(&context, &device);
@@ -0,0 +1,141 @@
+#include "numbers.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static const double exact_powers[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+	1e21, 1e22
+};
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Anything the fast path can't represent exactly goes through strtod,
+// which needs a terminated copy since the mapped text isn't.
+static const char* parse_float_slow(const char* text, const char* end, float* value)
+{
+	std::string copy(text, end - text);
+	char* stop;
+	*value = (float) strtod(copy.c_str(), &stop);
+	return text + (stop - copy.c_str());
+}
+
+const char* TOS_parse_float(const char* text, const char* end, float* value)
+{
+	const char* ptr = text;
+	bool negative = false;
+	if(ptr < end && (*ptr == '-' || *ptr == '+'))
+	{
+		negative = *ptr == '-';
+		ptr++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any_digits = false;
+
+	while(ptr < end && is_digit(*ptr))
+	{
+		any_digits = true;
+		if(mantissa != 0 || *ptr != '0')
+		{
+			if(digits < 19)
+				mantissa = mantissa * 10 + (*ptr - '0');
+			else
+				exponent++;
+			digits++;
+		}
+		ptr++;
+	}
+	if(ptr < end && *ptr == '.')
+	{
+		ptr++;
+		while(ptr < end && is_digit(*ptr))
+		{
+			any_digits = true;
+			if(mantissa != 0 || *ptr != '0')
+			{
+				if(digits < 19)
+				{
+					mantissa = mantissa * 10 + (*ptr - '0');
+					exponent--;
+				}
+				digits++;
+			}
+			else
+			{
+				exponent--;
+			}
+			ptr++;
+		}
+	}
+
+	// inf, nan and hex floats
+	if(!any_digits || (ptr < end && (*ptr == 'x' || *ptr == 'X')))
+		return parse_float_slow(text, end, value);
+
+	if(ptr < end && (*ptr == 'e' || *ptr == 'E'))
+	{
+		const char* exp_ptr = ptr + 1;
+		bool exp_negative = false;
+		if(exp_ptr < end && (*exp_ptr == '-' || *exp_ptr == '+'))
+		{
+			exp_negative = *exp_ptr == '-';
+			exp_ptr++;
+		}
+		if(exp_ptr < end && is_digit(*exp_ptr))
+		{
+			int exp_value = 0;
+			while(exp_ptr < end && is_digit(*exp_ptr))
+			{
+				if(exp_value < 10000)
+					exp_value = exp_value * 10 + (*exp_ptr - '0');
+				exp_ptr++;
+			}
+			exponent += exp_negative ? -exp_value : exp_value;
+			ptr = exp_ptr;
+		}
+	}
+
+	// Clinger's fast path: both operands are exact doubles, so the single
+	// rounding in the multiply or divide gives the correctly rounded result.
+	if(digits > 15 || exponent < -22 || exponent > 22)
+		return parse_float_slow(text, end, value);
+
+	double result = (double) mantissa;
+	if(exponent < 0)
+		result /= exact_powers[-exponent];
+	else
+		result *= exact_powers[exponent];
+	*value = (float) (negative ? -result : result);
+	return ptr;
+}
+
+const char* TOS_parse_int(const char* text, const char* end, int* value)
+{
+	const char* ptr = text;
+	bool negative = false;
+	if(ptr < end && (*ptr == '-' || *ptr == '+'))
+	{
+		negative = *ptr == '-';
+		ptr++;
+	}
+
+	int64_t result = 0;
+	while(ptr < end && is_digit(*ptr))
+	{
+		if(result <= INT32_MAX)
+			result = result * 10 + (*ptr - '0');
+		ptr++;
+	}
+	*value = (int) (negative ? -result : result);
+	return ptr;
+}
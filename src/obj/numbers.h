@@ -0,0 +1,9 @@
+#pragma once
+
+// Fixed-format number parsing for OBJ text.
+// Reads straight from a [text, end) span without touching the locale and
+// returns a pointer to the first character that is not part of the number.
+// Results match atof/atoi on the same text.
+
+const char* TOS_parse_float(const char* text, const char* end, float* value);
+const char* TOS_parse_int(const char* text, const char* end, int* value);
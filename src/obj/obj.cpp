@@ -1,35 +1,34 @@
 #include "obj.h"
 
+#include "numbers.h"
+#include "scan.h"
 #include "memory.h"
+#include "threads.h"
+#include "cowtools.h"
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <string>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/mman.h>
 
-static bool is_whitespace(char c)
+static char* seek_whitespace(char* text, char* end)
 {
-	return
-	c == ' ' ||
-	c == '\n' ||
-	c == '\t';
-}
-
-static char* seek_whitespace(char* text)
-{
-	while(*text != '\0' && !is_whitespace(*text))
-		text++;
-	return text;
+	return (char*) TOS_scan_whitespace(text, end);
 }
 
-static char* seek_glyph(char* text)
+static char* seek_glyph(char* text, char* end)
 {
-	while(*text != '\0' && is_whitespace(*text))
-		text++;
-	return text;
+	return (char*) TOS_scan_glyph(text, end);
 }
 
-static char* advance_token(char** text)
+static char* advance_token(char** text, char* end)
 {
-	*text = seek_whitespace(*text);
-	*text = seek_glyph(*text);
+	*text = seek_whitespace(*text, end);
+	*text = seek_glyph(*text, end);
 	return *text;
 }
 
@@ -39,15 +38,15 @@ struct token
 	size_t length;
 };
 
-static token consume_token(char** text)
+static token consume_token(char** text, char* end)
 {
-	char* start = seek_glyph(*text);
-	char* end = seek_whitespace(start);
-	advance_token(text);
+	char* start = seek_glyph(*text, end);
+	char* token_end = seek_whitespace(start, end);
+	advance_token(text, end);
 	return
 	{
 		.start = start,
-		.length = (size_t) (end-start)
+		.length = (size_t) (token_end-start)
 	};
 }
 
@@ -58,111 +57,383 @@ static bool token_says(token* tok, const char* text)
 	return strncmp(tok->start, text, tok->length) == 0;
 }
 
-static float consume_float(char** text)
+static float consume_float(char** text, char* end)
 {
-	return atof(consume_token(text).start);
+	token tok = consume_token(text, end);
+	float value;
+	TOS_parse_float(tok.start, tok.start + tok.length, &value);
+	return value;
 }
 
-enum face_component
+// Reads the v/vt/vn indices of one face point, with 0 for absent components.
+// The token is split in a single pass; components are read as far as the
+// following delimiter, so "1//3" has no vt.
+static void consume_face_point(char** text, char* end, int* components)
 {
-	FACE_V = (1 << 0),
-	FACE_VT = (1 << 1),
-	FACE_VN = (1 << 2)
-};
+	char* start = seek_glyph(*text, end);
+	TOS_face_token tok = TOS_scan_face_token(start, end);
+	*text = seek_glyph((char*) tok.end, end);
+
+	TOS_parse_int(tok.start, tok.end, &components[0]);
+	components[1] = 0;
+	components[2] = 0;
+	for(int i = 0; i < tok.slash_count; i++)
+		TOS_parse_int(tok.slashes[i]+1, tok.end, &components[i+1]);
+}
+
+// Parses the v/vt/vn records in [start, end) into obj and hands each face
+// to on_face as nine raw v/vt/vn indices, still possibly negative.
+template<typename F>
+static void parse_lines(char* start, char* end, TOS_OBJ* obj, F on_face)
+{
+	char* ptr = seek_glyph(start, end);
 
-static int classify_face(token* tok)
-{
-	char* ptr = tok->start;
-	char* end = tok->start + tok->length;
-	int delimiters = 0;
-	int component_flags = FACE_V;
-	while(ptr < end)
-	{	
-		if(*ptr == '/')
-		{	
-			if(delimiters == 0)
-				component_flags |= FACE_VT;
-			else if(delimiters == 1)
-				component_flags |= FACE_VN;
-			delimiters += 1;
-			
+	token tok;
+	do
+	{
+		tok = consume_token(&ptr, end);
+		if(token_says(&tok, "v"))
+		{
+			obj->v.push_back(consume_float(&ptr, end));
+			obj->v.push_back(consume_float(&ptr, end));
+			obj->v.push_back(consume_float(&ptr, end));
+		}
+		else if(token_says(&tok, "vt"))
+		{
+			obj->vt.push_back(consume_float(&ptr, end));
+			obj->vt.push_back(consume_float(&ptr, end));
+		}
+		else if(token_says(&tok, "vn"))
+		{
+			obj->vn.push_back(consume_float(&ptr, end));
+			obj->vn.push_back(consume_float(&ptr, end));
+			obj->vn.push_back(consume_float(&ptr, end));
+		}
+		else if(token_says(&tok, "f"))
+		{
+			int face[9];
+			for(int pt_idx = 0; pt_idx < 3; pt_idx ++)
+				consume_face_point(&ptr, end, &face[pt_idx*3]);
+			on_face(face);
 		}
-		ptr++;
 	}
-	return component_flags;
+	while(tok.length > 0);
 }
 
-static char* seek_face_component(char* text)
+// A contiguous run of whole lines, parsed independently of its neighbours.
+// Negative (relative) face indices can only be resolved against the number
+// of attributes seen so far, so they are made chunk-relative here and the
+// positions are remembered so the merge can add the preceding chunks' counts.
+struct chunk
 {
-	while(*text != '\0' && *text != '/')
-		text++;
-	return text+1;
-}
+	char* start;
+	char* end;
+	TOS_OBJ obj;
+	std::vector<size_t> relative;
+};
 
-static int read_face_component(token* tok, int component)
+static void parse_chunk(chunk* chunk)
 {
-	char* text = tok->start;
-	int component_pos =
-	component == FACE_V ? 0 :
-	component == FACE_VT ? 1 :
-	2;
-	for(int i = 0; i < component_pos; i++)
-		text = seek_face_component(text);
-	return atoi(text);
+	TOS_OBJ* obj = &chunk->obj;
+	parse_lines
+	(
+		chunk->start, chunk->end, obj,
+		[&](int* face)
+		{
+			size_t counts[3] =
+			{
+				obj->v.size() / 3,
+				obj->vt.size() / 2,
+				obj->vn.size() / 3
+			};
+			for(int i = 0; i < 9; i++)
+			{
+				if(face[i] < 0)
+				{
+					face[i] = (int) counts[i % 3] + face[i] + 1;
+					chunk->relative.push_back(obj->f.size());
+				}
+				obj->f.push_back(face[i]);
+			}
+		}
+	);
 }
 
 void TOS_OBJ_load(TOS_OBJ* obj, const char* path)
 {
-	*obj =
+	size_t file_size;
+	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_READ, &file_size, TOS_FILE_MAP_SEQUENTIAL | TOS_FILE_MAP_WILLNEED);
+
+	chunk whole =
 	{
-		.v = std::vector<float>(),
-		.vt = std::vector<float>(),
-		.vn = std::vector<float>(),
-		.f = std::vector<int>(),
+		.start = file_data,
+		.end = file_data + file_size
 	};
+	parse_chunk(&whole);
+	*obj = std::move(whole.obj);
+
+	TOS_unmap_file(file_data, file_size);
+}
+
+#define MIN_CHUNK_SIZE (1 << 20)
+
+void TOS_OBJ_load_parallel(TOS_OBJ* obj, const char* path, int thread_count)
+{
+	if(thread_count <= 0)
+		thread_count = TOS_get_thread_count();
 
+	// Every chunk is parsed at once, so fault the whole file in up front
+	// rather than from all the threads
 	size_t file_size;
-	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_PRIVATE, &file_size);
+	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_READ, &file_size, TOS_FILE_MAP_POPULATE);
+	char* file_end = file_data + file_size;
 
-	char* ptr = seek_glyph(file_data);
+	size_t chunk_count = TOS_clamp(file_size / MIN_CHUNK_SIZE, 1, (size_t) thread_count);
+	std::vector<chunk> chunks(chunk_count);
+	char* start = file_data;
+	for(size_t i = 0; i < chunk_count; i++)
+	{
+		char* end = i == chunk_count-1 ? file_end : file_data + file_size / chunk_count * (i+1);
+		end = TOS_max(end, start);
+		if(end > file_data && end < file_end && *(end-1) != '\n')
+			end = (char*) TOS_min(TOS_scan_newline(end, file_end) + 1, file_end);
+		chunks[i].start = start;
+		chunks[i].end = end;
+		start = end;
+	}
 
-	token tok;
-	do
+	TOS_parallel_for
+	(
+		chunk_count,
+		[&](size_t i) { parse_chunk(&chunks[i]); },
+		thread_count
+	);
+
+	std::vector<size_t> offsets[4];
+	size_t totals[4] = {0, 0, 0, 0};
+	for(size_t i = 0; i < chunk_count; i++)
 	{
-		tok = consume_token(&ptr);
-		if(token_says(&tok, "v"))
+		std::vector<float>* arrays[3] = {&chunks[i].obj.v, &chunks[i].obj.vt, &chunks[i].obj.vn};
+		for(int j = 0; j < 3; j++)
 		{
-			obj->v.push_back(consume_float(&ptr));
-			obj->v.push_back(consume_float(&ptr));
-			obj->v.push_back(consume_float(&ptr));
+			offsets[j].push_back(totals[j]);
+			totals[j] += arrays[j]->size();
 		}
-		else if(token_says(&tok, "vt"))
+		offsets[3].push_back(totals[3]);
+		totals[3] += chunks[i].obj.f.size();
+	}
+
+	*obj =
+	{
+		.v = std::vector<float>(totals[0]),
+		.vt = std::vector<float>(totals[1]),
+		.vn = std::vector<float>(totals[2]),
+		.f = std::vector<int>(totals[3]),
+	};
+
+	TOS_parallel_for
+	(
+		chunk_count,
+		[&](size_t i)
 		{
-			obj->vt.push_back(consume_float(&ptr));
-			obj->vt.push_back(consume_float(&ptr));
+			TOS_OBJ* part = &chunks[i].obj;
+			std::copy(part->v.begin(), part->v.end(), obj->v.begin() + offsets[0][i]);
+			std::copy(part->vt.begin(), part->vt.end(), obj->vt.begin() + offsets[1][i]);
+			std::copy(part->vn.begin(), part->vn.end(), obj->vn.begin() + offsets[2][i]);
+			std::copy(part->f.begin(), part->f.end(), obj->f.begin() + offsets[3][i]);
+
+			int bases[3] =
+			{
+				(int) (offsets[0][i] / 3),
+				(int) (offsets[1][i] / 2),
+				(int) (offsets[2][i] / 3)
+			};
+			for(size_t pos : chunks[i].relative)
+				obj->f[offsets[3][i] + pos] += bases[pos % 3];
+			*part = {};
+		},
+		thread_count
+	);
+
+	TOS_unmap_file(file_data, file_size);
+}
+
+// Like parse_lines, but resolves negative indices against everything parsed
+// into obj so far before passing the face on
+static void parse_resolved(char* start, char* end, TOS_OBJ* obj, const std::function<void(const int* face)>& on_face)
+{
+	parse_lines
+	(
+		start, end, obj,
+		[&](const int* raw)
+		{
+			size_t counts[3] =
+			{
+				obj->v.size() / 3,
+				obj->vt.size() / 2,
+				obj->vn.size() / 3
+			};
+			int face[9];
+			for(int i = 0; i < 9; i++)
+				face[i] = raw[i] < 0 ? (int) counts[i % 3] + raw[i] + 1 : raw[i];
+			on_face(face);
 		}
-		else if(token_says(&tok, "vn"))
+	);
+}
+
+void TOS_OBJ_count(TOS_OBJ_counts* counts, const char* text, size_t size)
+{
+	*counts = {};
+	const char* end = text + size;
+	const char* line = text;
+	while(line < end)
+	{
+		const char* start = TOS_scan_glyph(line, end);
+		const char* next = TOS_scan_newline(start, end);
+		if(start+1 < end && (start[1] == ' ' || start[1] == '\t'))
 		{
-			obj->vn.push_back(consume_float(&ptr));
-			obj->vn.push_back(consume_float(&ptr));
-			obj->vn.push_back(consume_float(&ptr));
+			if(start[0] == 'v')
+				counts->v++;
+			else if(start[0] == 'f')
+				counts->f++;
 		}
-		else if(token_says(&tok, "f"))
+		else if(start+2 < end && start[0] == 'v' && (start[2] == ' ' || start[2] == '\t'))
 		{
-			for(int pt_idx = 0; pt_idx < 3; pt_idx ++)
-			{
-				token ftok = consume_token(&ptr);
-				int component_flags = classify_face(&ftok);
-				for(int component_idx = 0; component_idx < 3; component_idx++)
-				{
-					int component_flag = 1 << component_idx;
-					int component = component_flags & component_flag ? read_face_component(&ftok, component_flag) : 0;
-					obj->f.push_back(component);
-				}
-			}
+			if(start[1] == 't')
+				counts->vt++;
+			else if(start[1] == 'n')
+				counts->vn++;
+		}
+		line = next + 1;
+	}
+}
+
+void TOS_OBJ_parse(TOS_OBJ* obj, char* text, size_t size, std::function<void(const int* face)> on_face)
+{
+	parse_resolved(text, text + size, obj, on_face);
+}
+
+void TOS_OBJ_stream(TOS_OBJ* obj, const char* path, std::function<void(const int* face)> on_face, size_t window_size)
+{
+	*obj = {};
+
+	size_t file_size;
+	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_READ, &file_size, TOS_FILE_MAP_SEQUENTIAL);
+	char* file_end = file_data + file_size;
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	window_size = TOS_max(window_size, page_size);
+
+	char* start = file_data;
+	char* released = file_data;
+	while(start < file_end)
+	{
+		char* end = start + TOS_min(window_size, (size_t) (file_end - start));
+		if(end < file_end && *(end-1) != '\n')
+			end = (char*) TOS_min(TOS_scan_newline(end, file_end) + 1, file_end);
+		parse_resolved(start, end, obj, on_face);
+		start = end;
+
+		// Hand back the pages behind the window; the mapping is read only,
+		// so they are simply dropped rather than swapped
+		char* release_end = file_data + (size_t) (start - file_data) / page_size * page_size;
+		if(release_end > released)
+		{
+#ifdef MADV_DONTNEED
+			madvise(released, release_end - released, MADV_DONTNEED);
+#endif
+			released = release_end;
+		}
+	}
+
+	TOS_unmap_file(file_data, file_size);
+}
+
+void TOS_OBJ_benchmark_numbers(const char* path)
+{
+	size_t file_size;
+	char* file_data = (char*) TOS_map_file(path, TOS_FILE_MAP_READ, &file_size, TOS_FILE_MAP_POPULATE);
+	char* end = file_data + file_size;
+
+	// Gather the coordinate tokens once so both parsers see the same spans
+	std::vector<token> tokens;
+	size_t token_bytes = 0;
+	char* ptr = seek_glyph(file_data, end);
+	token tok;
+	do
+	{
+		tok = consume_token(&ptr, end);
+		int arity =
+		token_says(&tok, "v") ? 3 :
+		token_says(&tok, "vt") ? 2 :
+		token_says(&tok, "vn") ? 3 :
+		0;
+		for(int i = 0; i < arity; i++)
+		{
+			tokens.push_back(consume_token(&ptr, end));
+			token_bytes += tokens.back().length;
 		}
 	}
 	while(tok.length > 0);
 
+	if(tokens.empty())
+	{
+		std::cout << "TOS_OBJ_benchmark_numbers: no coordinates in " << path << std::endl;
+		TOS_unmap_file(file_data, file_size);
+		return;
+	}
+
+	size_t mismatches = 0;
+	for(size_t i = 0; i < tokens.size(); i++)
+	{
+		float fast;
+		TOS_parse_float(tokens[i].start, tokens[i].start + tokens[i].length, &fast);
+		float slow = (float) atof(std::string(tokens[i].start, tokens[i].length).c_str());
+		if(memcmp(&fast, &slow, sizeof(float)) != 0)
+			mismatches++;
+	}
+
+	// atof runs straight on the mapping, as the loader used to
+	auto run_atof = [&]()
+	{
+		float sum = 0;
+		for(size_t i = 0; i < tokens.size(); i++)
+			sum += (float) atof(tokens[i].start);
+		return sum;
+	};
+	auto run_fast = [&]()
+	{
+		float sum = 0;
+		for(size_t i = 0; i < tokens.size(); i++)
+		{
+			float value;
+			TOS_parse_float(tokens[i].start, tokens[i].start + tokens[i].length, &value);
+			sum += value;
+		}
+		return sum;
+	};
+	auto throughput = [&](auto run)
+	{
+		volatile float sink = 0;
+		int passes = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		double elapsed = 0;
+		do
+		{
+			sink = sink + run();
+			passes++;
+			elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		while(elapsed < 0.5);
+		return (double) token_bytes * passes / elapsed / (1024.0 * 1024.0);
+	};
+
+	double atof_rate = throughput(run_atof);
+	double fast_rate = throughput(run_fast);
+	std::cout << "TOS_OBJ_benchmark_numbers: " << path << "\n"
+	<< "\t" << tokens.size() << " floats, " << token_bytes << " bytes\n"
+	<< "\tatof:            " << atof_rate << " MB/s\n"
+	<< "\tTOS_parse_float: " << fast_rate << " MB/s (" << fast_rate / atof_rate << "x)\n"
+	<< "\tmismatches:      " << mismatches << std::endl;
+
 	TOS_unmap_file(file_data, file_size);
-}
\ No newline at end of file
+}
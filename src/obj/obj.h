@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <vector>
 #include <map>
+#include <functional>
 
 /*struct TOS_MTL
 {
@@ -31,4 +32,33 @@ struct TOS_OBJ
 	std::vector<int> f;
 };
 
-void TOS_OBJ_load(TOS_OBJ* obj, const char* path);
\ No newline at end of file
+void TOS_OBJ_load(TOS_OBJ* obj, const char* path);
+// Splits the file at line boundaries and parses the pieces on worker threads.
+// The result is identical to TOS_OBJ_load.
+void TOS_OBJ_load_parallel(TOS_OBJ* obj, const char* path, int thread_count=0);
+
+// Number of records of each kind; f counts triangles
+struct TOS_OBJ_counts
+{
+	size_t v;
+	size_t vt;
+	size_t vn;
+	size_t f;
+};
+
+// Counts records by their leading keyword without parsing any numbers
+void TOS_OBJ_count(TOS_OBJ_counts* counts, const char* text, size_t size);
+// Appends the attributes in text to obj and passes faces to on_face as
+// TOS_OBJ_stream does. Reserve obj's arrays first to parse without regrowth.
+void TOS_OBJ_parse(TOS_OBJ* obj, char* text, size_t size, std::function<void(const int* face)> on_face);
+
+#define TOS_OBJ_STREAM_WINDOW (64 << 20)
+
+// Parses the file a window at a time and releases the pages behind it.
+// Only v, vt and vn are kept in obj; each face is passed to on_face as nine
+// resolved 1-based v/vt/vn indices (0 where absent) and is not stored.
+void TOS_OBJ_stream(TOS_OBJ* obj, const char* path, std::function<void(const int* face)> on_face, size_t window_size=TOS_OBJ_STREAM_WINDOW);
+
+// Times TOS_parse_float against atof over the coordinates in an OBJ file
+// and prints the throughput of each in MB/s.
+void TOS_OBJ_benchmark_numbers(const char* path);
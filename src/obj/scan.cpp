@@ -0,0 +1,155 @@
+#include "scan.h"
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BLOCK_SIZE 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BLOCK_SIZE 16
+#else
+#define BLOCK_SIZE 0
+#endif
+
+static bool is_stop(char c)
+{
+	return
+	c == ' ' ||
+	c == '\n' ||
+	c == '\t' ||
+	c == '\0';
+}
+
+#if BLOCK_SIZE > 0
+
+#if BLOCK_SIZE == 32
+typedef __m256i block;
+static block load_block(const char* text) { return _mm256_loadu_si256((const __m256i*) text); }
+static block splat(char c) { return _mm256_set1_epi8(c); }
+static block equal(block a, block b) { return _mm256_cmpeq_epi8(a, b); }
+static block either(block a, block b) { return _mm256_or_si256(a, b); }
+static uint32_t mask(block a) { return (uint32_t) _mm256_movemask_epi8(a); }
+#else
+typedef __m128i block;
+static block load_block(const char* text) { return _mm_loadu_si128((const __m128i*) text); }
+static block splat(char c) { return _mm_set1_epi8(c); }
+static block equal(block a, block b) { return _mm_cmpeq_epi8(a, b); }
+static block either(block a, block b) { return _mm_or_si128(a, b); }
+static uint32_t mask(block a) { return (uint32_t) _mm_movemask_epi8(a); }
+#endif
+
+static const uint32_t full_mask = BLOCK_SIZE == 32 ? 0xFFFFFFFF : 0xFFFF;
+
+// One bit per byte: set where the byte ends a token
+static uint32_t stop_mask(block b)
+{
+	block stops = either
+	(
+		either(equal(b, splat(' ')), equal(b, splat('\n'))),
+		either(equal(b, splat('\t')), equal(b, splat('\0')))
+	);
+	return mask(stops);
+}
+
+static int lowest_bit(uint32_t bits)
+{
+	return __builtin_ctz(bits);
+}
+
+#endif
+
+const char* TOS_scan_whitespace(const char* text, const char* end)
+{
+#if BLOCK_SIZE > 0
+	while(end - text >= BLOCK_SIZE)
+	{
+		uint32_t bits = stop_mask(load_block(text));
+		if(bits != 0)
+			return text + lowest_bit(bits);
+		text += BLOCK_SIZE;
+	}
+#endif
+	while(text < end && !is_stop(*text))
+		text++;
+	return text;
+}
+
+const char* TOS_scan_glyph(const char* text, const char* end)
+{
+	// Runs of whitespace are almost always a single byte
+	if(text < end && (*text == '\0' || !is_stop(*text)))
+		return text;
+#if BLOCK_SIZE > 0
+	while(end - text >= BLOCK_SIZE)
+	{
+		block b = load_block(text);
+		uint32_t bits = ~(stop_mask(b) & ~mask(equal(b, splat('\0')))) & full_mask;
+		if(bits != 0)
+			return text + lowest_bit(bits);
+		text += BLOCK_SIZE;
+	}
+#endif
+	while(text < end && *text != '\0' && is_stop(*text))
+		text++;
+	return text;
+}
+
+const char* TOS_scan_newline(const char* text, const char* end)
+{
+#if BLOCK_SIZE > 0
+	while(end - text >= BLOCK_SIZE)
+	{
+		uint32_t bits = mask(equal(load_block(text), splat('\n')));
+		if(bits != 0)
+			return text + lowest_bit(bits);
+		text += BLOCK_SIZE;
+	}
+#endif
+	while(text < end && *text != '\n')
+		text++;
+	return text;
+}
+
+TOS_face_token TOS_scan_face_token(const char* text, const char* end)
+{
+	TOS_face_token tok =
+	{
+		.start = text,
+		.end = text,
+		.slashes = {nullptr, nullptr},
+		.slash_count = 0
+	};
+	const char* ptr = text;
+
+#if BLOCK_SIZE > 0
+	while(end - ptr >= BLOCK_SIZE)
+	{
+		block b = load_block(ptr);
+		uint32_t stops = stop_mask(b);
+		uint32_t slashes = mask(equal(b, splat('/')));
+		if(stops != 0)
+			slashes &= (1u << lowest_bit(stops)) - 1;
+		while(slashes != 0 && tok.slash_count < 2)
+		{
+			tok.slashes[tok.slash_count++] = ptr + lowest_bit(slashes);
+			slashes &= slashes - 1;
+		}
+		if(stops != 0)
+		{
+			tok.end = ptr + lowest_bit(stops);
+			return tok;
+		}
+		ptr += BLOCK_SIZE;
+	}
+#endif
+
+	while(ptr < end && !is_stop(*ptr))
+	{
+		if(*ptr == '/' && tok.slash_count < 2)
+			tok.slashes[tok.slash_count++] = ptr;
+		ptr++;
+	}
+	tok.end = ptr;
+	return tok;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+// Vectorized scanning over OBJ text.
+// Whitespace is ' ', '\t' and '\n'; '\0' also ends a token.
+// Uses AVX2 or SSE2 when the compiler targets them, with a scalar fallback.
+
+const char* TOS_scan_whitespace(const char* text, const char* end);
+const char* TOS_scan_glyph(const char* text, const char* end);
+const char* TOS_scan_newline(const char* text, const char* end);
+
+struct TOS_face_token
+{
+	const char* start;
+	const char* end;
+	const char* slashes[2];
+	int slash_count;
+};
+
+// Finds the end of the token at text and its first two '/' delimiters in one pass
+TOS_face_token TOS_scan_face_token(const char* text, const char* end);
@@ -0,0 +1,64 @@
+#include "threads.h"
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include "cowtools.h"
+
+int TOS_get_thread_count()
+{
+	int count = (int) std::thread::hardware_concurrency();
+	return TOS_max(count, 1);
+}
+
+void TOS_parallel_for(size_t count, std::function<void(size_t)> body, int thread_count)
+{
+	if(thread_count <= 0)
+		thread_count = TOS_get_thread_count();
+	thread_count = (int) TOS_min((size_t) thread_count, count);
+
+	if(thread_count <= 1)
+	{
+		for(size_t i = 0; i < count; i++)
+			body(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error = nullptr;
+	std::atomic_flag error_set = ATOMIC_FLAG_INIT;
+	auto work = [&]()
+	{
+		try
+		{
+			for(size_t i = next++; i < count; i = next++)
+				body(i);
+		}
+		catch(...)
+		{
+			if(!error_set.test_and_set())
+				error = std::current_exception();
+			next = count;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for(int i = 1; i < thread_count; i++)
+		workers.emplace_back(work);
+	work();
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	if(error != nullptr)
+		std::rethrow_exception(error);
+}
+
+static std::mutex print_mutex;
+
+void TOS_print_line(std::ostream& stream, const std::string& line)
+{
+	std::lock_guard<std::mutex> lock(print_mutex);
+	stream << line << std::endl;
+}
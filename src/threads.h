@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+#include <ostream>
+#include <string>
+
+int TOS_get_thread_count();
+void TOS_parallel_for(size_t count, std::function<void(size_t)> body, int thread_count=0);
+// Writes the line and a newline as one piece, so that reports from worker
+// threads never interleave
+void TOS_print_line(std::ostream& stream, const std::string& line);